@@ -0,0 +1,75 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "cross_platform.h"
+
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#define ADMISSION_MAX_CONNECTIONS 4096      // concurrent client connections overall; 0 disables the cap
+#define ADMISSION_MAX_PER_CLIENT 1024       // concurrent connections from one client IP; 0 disables the cap
+#define ADMISSION_FD_HIGH_PERCENT 90        // accepting pauses once this share of RLIMIT_NOFILE is open
+#define ADMISSION_FD_LOW_PERCENT 75         // ... and resumes below this one
+#define ADMISSION_MEMORY_HIGH_PERCENT 85    // same for resident memory, as a share of physical memory
+#define ADMISSION_MEMORY_LOW_PERCENT 75
+#define ADMISSION_SAMPLE_MS 100             // fd and memory usage are sampled at most this often
+#define ADMISSION_PAUSE_MS 100              // a paused accept loop looks again after this long
+#define ADMISSION_RETRY_AFTER_SECONDS 5     // advertised to clients turned away
+#define ADMISSION_DRAIN_BYTES 65536         // request bytes read away from a turned-away client before closing
+
+class AdmissionControl;
+
+// One admitted connection's place under the caps, given back when it is destroyed. Moves along
+// with the connection, e.g. from an event loop to the threaded handler.
+class Admission {
+private:
+    AdmissionControl* control;
+    uint32_t client_ip;
+
+public:
+    Admission() : control(nullptr), client_ip(0) {}
+    Admission(AdmissionControl* control, uint32_t client_ip) : control(control), client_ip(client_ip) {}
+    Admission(Admission&& other) noexcept : control(other.control), client_ip(other.client_ip) { other.control = nullptr; }
+    Admission& operator=(Admission&& other) noexcept;
+    Admission(const Admission&) = delete;
+    Admission& operator=(const Admission&) = delete;
+    ~Admission();
+
+    explicit operator bool() const { return control != nullptr; }
+};
+
+// Decides in the accept path whether a new connection is served. Connections over the global or
+// per-client cap are turned away at once with a 503 that costs one send, and while open file
+// descriptors or resident memory are above their high watermark the accept loop stops accepting
+// until usage falls below the low one, leaving new connections in the listen backlog.
+class AdmissionControl {
+private:
+    std::atomic<int> total{0};
+    std::mutex clients_mutex;
+    std::unordered_map<uint32_t, int> clients;     // open connections by client IPv4 address
+
+    std::mutex sample_mutex;
+    std::chrono::steady_clock::time_point lastSample;
+    bool overloaded = false;
+
+    void release(uint32_t client_ip);
+    // Refreshes `overloaded` from /proc when the last sample is older than ADMISSION_SAMPLE_MS.
+    void sample();
+
+    friend class Admission;
+
+public:
+    // An empty Admission when the connection would go over a cap.
+    Admission admit(const sockaddr_in& client_addr);
+    // True while fd or memory usage is above its high watermark, until it falls below the low one.
+    // Always false where usage cannot be sampled.
+    bool shouldPause();
+    int active() const { return total.load(std::memory_order_relaxed); }
+
+    // Answers 503 with Retry-After and closes the socket, reading away only the request bytes that
+    // have already arrived so the close does not reset the connection.
+    static void reject(socket_t client_fd);
+};
+
+#endif // ADMISSION_H
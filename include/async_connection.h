@@ -0,0 +1,63 @@
+#ifndef ASYNC_CONNECTION_H
+#define ASYNC_CONNECTION_H
+
+#include "async_io.h"
+#include "proxy.h"
+
+// A client connection served by coroutines on an event loop instead of a thread of its own. The
+// steps read like the threaded handler's, but every wait suspends the coroutine instead of
+// blocking, so a few loop threads multiplex any number of connections, and an idle one costs only
+// its coroutine frames. CONNECT tunnels and plain requests are relayed here, with CPU-heavy steps
+// handed to the work pool; requests that may be answered from the cache or collapsed go to the
+// threaded handler, whose helpers block, together with the bytes already read.
+class AsyncConnection {
+private:
+    Proxy& proxy;
+    AsyncIo io;
+    socket_t client_fd;
+    socket_t remote_fd;
+    sockaddr_in client_addr;
+    bool handedOff;
+    bool shutDown;
+    const char* relayError;         // first failure of either tunnel direction
+    std::string head;
+    HttpRequest request;
+    std::vector<std::string> capturedResponses;     // response heads of a plaintext tunnel, parsed once it is over
+    ObjectPool<ConnectionInfo>::Handle info;
+    Admission admission;
+    ConnectionEntry entry;
+    RateLimit rateLimit;
+    ConnectionDeadlines deadlines;
+    std::chrono::steady_clock::time_point acceptedAt;
+    bool firstUpstreamByte;
+    bool clientSpoke;
+
+    AsyncConnection(Proxy& proxy, EventLoop& loop, socket_t client_fd, std::chrono::steady_clock::time_point accepted_at,
+                    Admission admission);
+
+    Task<> run();
+    // Unlike the threaded handler, a head split over several segments is collected before routing.
+    Task<bool> readHead();
+    // Answers with a canned response and records the transaction.
+    Task<> reply(const char* response);
+    // Answers with 404, records it and throws to end the connection.
+    Task<> rejectBlocked();
+    Task<> connectRemote(const std::string& host);
+    Task<> tunnel();
+    Task<> relay(socket_t from, socket_t to, bool upstream, Latch& finished);
+    Task<> forward();
+    void handOff();
+    // Fails whatever is pending on both sockets, so every coroutine of the connection returns.
+    void cancelPending();
+
+public:
+    ~AsyncConnection();
+    AsyncConnection(const AsyncConnection&) = delete;
+    AsyncConnection& operator=(const AsyncConnection&) = delete;
+
+    // The connection's top-level coroutine, run with spawn() on `loop`; it owns the connection.
+    static Task<> serve(Proxy& proxy, EventLoop& loop, socket_t client_fd, std::chrono::steady_clock::time_point accepted_at,
+                        Admission admission);
+};
+
+#endif // ASYNC_CONNECTION_H
@@ -0,0 +1,186 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include "event_loop.h"
+#include "task.h"
+
+#include <optional>
+#include <string>
+#include <type_traits>
+
+struct RecvResult {
+    int result = 0;         // bytes received, 0 at end of stream, or -errno
+    IoBuffer buffer;        // holds the bytes when result > 0; give it back with AsyncIo::releaseBuffer
+};
+
+struct TransferResult {
+    int sent = 0;
+    RecvResult next;        // -ECANCELED unless the send went through whole
+};
+
+struct ResolveResult {
+    bool found = false;
+    sockaddr_in address = {};
+};
+
+// The operations of an EventLoop as awaitables, for coroutines running on the loop thread. Each one
+// suspends the coroutine until the loop reports the completion and resumes it from run(), so a
+// coroutine reads like blocking code while its loop serves everything else meanwhile.
+class AsyncIo {
+private:
+    EventLoop& loop;
+
+    struct ReadAwaiter {
+        EventLoop& loop;
+        socket_t fd;
+        RecvResult received;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            loop.recv(fd, [this, handle](int result, IoBuffer buffer) {
+                received.result = result;
+                received.buffer = buffer;
+                handle.resume();
+            });
+        }
+        RecvResult await_resume() const noexcept { return received; }
+    };
+
+    struct WriteAwaiter {
+        EventLoop& loop;
+        socket_t fd;
+        const char* data;
+        size_t length;
+        int sent = 0;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            loop.send(fd, data, length, [this, handle](int result) {
+                sent = result;
+                handle.resume();
+            });
+        }
+        int await_resume() const noexcept { return sent; }
+    };
+
+    // The receive always reports after the send, so it is the one that resumes.
+    struct TransferAwaiter {
+        EventLoop& loop;
+        socket_t to;
+        const char* data;
+        size_t length;
+        socket_t from;
+        TransferResult transfer;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            loop.sendThenRecv(to, data, length, [this](int result) { transfer.sent = result; },
+                from, [this, handle](int result, IoBuffer buffer) {
+                    transfer.next.result = result;
+                    transfer.next.buffer = buffer;
+                    handle.resume();
+                });
+        }
+        TransferResult await_resume() const noexcept { return transfer; }
+    };
+
+    struct CompletionAwaiter {
+        EventLoop& loop;
+        std::function<void(EventLoop&, EventLoop::CompletionHandler)> start;
+        int result = 0;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            start(loop, [this, handle](int completed) {
+                result = completed;
+                handle.resume();
+            });
+        }
+        int await_resume() const noexcept { return result; }
+    };
+
+    struct ResolveAwaiter {
+        EventLoop& loop;
+        std::string host;
+        uint16_t port;
+        ResolveResult resolved;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            loop.offload([this]() { resolved = AsyncIo::resolveNow(host, port); }, [handle]() { handle.resume(); });
+        }
+        ResolveResult await_resume() const noexcept { return resolved; }
+    };
+
+    template <typename F>
+    struct ComputeAwaiter {
+        typedef std::invoke_result_t<F&> Result;
+        typedef std::conditional_t<std::is_void_v<Result>, bool, Result> Stored;
+
+        EventLoop& loop;
+        F function;
+        std::optional<Stored> value;
+        std::exception_ptr error;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            loop.compute([this]() {
+                try {
+                    if constexpr (std::is_void_v<Result>) {
+                        function();
+                        value = true;
+                    } else {
+                        value = function();
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }, [handle]() { handle.resume(); });
+        }
+        Result await_resume() {
+            if (error) std::rethrow_exception(error);
+            if constexpr (!std::is_void_v<Result>) return std::move(*value);
+        }
+    };
+
+    // Blocking lookup of the first IPv4 address of `host`; records the DNS latency.
+    static ResolveResult resolveNow(const std::string& host, uint16_t port);
+
+public:
+    explicit AsyncIo(EventLoop& loop) : loop(loop) {}
+
+    EventLoop& eventLoop() { return loop; }
+
+    ReadAwaiter read(socket_t fd) { return ReadAwaiter{loop, fd, RecvResult()}; }
+    // Resumes once all of `data` was sent or the send failed; yields the bytes sent or -errno.
+    WriteAwaiter write(socket_t fd, const char* data, size_t length) { return WriteAwaiter{loop, fd, data, length}; }
+    // Sends to `to` and, only if that went through whole, reads `from` again.
+    TransferAwaiter writeThenRead(socket_t to, const char* data, size_t length, socket_t from) {
+        return TransferAwaiter{loop, to, data, length, from, TransferResult()};
+    }
+    // Yields 0 once connected, or -errno.
+    CompletionAwaiter connect(socket_t fd, const sockaddr_in& address) {
+        return CompletionAwaiter{loop, [fd, address](EventLoop& loop, EventLoop::CompletionHandler done) {
+            loop.connect(fd, address, std::move(done));
+        }};
+    }
+    // Yields 0 once `ms` milliseconds have passed, or -ECANCELED when the loop stops first.
+    CompletionAwaiter sleep(uint64_t ms) {
+        return CompletionAwaiter{loop, [ms](EventLoop& loop, EventLoop::CompletionHandler done) {
+            loop.timeout(ms, std::move(done));
+        }};
+    }
+    // Name resolution blocks, so it runs off the loop and the coroutine resumes on it afterwards.
+    ResolveAwaiter resolve(const std::string& host, uint16_t port) { return ResolveAwaiter{loop, host, port, ResolveResult()}; }
+
+    // Runs CPU-heavy `function` on the WorkStealingPool and resumes with its result, or its
+    // exception. The coroutine is suspended meanwhile, so `function` may use its state.
+    template <typename F>
+    ComputeAwaiter<F> compute(F function) { return ComputeAwaiter<F>{loop, std::move(function), std::nullopt, nullptr}; }
+
+    void cancel(socket_t fd) { loop.cancel(fd); }
+    void release(socket_t fd) { loop.release(fd); }
+    void releaseBuffer(IoBuffer buffer) { loop.releaseBuffer(buffer); }
+};
+
+#endif // ASYNC_IO_H
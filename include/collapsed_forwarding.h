@@ -0,0 +1,73 @@
+#ifndef COLLAPSED_FORWARDING_H
+#define COLLAPSED_FORWARDING_H
+
+#include "http_parser.h"
+
+#include <condition_variable>
+#include <memory>
+
+#define COLLAPSED_MAX_RESPONSE_BYTES (32ULL << 20)     // larger responses are not shared
+
+// One origin fetch that concurrent identical requests attach to. The leading handler relays the
+// response as usual and appends every byte here; followers replay the bytes to their own clients
+// as they arrive.
+class InflightFetch {
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::string data;                   // everything relayed so far, interim heads included
+    std::string head;                   // head of the final response once known
+    std::string vary;
+    HttpRequest leader;
+    ResponseTracker tracker;
+    bool headKnown = false;
+    bool shareable = false;
+    bool sharedWithCookies = false;     // public, or Vary covers Cookie, so cookie-bearing requests may share it
+    bool finished = false;
+    bool complete = false;
+    bool overflowed = false;
+
+public:
+    const std::string key;
+
+    InflightFetch(const std::string& key, const HttpRequest& request);
+
+    // Leader side.
+    void append(const char* bytes, size_t length);
+    void finish(bool completed);
+
+    // Follower side. waitForHead returns false when this request cannot share the response
+    // (not storable by a shared cache, cookies on either request without the response allowing it,
+    // Vary mismatch, too large, or the fetch failed before its head).
+    bool waitForHead(const HttpRequest& request, std::string& finalHead);
+    // Copies bytes past `offset` into `chunk`, waiting for them; returns false once nothing more will come.
+    bool read(size_t offset, std::string& chunk);
+    bool isComplete();
+};
+
+// Registry of in-flight fetches by cache key: the first miss leads, later ones follow.
+class CollapsedForwarding {
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<InflightFetch>> inflight;
+
+public:
+    std::shared_ptr<InflightFetch> join(const std::string& key, const HttpRequest& request, bool& leader);
+    void leave(const std::shared_ptr<InflightFetch>& fetch);
+};
+
+// Held by the leading handler: ends the fetch (as failed unless finished first) and unregisters it
+// however the handler unwinds.
+class InflightLease {
+private:
+    CollapsedForwarding& registry;
+    std::shared_ptr<InflightFetch> fetch;
+
+public:
+    InflightLease(CollapsedForwarding& registry, std::shared_ptr<InflightFetch> fetch);
+    ~InflightLease();
+    InflightLease(const InflightLease&) = delete;
+    InflightLease& operator=(const InflightLease&) = delete;
+};
+
+#endif // COLLAPSED_FORWARDING_H
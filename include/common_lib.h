@@ -28,6 +28,21 @@
 #define LISTEN_PORT 8080
 #define MAX_CONNECTIONS 100
 
+#define METRICS_PORT 9090
+#define METRICS_SCRAPE_TIMEOUT_MS 2000     // a scraper that sends nothing for this long is dropped
+
+#define HEADER_READ_TIMEOUT_MS 10000        // accept -> first request bytes
+#define CONNECT_TIMEOUT_MS 10000            // upstream TCP connect
+#define HTTP_IDLE_TIMEOUT_MS 5000           // plain HTTP: no traffic in either direction
+#define TUNNEL_IDLE_TIMEOUT_MS 300000       // CONNECT tunnels: no traffic in either direction
+#define CONNECTION_LIFETIME_MS 3600000      // hard cap on any single connection
+
+#define ANSI_RED         "\033[31m"
+#define ANSI_RESET       "\033[0m"
+#define ANSI_GREEN       "\033[32m"
+#define ANSI_YELLOW      "\033[33m"
+#define ANSI_CONCEALED   "\033[8m"
+
 #define blockedDomainsFile "asset/blocked_domains.txt"
 #define blockedIPsFile "asset/blocked_ip.txt"
 
@@ -0,0 +1,68 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "http_parser.h"
+#include "work_pool.h"
+
+#include <memory>
+#include <utility>
+#include <zlib.h>
+
+#define COMPRESSION_LEVEL 6
+#define COMPRESSION_MIN_BYTES 1024          // smaller bodies are not worth the chunked framing
+#define COMPRESSION_MAX_BACKLOG 64          // queued work-pool jobs beyond which new responses pass through
+
+bool acceptsEncoding(const HttpRequest& request, const std::string& coding);
+bool isCompressibleType(const std::string& contentType);
+
+// Streaming gzip encoder. Every call ends with a sync flush so the client can decode everything
+// it has received so far.
+class GzipEncoder {
+private:
+    z_stream stream;
+    bool ready;
+
+public:
+    GzipEncoder(int level = COMPRESSION_LEVEL);
+    ~GzipEncoder();
+    GzipEncoder(const GzipEncoder&) = delete;
+    GzipEncoder& operator=(const GzipEncoder&) = delete;
+
+    bool isReady() const;
+    std::string compress(const char* data, size_t length, bool finish);
+};
+
+// Re-encodes one relayed response as gzip with chunked framing when the client accepts it and the
+// content qualifies; any other response passes through byte for byte.
+class ResponseCompressor {
+private:
+    bool clientAccepts;
+    std::string requestMethod;
+    std::string pendingHead;
+    bool headDone = false;
+    bool active = false;
+    BodyFraming framing;
+    ChunkedScanner chunked;
+    size_t bodyBytes = 0;
+    size_t bytesIn = 0;
+    size_t bytesOut = 0;
+    std::unique_ptr<GzipEncoder> encoder;
+
+    bool qualifies(const HttpResponse& response);
+    std::string rewriteHead(const std::string& head);
+    std::string encodeChunk(const std::string& payload, bool finish);
+
+public:
+    ResponseCompressor(const HttpRequest& request);
+
+    // Takes upstream bytes and returns what should be sent to the client in their place.
+    std::string feed(const char* data, size_t length);
+    // Once the upstream response is complete: the gzip trailer and the last chunk.
+    std::string finish();
+    bool isActive() const { return active; }
+    // feed() would hand every further byte back unchanged: the client takes no gzip, or the
+    // response turned out not to qualify.
+    bool isPassthrough() const { return !clientAccepts || (headDone && !active); }
+};
+
+#endif // COMPRESSION_H
@@ -0,0 +1,143 @@
+#ifndef CONNECTION_REGISTRY_H
+#define CONNECTION_REGISTRY_H
+
+#include "cross_platform.h"
+
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#define REGISTRY_CHUNK_SLOTS 1024           // slots are allocated this many at a time...
+#define REGISTRY_MAX_CHUNKS 64              // ...up to this many chunks; connections beyond are served untracked
+
+enum ConnectionState {
+    CONNECTION_READING,         // waiting for the request head
+    CONNECTION_RESOLVING,
+    CONNECTION_CONNECTING,
+    CONNECTION_TUNNELING,       // relaying a CONNECT tunnel
+    CONNECTION_FORWARDING,      // answering a plain request, from the origin or the cache
+};
+
+const char* connectionStateName(ConnectionState state);
+
+// Names one registered connection. Its slot is reused once the connection is gone, but under a
+// new generation, so a stale id never matches the next connection. Generation 0 names nothing.
+struct ConnectionId {
+    uint32_t slot = 0;
+    uint32_t generation = 0;
+
+    explicit operator bool() const { return generation != 0; }
+    bool operator==(const ConnectionId& other) const { return slot == other.slot && generation == other.generation; }
+};
+
+// A registered connection as it was when the snapshot was taken.
+struct ConnectionSnapshot {
+    ConnectionId id;
+    char clientIp[INET_ADDRSTRLEN];
+    uint16_t clientPort;
+    std::string target;                 // host:port once the request named it
+    ConnectionState state;
+    uint64_t bytesUp;                   // client to origin
+    uint64_t bytesDown;                 // origin to client
+    std::chrono::steady_clock::time_point openedAt;
+    double rateUp = 0;                  // bytes per second since the previous sample, set by ThroughputSampler
+    double rateDown = 0;
+};
+
+class ConnectionRegistry;
+
+// One connection's slot in the registry, given back when it is destroyed or reset. Moves along
+// with the connection like its Admission. Updates are single atomic stores, cheap enough for
+// every relayed chunk. The owner must reset it before closing the sockets, so a force-close never
+// hits a descriptor that was already reused.
+class ConnectionEntry {
+private:
+    ConnectionRegistry* registry;
+    uint32_t slot;
+
+public:
+    ConnectionEntry() : registry(nullptr), slot(0) {}
+    ConnectionEntry(ConnectionRegistry* registry, uint32_t slot) : registry(registry), slot(slot) {}
+    ConnectionEntry(ConnectionEntry&& other) noexcept : registry(other.registry), slot(other.slot) { other.registry = nullptr; }
+    ConnectionEntry& operator=(ConnectionEntry&& other) noexcept;
+    ConnectionEntry(const ConnectionEntry&) = delete;
+    ConnectionEntry& operator=(const ConnectionEntry&) = delete;
+    ~ConnectionEntry();
+
+    void reset();
+    ConnectionId id() const;
+    void setRemote(socket_t remote_fd);
+    void setState(ConnectionState state);
+    void setTarget(const std::string& host, uint16_t port);
+    void addBytes(bool upstream, size_t length);
+
+    explicit operator bool() const { return registry != nullptr; }
+};
+
+// Every open client connection, in a table of slots reused through a free list, so registering
+// and unregistering cost O(1) from any thread and the table never grows past the peak number of
+// connections open at once. Slot memory is never freed while the registry lives, so a reader may
+// look at any slot below the high-water mark at any time.
+class ConnectionRegistry {
+private:
+    struct Slot {
+        std::mutex mutex;               // orders a force-close against the slot being given back
+        uint32_t generation = 0;        // nonzero while in use
+        std::atomic<socket_t> clientFd{INVALID_SOCKET};
+        std::atomic<socket_t> remoteFd{INVALID_SOCKET};
+        std::atomic<int> state{CONNECTION_READING};
+        std::atomic<uint64_t> bytesUp{0};
+        std::atomic<uint64_t> bytesDown{0};
+        std::chrono::steady_clock::time_point openedAt;
+        char clientIp[INET_ADDRSTRLEN] = {};
+        uint16_t clientPort = 0;
+        std::string target;
+    };
+
+    std::atomic<Slot*> chunks[REGISTRY_MAX_CHUNKS];
+    std::atomic<uint32_t> highWater{0};         // slots ever handed out
+    std::atomic<int> live{0};
+    std::mutex free_mutex;
+    std::vector<uint32_t> freeSlots;
+    uint32_t nextGeneration = 0;                // guarded by free_mutex
+
+    Slot& at(uint32_t slot) const;
+    void release(uint32_t slot);
+    static void shutDown(Slot& slot);
+
+    friend class ConnectionEntry;
+
+public:
+    ConnectionRegistry();
+    ~ConnectionRegistry();
+    ConnectionRegistry(const ConnectionRegistry&) = delete;
+    ConnectionRegistry& operator=(const ConnectionRegistry&) = delete;
+
+    // An empty entry when every slot is taken; the connection is then served without being tracked.
+    ConnectionEntry open(socket_t client_fd, const sockaddr_in& client_addr);
+    // Shuts the connection's sockets down, which ends it the way an expired deadline does; false
+    // when it is already gone.
+    bool close(ConnectionId id);
+    // Returns how many connections were shut down.
+    int closeAll();
+    std::vector<ConnectionSnapshot> snapshot() const;
+    int size() const { return live.load(std::memory_order_relaxed); }
+};
+
+// Turns successive snapshots into current throughput per connection, from how far its counters
+// moved since the previous sample. Connections gone from a snapshot are forgotten.
+class ThroughputSampler {
+private:
+    struct Sample {
+        uint64_t bytesUp;
+        uint64_t bytesDown;
+        std::chrono::steady_clock::time_point at;
+    };
+    std::unordered_map<uint64_t, Sample> last;      // by slot and generation
+
+public:
+    // A connection seen for the first time is measured from when it opened.
+    void sample(std::vector<ConnectionSnapshot>& connections);
+};
+
+#endif // CONNECTION_REGISTRY_H
@@ -21,6 +21,12 @@
         closesocket(fd); \
     } while (0)
 
+    #define SHUTDOWN_SOCKET(fd) shutdown((fd), SD_BOTH)
+    #define SHUTDOWN_SOCKET_WRITE(fd) shutdown((fd), SD_SEND)
+    // Closes this process's descriptor only, without shutting the socket down for others sharing it.
+    #define RELEASE_SOCKET(fd) closesocket(fd)
+    #define POLL_SOCKETS(fds, count, timeout_ms) WSAPoll((fds), ULONG(count), (timeout_ms))
+
     #define INIT_SOCKET() do { \
         WSADATA wsaData; \
         if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) { \
@@ -37,10 +43,13 @@
     #include <sys/types.h>
     #include <sys/socket.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
     #include <unistd.h>
     #include <netdb.h>
     #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
     
     typedef int socket_t;
     #define SOCKET_ERROR_CODE errno
@@ -50,6 +59,12 @@
         close(fd); \
     } while (0)
 
+    #define SHUTDOWN_SOCKET(fd) shutdown((fd), SHUT_RDWR)
+    #define SHUTDOWN_SOCKET_WRITE(fd) shutdown((fd), SHUT_WR)
+    #define RELEASE_SOCKET(fd) close(fd)
+    // Unlike select(), not limited to descriptors below FD_SETSIZE.
+    #define POLL_SOCKETS(fds, count, timeout_ms) poll((fds), nfds_t(count), (timeout_ms))
+
     #define INIT_SOCKET() (void)0
     #define CLEANUP_SOCKET() (void)0
     #define SETSOCKOPT(s, level, optname, optval, optlen) \
@@ -66,4 +81,32 @@ inline void print_socket_error(const char *msg) {
 #endif
 }
 
+inline void set_socket_blocking(socket_t fd, bool blocking) {
+#if IS_WINDOWS
+    u_long nonBlocking = blocking ? 0 : 1;
+    ioctlsocket(fd, FIONBIO, &nonBlocking);
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+// The last socket call failed only because it would have blocked or was interrupted.
+inline bool socket_would_block() {
+#if IS_WINDOWS
+    int error = WSAGetLastError();
+    return error == WSAEWOULDBLOCK || error == WSAEINTR;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// True once `fd` is readable (for a listener: a connection is waiting), false after `timeout_ms`.
+inline bool wait_readable(socket_t fd, int timeout_ms) {
+    pollfd watched = {};
+    watched.fd = fd;
+    watched.events = POLLIN;
+    return POLL_SOCKETS(&watched, 1, timeout_ms) > 0;
+}
+
 #endif // CROSS_PLATFORM_H
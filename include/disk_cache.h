@@ -0,0 +1,79 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include "http_cache.h"
+
+#include <shared_mutex>
+
+#define DISK_CACHE_DIR "cache/"
+#define DISK_CACHE_SLABS 16
+#define DISK_CACHE_SLAB_BYTES (64ULL << 20)             // 16 x 64 MiB = 1 GiB on disk
+#define DISK_CACHE_MIN_OBJECT_BYTES (256ULL << 10)      // smaller bodies stay in the memory tier
+#define DISK_CACHE_MAX_OBJECT_BYTES (32ULL << 20)
+#define DISK_CACHE_INDEX_SETS 8192
+#define DISK_CACHE_INDEX_WAYS 8
+
+// A disk hit: metadata read back from the slab record plus where its body lives. The slab stays
+// pinned (it cannot be recycled) for as long as the hit is held.
+struct DiskCacheHit {
+    CachedResponse meta;                // body left empty
+    int slab = -1;
+    uint64_t bodyOffset = 0;
+    uint64_t bodyLength = 0;
+    std::shared_lock<std::shared_mutex> pin;
+};
+
+// Second cache tier for large objects. Records are appended log-style to fixed-size slab files
+// and slabs are recycled round-robin; a set-associative index kept in an mmap'd file maps key
+// hashes to records, so both survive restarts. Bodies are sent to clients with sendfile.
+class DiskCache {
+private:
+    struct IndexEntry {
+        uint64_t keyHash;
+        uint64_t offset;
+        uint64_t recordLength;
+        int64_t storedAt;
+        uint32_t slab;
+        uint32_t generation;            // slab generation the record was written in
+    };
+
+    struct IndexFile {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slabCount;
+        uint32_t writeSlab;
+        uint64_t slabBytes;
+        uint64_t writeOffset;
+        uint32_t generations[DISK_CACHE_SLABS];
+        IndexEntry entries[DISK_CACHE_INDEX_SETS * DISK_CACHE_INDEX_WAYS];
+    };
+
+    std::string directory;
+    IndexFile* index;
+    int indexFd;
+    int slabFds[DISK_CACHE_SLABS];
+    std::shared_mutex slabLocks[DISK_CACHE_SLABS];
+    std::mutex mutex;                   // guards the index and the write position
+
+    bool validEntry(const IndexEntry& entry) const;
+    IndexEntry* findEntry(uint64_t keyHash);
+    bool reserve(uint64_t length, uint32_t& slab, uint64_t& offset);
+
+public:
+    DiskCache(const std::string& directory = DISK_CACHE_DIR);
+    ~DiskCache();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    // Fills `hit` with the record matching the request (including Vary), fresh or stale.
+    bool lookup(const HttpRequest& request, DiskCacheHit& hit);
+    bool store(const CachedResponse& entry);
+    // Sends the body of `hit` to the client without copying it through user space.
+    bool sendBody(socket_t client_fd, const DiskCacheHit& hit);
+    bool readBody(const DiskCacheHit& hit, std::string& body);
+    void remove(const std::string& key);
+};
+
+#endif // DISK_CACHE_H
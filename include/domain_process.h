@@ -3,13 +3,42 @@
 
 #include "common_lib.h"
 
+#include <memory>
+
 struct FilterList {
+    // Edited from the GUI thread; lookups use an index of them, so call rebuild() after a change.
     std::unordered_set<std::string> domains; 
     std::unordered_set<std::string> ips;     
 
+    FilterList();
+    // Copies the sets and shares the current index; the copy rebuilds on its own afterwards.
+    FilterList(const FilterList& other);
+
     void addDomain(const std::string& domain);
     void addIP(const std::string& ip);
     bool isBlocked(const std::string& entry) const;
+
+    // Indexes the sets as they are now on the work pool; lookups keep using the previous index
+    // until the new one is ready, and an index overtaken by a later rebuild is never installed.
+    void rebuild();
+    // Same, on the calling thread.
+    void reindex();
+
+private:
+    struct Index {
+        std::unordered_set<std::string> domains;
+        std::unordered_set<std::string> ips;
+    };
+    // Outlives the list while a rebuild job still holds it.
+    struct Slot {
+        std::mutex mutex;
+        std::shared_ptr<const Index> index;
+        uint64_t generation = 0;
+    };
+    std::shared_ptr<Slot> slot;
+
+    std::shared_ptr<const Index> current() const;
+    static void install(Slot& slot, uint64_t generation, std::shared_ptr<const Index> index);
 };
  
 bool loadListFromFile(const char*  filePath, std::unordered_set<std::string>& list);
@@ -0,0 +1,130 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "cross_platform.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#define EVENT_LOOP_QUEUE_DEPTH 1024         // io_uring submission queue entries
+#define EVENT_LOOP_BUFFER_COUNT 512         // receive buffers shared by every socket of a loop (power of two)
+#define EVENT_LOOP_BUFFER_SIZE 16384
+#define EVENT_LOOP_THREADS 4                // loops serving connections, one thread each
+#define EVENT_LOOP_ACCEPT_RETRY_MS 100      // wait before accepting again after running out of descriptors
+
+enum IoBackend {
+    IO_BACKEND_THREADS,     // one blocking thread per connection
+    IO_BACKEND_EPOLL,
+    IO_BACKEND_URING,
+};
+
+// Backend used by new proxies; IO_BACKEND_EPOLL and IO_BACKEND_URING are Linux only and fall back
+// to threads elsewhere.
+#ifndef PROXY_IO_BACKEND
+#define PROXY_IO_BACKEND IO_BACKEND_THREADS
+#endif
+
+const char* ioBackendName(IoBackend backend);
+
+// A receive buffer lent by the loop; only valid when the receive returned data, and it must be
+// handed back with EventLoop::releaseBuffer once its bytes have been used.
+struct IoBuffer {
+    char* data = nullptr;
+    int id = -1;
+};
+
+// Single-threaded completion loop. Every operation reports through its handler with the syscall's
+// result (bytes, or -errno), always from run() and never from inside the call that started it.
+// At most one receive and one send may be pending per socket. Both backends share this contract,
+// so the connections they drive do not know which one is underneath. Every handler runs exactly
+// once: operations still pending when the loop stops fail with -ECANCELED, as does anything
+// started while it is stopping.
+class EventLoop : public std::enable_shared_from_this<EventLoop> {
+public:
+    typedef std::function<void(socket_t fd)> AcceptHandler;
+    typedef std::function<void(int result, IoBuffer buffer)> RecvHandler;
+    typedef std::function<void(int result)> CompletionHandler;
+
+    // Returns nullptr when the backend is not supported by this platform or kernel.
+    static std::shared_ptr<EventLoop> create(IoBackend backend);
+    virtual ~EventLoop() {}
+
+    virtual IoBackend backend() const = 0;
+    // Keeps accepting on listen_fd until the loop stops; sockets are handed over in blocking mode.
+    virtual void accept(socket_t listen_fd, AcceptHandler handler) = 0;
+    // Stops accepting on listen_fd until accept() is called again. Sockets the kernel accepted
+    // before the pause took effect may still reach the handler.
+    virtual void pauseAccept(socket_t listen_fd) = 0;
+    virtual void recv(socket_t fd, RecvHandler handler) = 0;
+    // Completes once all `length` bytes were sent or the send failed; `data` must outlive it.
+    virtual void send(socket_t fd, const char* data, size_t length, CompletionHandler onSent) = 0;
+    // A send followed by a receive that is only started once the send fully succeeded (otherwise
+    // it completes with -ECANCELED); both go to the kernel together where the backend allows it.
+    virtual void sendThenRecv(socket_t fd, const char* data, size_t length, CompletionHandler onSent,
+                              socket_t recv_fd, RecvHandler onRecv) = 0;
+    virtual void connect(socket_t fd, const sockaddr_in& address, CompletionHandler onConnected) = 0;
+    // Completes with 0 once `ms` milliseconds have passed.
+    virtual void timeout(uint64_t ms, CompletionHandler onExpired) = 0;
+    // Shuts the socket down and fails its pending operations with -ECANCELED. The caller still
+    // closes it, once the last handler has run.
+    virtual void cancel(socket_t fd) = 0;
+    // Forgets a socket with nothing pending and puts it back in blocking mode for another owner.
+    virtual void release(socket_t fd) = 0;
+    virtual void releaseBuffer(IoBuffer buffer) = 0;
+
+    // Thread-safe: runs `task` on the loop thread. Returns false, dropping it, once run() has returned.
+    bool post(std::function<void()> task);
+    // Runs blocking `work` on a thread of its own, then `then` on the loop thread. The loop keeps
+    // running after stop() until every `then` has run.
+    void offload(std::function<void()> work, std::function<void()> then);
+    // Same for CPU-bound `work`, which runs on the WorkStealingPool instead.
+    void compute(std::function<void()> work, std::function<void()> then);
+    void run();
+    // Thread-safe. run() returns once every pending operation has failed and every handler has run.
+    void stop();
+
+protected:
+    struct Operation {
+        enum Kind { ACCEPT, RECV, SEND, CONNECT, TIMEOUT, WAKE };
+        Kind kind;
+        socket_t fd;
+        AcceptHandler onAccept;
+        RecvHandler onRecv;
+        CompletionHandler onComplete;
+        const char* data = nullptr;
+        size_t length = 0;
+        size_t done = 0;
+        sockaddr_in address;
+        IoBuffer buffer;
+        bool started = false;
+        bool cancelling = false;
+        int64_t interval[2] = {0, 0};   // seconds and nanoseconds, laid out like __kernel_timespec
+        std::chrono::steady_clock::time_point deadline;
+        Operation* linked = nullptr;    // submitted only after this one fully succeeds
+    };
+
+    std::atomic<bool> stopping{false};
+
+    // Blocks until something completes, a task is posted or the loop is stopped, and dispatches it.
+    virtual void wait() = 0;
+    virtual void wake() = 0;
+    // Called on the loop thread once stopped: fails pending operations and dispatches whatever
+    // completed. Returns true while operations are still outstanding.
+    virtual bool drain() = 0;
+    void dispatch(Operation* op, int result);
+
+private:
+    std::mutex posted_mutex;
+    std::vector<std::function<void()>> posted;
+    bool finished = false;
+    std::atomic<int> offloaded{0};
+
+    // Returns false when there was nothing to run.
+    bool runPosted();
+    // Wraps an offloaded job so it hands `then` back to the loop when done.
+    std::function<void()> handBack(std::function<void()> work, std::function<void()> then);
+};
+
+#endif // EVENT_LOOP_H
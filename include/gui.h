@@ -1,9 +1,12 @@
 #ifndef GUI_H
 #define GUI_H
 
+#include "connection_registry.h"
 #include "http_parser.h"
 #include "common_lib.h"
 
+#include <functional>
+
 class Button {
 protected:
     Rectangle bounds;           // 
@@ -137,6 +140,36 @@ public:
 };
 
 
+#define MONITOR_REFRESH_SECONDS 1.0     // how often the open connections are sampled
+
+// Connections open right now with their state, age and current throughput each way, busiest
+// first. A selected row is closed with Delete.
+class ConnectionMonitor {
+private:
+    Rectangle bounds;                                       //
+    Font font;                                              //
+    int fontSize;                                           //
+    float rowHeight;                                        //
+    float scrollOffset;                                     //
+    int selectedRow;                                        //
+    double lastRefresh;                                     //
+    std::vector<ConnectionSnapshot> rows;                   //
+    ThroughputSampler sampler;                              //
+    std::function<std::vector<ConnectionSnapshot>()> source;
+    std::function<void(ConnectionId)> onClose;
+
+    void Refresh();
+    void DrawRow(int rowIndex, float y, bool isHovered, bool isSelected);
+public:
+    ConnectionMonitor(float x, float y, float width, float height, std::function<std::vector<ConnectionSnapshot>()> openConnections,
+                      std::function<void(ConnectionId)> closeConnection, Font customFont = GetFontDefault(),
+                      int textSize = 20, float rowSpacing = 5.0f);
+
+    void Update();
+    void Draw();
+};
+
+
 class InputText {
 private:
     Rectangle bounds;           //
@@ -204,10 +237,12 @@ private:
     Rectangle bounds_d;
     int fontSize;
     int lineSpacing;
+    std::function<void()> onChange;     // called after a name was added or deleted
 public:
     NameList(std::string filename, float x, float y, float width, float height, 
              std::unordered_set<std::string>& names, Font customFont,
-             const std::string& titleText, int textSize = 20, int rowSpacing = 5.0f);  
+             const std::string& titleText, int textSize = 20, int rowSpacing = 5.0f,
+             std::function<void()> changed = nullptr);  
     
     void Update();
     void HandleScrollBar(Vector2 mousePosition);
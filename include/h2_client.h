@@ -0,0 +1,145 @@
+#ifndef H2_CLIENT_H
+#define H2_CLIENT_H
+
+#include "hpack.h"
+#include "http_parser.h"
+#include "socket_options.h"
+
+#include <functional>
+
+#define H2C_ORIGINS_FILE "asset/h2c_origins.txt"    // "host[:port]" per line of origins reached over h2c
+#define H2_STREAM_WINDOW (1 << 20)          // receive window of each stream
+#define H2_CONNECTION_WINDOW (16 << 20)     // ...and of the whole connection
+#define H2_MAX_SESSIONS_PER_ORIGIN 4        // more are opened only while every one is at its stream limit
+#define H2_SESSION_IDLE_MS 60000            // a connection without streams is closed after this long
+#define H2_CONNECT_TIMEOUT_MS 5000
+#define H2_SEND_TIMEOUT_MS 10000            // waiting for the peer to open its window for a request body
+
+class H2Session;
+
+// One request on an h2c connection, whose response reads like the HTTP/1.1 message an origin would
+// have sent: a status line and header block, then the body with its Content-Length, or chunked
+// when the origin gave none. Dropping the stream before the response ends resets it.
+class H2Stream {
+private:
+    friend class H2Session;
+    std::shared_ptr<H2Session> session;
+    uint32_t id;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::string pending;            // response bytes, read from readOffset on
+    size_t readOffset;
+    bool headSent;
+    bool chunked;
+    bool finished;                  // END_STREAM seen and nothing more will be added
+    bool failed;                    // reset, or the connection went away
+    int64_t sendWindow;             // guarded by the session's mutex
+    size_t received;                // DATA bytes taken in, padding included
+    size_t credited;                // ...and given back to the peer with WINDOW_UPDATE
+
+    H2Stream(std::shared_ptr<H2Session> session, uint32_t id, int64_t sendWindow);
+
+public:
+    ~H2Stream();
+    // Bytes copied into `out`, 0 once the response is complete, -1 when the stream failed or nothing
+    // arrived within `timeoutMs`.
+    ssize_t read(char* out, size_t capacity, int timeoutMs);
+};
+
+// One prior-knowledge h2c connection (RFC 9113 section 3.3) carrying many streams. A reader thread
+// owns the receiving side; senders share the socket under a mutex so each frame goes out whole and
+// header blocks leave in the order they were compressed.
+class H2Session : public std::enable_shared_from_this<H2Session> {
+private:
+    friend class H2Stream;
+    socket_t fd;
+    sockaddr_in address;
+    std::mutex write_mutex;
+    HpackEncoder encoder;           // guarded by write_mutex
+    HpackDecoder decoder;           // reader thread only, like the header block being put together
+    std::string headerBlock;
+    uint32_t headerStream;          // 0 unless CONTINUATION frames are due
+    bool headerEndStream;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::unordered_map<uint32_t, std::weak_ptr<H2Stream>> streams;
+    uint32_t nextStreamId;
+    uint32_t peerMaxStreams;
+    uint32_t peerMaxFrame;
+    int64_t peerInitialWindow;
+    int64_t sendWindow;             // of the connection
+    size_t connectionUnacked;       // DATA bytes not yet credited back on the connection
+    bool goingAway;                 // GOAWAY either way; no new streams
+    std::atomic<bool> closed;
+    int64_t idleSince;              // steady clock milliseconds when the last stream ended
+
+    // Sends one frame; false once the connection is gone.
+    bool sendFrame(uint8_t type, uint8_t flags, uint32_t streamId, const std::string& payload);
+    void sendWindowUpdate(uint32_t streamId, size_t increment);
+    void run();
+    // Handles one frame from the peer; false for a protocol error, which ends the connection.
+    bool handleFrame(uint8_t type, uint8_t flags, uint32_t streamId, const std::string& payload);
+    bool deliverHeaders(uint32_t streamId, const std::string& block, bool endStream);
+    void deliverData(uint32_t streamId, const char* data, size_t length, size_t frameLength, bool endStream);
+    std::shared_ptr<H2Stream> findStream(uint32_t streamId);
+    void endStream(uint32_t streamId, bool failed);
+    void failAll();
+    // A stream given up by its reader before the end.
+    void cancel(uint32_t streamId);
+
+public:
+    H2Session(socket_t fd, const sockaddr_in& address);
+    ~H2Session();
+
+    // Connects, sends the preface and settings and starts the reader; nullptr when the origin
+    // cannot be reached.
+    static std::shared_ptr<H2Session> open(const sockaddr_in& address, const SocketProfile& profile);
+    // Whether another stream may be started right now.
+    bool available();
+    // False once either side sent GOAWAY or the connection is gone.
+    bool accepting();
+    const sockaddr_in& getAddress() const { return address; }
+    // Without streams for `ms`, or at all once going away.
+    bool idleFor(int64_t ms);
+    // Starts a stream for the request at `weight` (1 to 256); the body, if any, goes out before this
+    // returns. nullptr when the connection has no room for it after all.
+    std::shared_ptr<H2Stream> submit(const std::vector<HeaderField>& headers, const std::string& body, int weight);
+    // GOAWAY with `errorCode`, then shuts the socket down; streams still open fail.
+    void goAway(uint32_t errorCode = 0);
+};
+
+// The origins configured for h2c and the connections to each.
+class H2Pool {
+private:
+    struct Origin {
+        std::mutex mutex;
+        std::condition_variable changed;        // a connection was opened, or failed to be
+        std::vector<std::shared_ptr<H2Session>> sessions;
+        int connecting = 0;                     // connections being opened outside the mutex
+    };
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<Origin>> origins;     // keyed by "host:port"
+
+    // A connection with room for another stream, waiting for one being opened rather than opening a
+    // second at once. Returns nullptr, with `address` set, when a new one would go to a blocked
+    // address. Throws runtime_error when none can be had.
+    std::shared_ptr<H2Session> pickSession(Origin& origin, const std::string& host, const std::string& key, int port,
+                                           const SocketProfile& profile, sockaddr_in& address,
+                                           const std::function<bool(const sockaddr_in&)>& blocked);
+
+public:
+    // A missing file leaves h2c off.
+    void load(const char* file);
+    // Whether the request goes to an h2c origin and can be sent as a stream: not a tunnel, without a
+    // chunked body, which is only relayed as it comes, and with all of any Content-Length body at hand.
+    bool routes(const HttpRequest& request, int port) const;
+    // Sends an HTTP/1.1 request for an origin `routes` accepted as a stream, on a connection with
+    // room for it or a new one. `address` receives the origin's address. When `blocked` rejects it,
+    // nothing is connected or sent and nullptr is returned. Throws runtime_error when the origin
+    // cannot be reached.
+    std::shared_ptr<H2Stream> open(const std::string& rawRequest, int port, const SocketProfile& profile, sockaddr_in& address,
+                                   const std::function<bool(const sockaddr_in&)>& blocked);
+    void closeAll();
+};
+
+#endif // H2_CLIENT_H
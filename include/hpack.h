@@ -0,0 +1,71 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include "cross_platform.h"
+
+#include <deque>
+
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_DEFAULT_TABLE_SIZE 4096       // until SETTINGS_HEADER_TABLE_SIZE says otherwise
+#define HPACK_ENTRY_OVERHEAD 32             // counted per entry on top of name and value
+#define HPACK_MAX_HEADER_LIST 65536         // a decoded block larger than this is refused
+
+struct HeaderField {
+    std::string name;
+    std::string value;
+};
+
+// The static table followed by a dynamic one (RFC 7541 section 2.3), one per direction of a
+// connection. Index 1 is the first static entry; the newest dynamic entry comes right after the
+// last static one.
+class HpackTable {
+private:
+    std::deque<HeaderField> entries;        // newest first
+    size_t size;
+    size_t capacity;
+
+    void evict(size_t room);
+
+public:
+    HpackTable();
+    void add(const HeaderField& field);
+    void resize(size_t capacity);
+    size_t getCapacity() const { return capacity; }
+    // Null for an index past the end.
+    const HeaderField* at(size_t index) const;
+    // The lowest index holding `name`, preferring one with `value` too; 0 when none does.
+    size_t find(const std::string& name, const std::string& value, bool& exact) const;
+};
+
+// Encodes header lists for one connection's requests. Fields that repeat from request to request
+// (user agent, cookies, accept headers) go into the dynamic table and cost a byte or two after the
+// first request; fields that change every time are sent literally so they do not push them out.
+class HpackEncoder {
+private:
+    HpackTable table;
+    size_t peerLimit;
+    bool announceSize;          // the next block starts with a table size update
+
+public:
+    HpackEncoder();
+    // From the peer's SETTINGS_HEADER_TABLE_SIZE.
+    void setPeerLimit(size_t limit);
+    std::string encode(const std::vector<HeaderField>& headers);
+};
+
+class HpackDecoder {
+private:
+    HpackTable table;
+    size_t limit;               // what we advertised; the peer may resize up to it
+
+public:
+    HpackDecoder();
+    // False for a malformed block, which the connection cannot recover from.
+    bool decode(const std::string& block, std::vector<HeaderField>& headers);
+};
+
+// RFC 7541 Appendix B.
+std::string huffmanEncode(const std::string& text);
+bool huffmanDecode(const unsigned char* data, size_t length, std::string& out);
+
+#endif // HPACK_H
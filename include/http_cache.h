@@ -0,0 +1,98 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include "http_parser.h"
+
+#include <list>
+#include <memory>
+
+#define CACHE_CAPACITY_BYTES (256ULL << 20)
+#define CACHE_MAX_OBJECT_BYTES (8ULL << 20)
+#define CACHE_SHARDS 16
+#define CACHE_HEURISTIC_MAX_SECONDS 86400   // cap for Last-Modified based freshness
+#define CACHE_REFRESH_THREADS 2             // background stale-while-revalidate fetches at once
+#define CACHE_REFRESH_QUEUE 256             // refreshes waiting beyond those; more are dropped
+
+struct CachedResponse {
+    std::string key;
+    std::string head;               // status line and header lines (CRLF terminated), without Age
+    std::string body;               // exactly as received, possibly still chunked
+    std::vector<std::pair<std::string, std::string>> varyHeaders;   // request headers this variant matches
+    int statusCode = 0;
+    std::time_t storedAt = 0;
+    int64_t initialAge = 0;         // seconds, Age corrected with the Date header at store time
+    int64_t freshnessLifetime = 0;  // seconds
+    int64_t staleWhileRevalidate = 0;   // seconds past expiry a stale copy may be served while refreshing
+    int64_t staleIfError = 0;           // seconds past expiry a stale copy may replace an origin error
+    bool mustRevalidate = false;
+    std::string etag;
+    std::string lastModified;
+
+    size_t size() const;
+    int64_t currentAge(std::time_t now) const;
+    bool isFresh(std::time_t now) const;
+    bool canServeWhileRevalidating(std::time_t now) const;
+    bool canServeOnError(std::time_t now) const;
+    // Response head ready to send: stored headers plus a fresh Age header and the blank line.
+    std::string headWithAge(std::time_t now) const;
+};
+
+// Count-min sketch of recent access frequency (TinyLFU). Counters saturate at 15 and are halved
+// every `sampleSize` increments so old popularity fades.
+class FrequencySketch {
+private:
+    static const int DEPTH = 4;
+    std::vector<uint8_t> table;
+    size_t mask;
+    size_t additions;
+    size_t sampleSize;
+
+    size_t indexOf(uint64_t hash, int row) const;
+
+public:
+    FrequencySketch(size_t width = 4096);
+    void increment(uint64_t hash);
+    int estimate(uint64_t hash) const;
+};
+
+// Sharded in-memory response cache. Each shard has its own lock, LRU list, byte budget and
+// frequency sketch; a new object is only admitted over the LRU victim if it is accessed more often.
+class HttpCache {
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::list<std::shared_ptr<CachedResponse>> lru;   // front = most recently used
+        std::unordered_map<std::string, std::list<std::shared_ptr<CachedResponse>>::iterator> index;
+        size_t bytes = 0;
+        FrequencySketch sketch;
+    };
+
+    Shard shards[CACHE_SHARDS];
+    size_t shardCapacity;
+
+    Shard& shardFor(const std::string& key);
+    void unlink(Shard& shard, const std::string& key);
+
+public:
+    HttpCache(size_t capacityBytes = CACHE_CAPACITY_BYTES);
+
+    static std::string cacheKey(const HttpRequest& request);
+    static bool isCacheableRequest(const HttpRequest& request);
+    // Builds a cache entry from a complete raw response, or nullptr when it must not be stored.
+    static std::shared_ptr<CachedResponse> buildEntry(const HttpRequest& request, const std::string& rawResponse);
+    // The request with If-None-Match / If-Modified-Since validators taken from `stale`.
+    static std::string conditionalRequest(const HttpRequest& request, const CachedResponse& stale);
+    // Applies the headers of a 304 response to a stale entry and recomputes its freshness.
+    static std::shared_ptr<CachedResponse> refreshEntry(const HttpRequest& request, const CachedResponse& stale,
+                                                        const std::string& body, const std::string& notModifiedHead);
+
+    // Returns the entry matching the request (including Vary), fresh or stale, or nullptr.
+    std::shared_ptr<const CachedResponse> lookup(const HttpRequest& request);
+    bool store(std::shared_ptr<CachedResponse> entry);
+    void remove(const std::string& key);
+
+    size_t sizeBytes();
+    size_t objectCount();
+};
+
+#endif // HTTP_CACHE_H
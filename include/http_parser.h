@@ -20,7 +20,7 @@ struct HttpRequest {
 struct HttpResponse {
     std::string rawResponse;
     std::string httpVersion;
-    int statusCode;
+    int statusCode = 0;
     std::string reasonPhrase;
     std::unordered_map<std::string, std::string> headers;
     std::string body;
@@ -30,9 +30,60 @@ struct HttpResponse {
     std::string toString() const;
 };
 
+// How the end of a response body is detected on the wire.
+struct BodyFraming {
+    enum Kind { NONE, CONTENT_LENGTH, CHUNKED, UNTIL_CLOSE };
+    Kind kind = UNTIL_CLOSE;
+    size_t length = 0;
+};
+
+// Incremental scanner that tracks where a chunked body ends; the chunk data can be collected on the way.
+class ChunkedScanner {
+private:
+    enum State { SIZE, SIZE_EXTENSION, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER_START, TRAILER_LINE, TRAILER_LF, DONE };
+    State state = SIZE;
+    size_t remaining = 0;
+    bool sawDigit = false;
+    bool malformed = false;
+
+public:
+    // Returns how many bytes belong to the body; anything after that is not part of this message.
+    // Chunk data (without the framing) is appended to `payload` when given.
+    size_t feed(const char* data, size_t length, std::string* payload = nullptr);
+    bool isComplete() const { return state == DONE; }
+    bool isMalformed() const { return malformed; }
+};
+
+// Follows one response as it is relayed: skips interim 1xx heads, parses the final head and uses
+// its framing to tell when the message is complete. Keeps nothing but a partial head.
+class ResponseTracker {
+private:
+    std::string requestMethod;
+    std::string pendingHead;
+    size_t interimBytes = 0;        // bytes of 1xx heads in front of the final response
+    size_t totalBytes = 0;
+    size_t bodyBytes = 0;
+    int status = 0;
+    bool headDone = false;
+    bool done = false;
+    BodyFraming framing;
+    ChunkedScanner chunked;
+
+public:
+    ResponseTracker(const std::string& requestMethod);
+    void feed(const char* data, size_t length);
+    // With `closed`, a body delimited by the connection close counts as complete.
+    bool isComplete(bool closed = false) const;
+    bool hasHead() const { return headDone; }
+    int statusCode() const { return status; }       // of the final response, once hasHead()
+    size_t bytesSeen() const { return totalBytes; }
+    // The final response out of everything relayed, i.e. without interim heads.
+    std::string finalResponse(const std::string& relayed) const;
+};
+
 
 struct Host {
-    char ip[INET_ADDRSTRLEN];
+    char ip[INET6_ADDRSTRLEN];      // a SOCKS client may name an IPv6 origin
     unsigned short port;
 };
 
@@ -48,19 +99,29 @@ struct ConnectionInfo {
 
     std::vector<Transaction> transactions;
     ConnectionInfo() : client(), server(), transactions() {}
-    void parseServerPort(HttpRequest request) {
-        size_t pos = request.url.find(':');
+    // Clears the record for reuse by ObjectPool; the transactions vector keeps its capacity.
+    void reset() {
+        client = Host();
+        server = Host();
+        time = 0;
+        transactions.clear();
+    }
+    void parseServerPort(const HttpRequest& request) {
+        // Accepts both "host:port" (CONNECT) and "scheme://host:port/path" (absolute form)
+        std::string authority = request.url;
+        size_t scheme = authority.find("://");
+        if (scheme != std::string::npos) {
+            authority = authority.substr(scheme + 3);
+        }
+        authority = authority.substr(0, authority.find('/'));
+
+        server.port = (request.isEncrypted || request.method == "CONNECT") ? 443 : 80;
+        size_t pos = authority.rfind(':');
         try {
             if (pos != std::string::npos) {
-                server.port = std::stoi(request.url.substr(pos + 1));
-            }
-        } catch (const std::invalid_argument& e) {
-            if (request.isEncrypted) {
-                server.port = 443;
-            } else {
-                server.port = 80;
+                server.port = std::stoi(authority.substr(pos + 1));
             }
-        } 
+        } catch (const std::exception& e) {}
     }
 
     void addTransaction(const HttpRequest& request, const HttpResponse& response);
@@ -74,6 +135,13 @@ bool isValidHttpVersion(const std::string version);
 void trimNewlineChars(std::string& str);
 HttpRequest parseHttpRequest(const std::string& rawMessage);
 HttpResponse parseHttpResponse(const std::string& rawMessage);
+// The head of the message a relayed chunk starts with, as far as the chunk has it.
+std::string messageHead(const char* data, size_t length);
+std::string findHeader(const std::unordered_map<std::string, std::string>& headers, const std::string& name);
+bool headerHasToken(const std::string& value, const std::string& token);
+BodyFraming responseBodyFraming(const HttpResponse& response, const std::string& requestMethod);
+std::time_t parseHttpDate(const std::string& value);
+std::string formatHttpDate(std::time_t time);
 std::string ConnectionInfoToString(const ConnectionInfo& connection);
 
 void log_request(HttpRequest request, FILE* f = stderr);
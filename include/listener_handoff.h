@@ -0,0 +1,39 @@
+#ifndef LISTENER_HANDOFF_H
+#define LISTENER_HANDOFF_H
+
+#include "cross_platform.h"
+
+#include <atomic>
+#include <functional>
+
+#define HANDOFF_SOCKET_FORMAT "%s/proxy-handoff-%d.sock"    // Unix socket per proxy port a replacement asks on
+#define HANDOFF_DIR_FORMAT "/tmp/proxy-handoff-%u"          // per-user directory (mode 0700) for it without $XDG_RUNTIME_DIR
+#define HANDOFF_TIMEOUT_MS 2000             // either side gives up on a silent peer after this long
+#define DRAIN_TIMEOUT_MS 30000              // a replaced proxy closes connections still open after this long
+
+// Passes listening sockets from a running proxy to the process replacing it, as SCM_RIGHTS over a
+// Unix socket. Both then accept from the same kernel queue, so while the old process stops
+// accepting and drains, connection attempts are never refused. The socket lives in a directory only
+// its user can enter, and each side also checks that the peer runs as that user. Unix only;
+// elsewhere a replacement simply binds anew.
+class ListenerHandoff {
+private:
+    socket_t server_fd;
+    std::vector<socket_t> listeners;
+    std::function<void()> handedOff;
+    std::atomic<bool> serving;
+
+    void serve(std::string path);
+
+public:
+    ListenerHandoff();
+
+    // The listeners of a proxy running on `port`, in the order it offered them; empty when none answered.
+    static std::vector<socket_t> takeOver(int port);
+
+    // Gives `listeners` to the next process that asks, then calls `onHandedOff` on the serving thread.
+    bool offer(int port, std::vector<socket_t> listeners, std::function<void()> onHandedOff);
+    void withdraw(int port);
+};
+
+#endif // LISTENER_HANDOFF_H
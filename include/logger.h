@@ -0,0 +1,84 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "cross_platform.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+// Messages below this level are removed at compile time, e.g. -DLOG_MIN_LEVEL=LOG_LEVEL_WARNING.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RATE_PER_SECOND 50      // per call site; extra messages are counted, not printed
+#define LOG_QUEUE_CAPACITY 8192     // pending lines; beyond this messages are dropped
+
+#if defined(__GNUC__)
+#define LOG_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define LOG_PRINTF_FORMAT(fmt, args)
+#endif
+
+// Fixed one-second window limiter, one per call site. Lock-free; racing threads may let a
+// couple of extra messages through at a window boundary, which is fine for logging.
+struct LogRateLimiter {
+    std::atomic<int64_t> window{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+
+    bool allow(uint32_t& suppressedBefore);
+};
+
+class Logger {
+private:
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;      // writer waits for lines
+    std::condition_variable idle_cv;       // flush() waits for the writer to drain
+    std::vector<std::string> queue;
+    std::atomic<uint64_t> dropped;
+    bool running;
+    bool writing;
+    std::thread writer;
+
+    Logger();
+    void writeLoop();
+
+public:
+    ~Logger();
+    static Logger& instance();
+
+    void log(LogLevel level, uint32_t suppressed, const char* format, ...) LOG_PRINTF_FORMAT(4, 5);
+    void flush();
+};
+
+// "YYYY-MM-DD HH:MM:SS" in local time, thread-safe unlike std::ctime.
+std::string formatTimestamp(std::time_t time);
+// Text for the last socket error of the calling thread.
+std::string socketErrorText();
+
+#define LOG_AT(level, ...) do { \
+    if constexpr ((level) >= LOG_MIN_LEVEL) { \
+        static LogRateLimiter log_limiter_; \
+        uint32_t log_suppressed_ = 0; \
+        if (log_limiter_.allow(log_suppressed_)) { \
+            Logger::instance().log((level), log_suppressed_, __VA_ARGS__); \
+        } \
+    } \
+} while (0)
+
+#define LOG_DEBUG(...)   LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)    LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...)   LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif // LOGGER_H
@@ -0,0 +1,111 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "cross_platform.h"
+
+#include <atomic>
+
+enum MetricCounter {
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_ACTIVE,
+    METRIC_REQUESTS_BLOCKED,
+    METRIC_CONNECTION_ERRORS,
+    METRIC_BYTES_CLIENT_TO_SERVER,
+    METRIC_BYTES_SERVER_TO_CLIENT,
+    METRIC_CACHE_HITS,
+    METRIC_CACHE_MISSES,
+    METRIC_CACHE_HIT_BYTES,
+    METRIC_CACHE_MISS_BYTES,
+    METRIC_DISK_CACHE_HITS,
+    METRIC_CACHE_REVALIDATED,
+    METRIC_CACHE_STALE_SERVED,
+    METRIC_COLLAPSED_REQUESTS,
+    METRIC_COMPRESSED_RESPONSES,
+    METRIC_COMPRESSION_SKIPPED,
+    METRIC_COMPRESSION_BYTES_IN,
+    METRIC_COMPRESSION_BYTES_OUT,
+    METRIC_CONNECTIONS_REJECTED,
+    METRIC_ACCEPT_PAUSED,
+    METRIC_TRANSFERS_THROTTLED,
+    METRIC_PARENT_RETRIES,
+    METRIC_PARENT_EJECTIONS,
+    METRIC_COUNTER_COUNT
+};
+
+enum MetricHistogram {
+    METRIC_ACCEPT_LATENCY,          // accept() returned -> handler running
+    METRIC_DNS_LATENCY,
+    METRIC_CONNECT_LATENCY,
+    METRIC_TIME_TO_FIRST_BYTE,      // accept() returned -> first upstream byte
+    METRIC_TOTAL_DURATION,
+    METRIC_HISTOGRAM_COUNT
+};
+
+// Log-linear (HDR style) histogram over microseconds: 16 linear sub-buckets per power of two,
+// so every recorded value is within ~6% of its bucket bound. Values above ~19 hours are clamped.
+struct LatencyHistogram {
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_MAGNITUDE = 36;
+    static const int BUCKET_COUNT = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+    static int bucketIndex(uint64_t micros);
+    static uint64_t bucketUpperBound(int index);
+    void record(uint64_t micros);
+};
+
+// Process-wide registry. Every thread owns one shard and only ever touches it with relaxed
+// atomics, so recording never takes a lock; scrapes sum all shards.
+class MetricsRegistry {
+private:
+    static const int MAX_SHARDS = 64;
+
+    struct Shard {
+        std::atomic<bool> inUse{false};
+        std::atomic<int64_t> counters[METRIC_COUNTER_COUNT];
+        LatencyHistogram histograms[METRIC_HISTOGRAM_COUNT];
+    };
+
+    Shard shards[MAX_SHARDS + 1];   // the extra shard is shared by threads beyond MAX_SHARDS
+
+    MetricsRegistry();
+    Shard& localShard();
+    void releaseShard(Shard* shard);
+
+    friend struct ShardLease;
+
+public:
+    static MetricsRegistry& instance();
+
+    void increment(MetricCounter counter, int64_t value = 1);
+    void record(MetricHistogram histogram, std::chrono::steady_clock::duration elapsed);
+
+    int64_t counterValue(MetricCounter counter) const;
+    std::string renderPrometheus() const;
+};
+
+// Serves GET /metrics in Prometheus text format on its own (loopback) port.
+class MetricsServer {
+private:
+    int port;
+    socket_t server_fd;
+    std::atomic<bool> running;
+
+    void serve();
+    void handleScrape(socket_t client_fd);
+
+public:
+    MetricsServer(int port);
+
+    // Serves on `inherited` when given, a listener another process handed over, instead of binding anew.
+    bool start(socket_t inherited = INVALID_SOCKET);
+    void stop();
+    int getPort() const;
+    socket_t getListener() const;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,85 @@
+#ifndef PARENT_PROXY_H
+#define PARENT_PROXY_H
+
+#include "cross_platform.h"
+
+#define PARENT_PROXIES_FILE "asset/parent_proxies.txt"
+#define PARENT_VIRTUAL_NODES 100            // ring points per unit of weight
+#define PARENT_MAX_ATTEMPTS 3               // parents tried for one request before giving up
+#define PARENT_HEALTH_INTERVAL_MS 5000      // between active checks of every parent
+#define PARENT_HEALTH_TIMEOUT_MS 2000       // for the check's connect
+#define PARENT_HEALTH_FALL 2                // consecutive failed checks that mark a parent down...
+#define PARENT_HEALTH_RISE 2                // ...and passed ones that bring it back
+#define PARENT_MAX_FAILS 3                  // consecutive failures on real traffic that eject a parent...
+#define PARENT_EJECT_MS 30000               // ...for this long
+
+// One upstream proxy. Active checks decide whether it is up; failures seen on real traffic eject
+// it for a while on top of that.
+struct ParentProxy {
+    std::string name;               // host:port as configured
+    std::string host;
+    int port;
+    int weight;
+    std::mutex mutex;
+    sockaddr_in address;            // guarded by mutex; resolved again by the checks while unresolved
+    bool resolved;
+    std::atomic<bool> up;
+    std::atomic<int> checkStreak;   // consecutive checks disagreeing with `up`; health thread only
+    std::atomic<int> failures;
+    std::atomic<int64_t> ejectedUntil;      // steady clock milliseconds
+
+    ParentProxy(const std::string& host, int port, int weight);
+    bool available() const;
+    // False while the name does not resolve.
+    bool getAddress(sockaddr_in& out);
+    bool resolve();
+};
+
+// A set of parents sharing the requests routed to it. Each parent owns PARENT_VIRTUAL_NODES points
+// per unit of weight on a hash ring, so a host always maps to the same parent and only the hosts of
+// a parent that comes or goes move elsewhere, which keeps the parents' caches from holding copies of
+// everything.
+struct ParentPool {
+    std::string name;
+    std::vector<std::shared_ptr<ParentProxy>> parents;
+    std::vector<std::pair<uint64_t, size_t>> ring;     // point and index into parents, sorted by point
+
+    void buildRing();
+};
+
+// Which hosts go through which pool, from PARENT_PROXIES_FILE:
+//   parent <pool> <host:port> [weight]
+//   route <pool> <domain>           the domain and its subdomains; "*" for every host
+//   route direct <domain>           never through a parent
+// The first matching route wins; hosts no route matches use the pool named "default" if there is one.
+class ParentRouter {
+private:
+    std::vector<std::unique_ptr<ParentPool>> pools;
+    std::vector<std::pair<std::string, ParentPool*>> domain_routes;   // domain, pool (nullptr for direct)
+    ParentPool* fallback;
+    std::thread checker;
+    std::mutex checker_mutex;
+    std::condition_variable checker_wake;
+    bool checking;
+
+    ParentPool* poolFor(const std::string& host) const;
+    void checkLoop();
+
+public:
+    ParentRouter();
+    ~ParentRouter();
+
+    // A missing file leaves every host direct.
+    void load(const char* file);
+    // Starts and stops the active health checks.
+    void start();
+    void stop();
+    bool routes(const std::string& host) const;
+    // The parents to try for `host`, at most PARENT_MAX_ATTEMPTS, in ring order from the host's
+    // point: available ones only, or every one as a last resort when none is.
+    std::vector<std::shared_ptr<ParentProxy>> candidates(const std::string& host) const;
+    void reportSuccess(ParentProxy& parent);
+    void reportFailure(ParentProxy& parent);
+};
+
+#endif // PARENT_PROXY_H
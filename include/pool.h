@@ -0,0 +1,124 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "common_lib.h"
+
+#include <memory>
+
+// Free-list pool shared by the whole process. Each thread keeps a few objects in a private
+// cache so steady-state acquire/release touch no lock and no allocator; the rest live in a
+// global depot. Released objects are reset() rather than destroyed, so strings and vectors
+// keep their capacity for the next connection.
+template <typename T>
+class ObjectPool {
+private:
+    static const size_t CACHE_LIMIT = 8;
+    static const size_t DEPOT_LIMIT = 1024;
+
+    struct Depot {
+        std::mutex mutex;
+        std::vector<T*> objects;
+    };
+
+    struct Cache {
+        std::vector<T*> objects;
+        ~Cache() {
+            for (T* object : objects) pushToDepot(object);
+        }
+    };
+
+    static Depot& depot() {
+        static Depot instance;
+        return instance;
+    }
+
+    static Cache& cache() {
+        thread_local Cache instance;
+        return instance;
+    }
+
+    static void pushToDepot(T* object) {
+        Depot& d = depot();
+        std::lock_guard<std::mutex> lock(d.mutex);
+        if (d.objects.size() < DEPOT_LIMIT) {
+            d.objects.push_back(object);
+        } else {
+            delete object;
+        }
+    }
+
+public:
+    struct Deleter {
+        void operator()(T* object) const { ObjectPool<T>::release(object); }
+    };
+    typedef std::unique_ptr<T, Deleter> Handle;
+
+    static Handle acquire() {
+        Cache& c = cache();
+        if (!c.objects.empty()) {
+            T* object = c.objects.back();
+            c.objects.pop_back();
+            return Handle(object);
+        }
+
+        Depot& d = depot();
+        {
+            std::lock_guard<std::mutex> lock(d.mutex);
+            if (!d.objects.empty()) {
+                T* object = d.objects.back();
+                d.objects.pop_back();
+                return Handle(object);
+            }
+        }
+        return Handle(new T());
+    }
+
+    static void release(T* object) {
+        object->reset();
+        Cache& c = cache();
+        if (c.objects.size() < CACHE_LIMIT) {
+            c.objects.push_back(object);
+        } else {
+            pushToDepot(object);
+        }
+    }
+};
+
+// Size-classed I/O buffer pool with the same thread-cache/depot layout as ObjectPool.
+class BufferPool {
+public:
+    static const int CLASS_COUNT = 3;
+    static const size_t CLASS_SIZES[CLASS_COUNT];       // 4 KiB, 16 KiB, 64 KiB
+
+    static int classFor(size_t size);
+    static char* acquire(int sizeClass);
+    // toDepot returns the buffer to the shared depot instead of this thread's cache, so an
+    // idle connection's thread is not left holding memory.
+    static void release(char* buffer, int sizeClass, bool toDepot = false);
+    static size_t cachedBytes();
+};
+
+// Move-only RAII handle over a BufferPool buffer. An empty handle owns nothing.
+class PooledBuffer {
+private:
+    char* buffer;
+    int sizeClass;
+
+public:
+    PooledBuffer();
+    explicit PooledBuffer(size_t size);
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer();
+
+    void acquire(size_t size);
+    void release(bool toDepot = false);
+
+    char* data() const;
+    size_t capacity() const;
+    bool empty() const;
+};
+
+#endif // POOL_H
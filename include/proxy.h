@@ -1,24 +1,175 @@
 #ifndef PROXY_H
 #define PROXY_H
 
+#include "admission.h"
+#include "collapsed_forwarding.h"
+#include "compression.h"
+#include "connection_registry.h"
+#include "disk_cache.h"
 #include "domain_process.h"
+#include "event_loop.h"
+#include "h2_client.h"
+#include "http_cache.h"
 #include "http_parser.h"
+#include "listener_handoff.h"
+#include "logger.h"
+#include "metrics.h"
+#include "parent_proxy.h"
+#include "pool.h"
+#include "socket_options.h"
+#include "socks5.h"
+#include "timer_wheel.h"
+#include "traffic_shaper.h"
+#include "transparent.h"
+#include "tunnel_relay.h"
+
+// Per-connection deadlines driven by the proxy's TimerService. Expiry only shuts the sockets
+// down, which makes the owning thread's blocking connect/recv/select return so it can clean up.
+struct ConnectionDeadlines {
+    TimerService& timers;
+    TimerNode headerRead;
+    TimerNode connect;
+    TimerNode idle;
+    TimerNode lifetime;
+    std::atomic<int64_t> lastActivity;      // steady clock, milliseconds
+
+    ConnectionDeadlines(TimerService& timers);
+    ~ConnectionDeadlines();
+
+    void armHeaderRead(socket_t client_fd);
+    void cancelHeaderRead();
+    void armConnect(socket_t remote_fd);
+    void cancelConnect();
+    void armIdle(socket_t client_fd, socket_t remote_fd, uint64_t idleMs);
+    void armLifetime(socket_t client_fd, socket_t remote_fd, uint64_t lifetimeMs);
+    void touch();
+    void cancelAll();
+};
+
+// A cached response found for a request in either tier. A disk entry keeps its slab pinned.
+struct CacheEntryRef {
+    std::shared_ptr<const CachedResponse> memory;
+    DiskCacheHit disk;
+    bool onDisk = false;
+
+    const CachedResponse& meta() const { return onDisk ? disk.meta : *memory; }
+    explicit operator bool() const { return onDisk || memory != nullptr; }
+};
+
+// Responses the proxy answers with itself.
+extern const char BAD_REQUEST_RESPONSE[];
+extern const char VERSION_NOT_SUPPORTED_RESPONSE[];
+extern const char BLOCKED_RESPONSE[];
+extern const char CONNECT_ESTABLISHED_RESPONSE[];
+
+class AsyncConnection;
+
+// What a listener's connections speak; each kind has its own handler.
+enum ListenerKind {
+    LISTENER_PROXY,             // HTTP, with CONNECT
+    LISTENER_TRANSPARENT,       // redirected by the firewall
+    LISTENER_SOCKS,
+};
 
 class Proxy {
 private:
     int port;
     socket_t server_fd;
+    int transparent_port;
+    socket_t transparent_fd;
+    int socks_port;
+    socket_t socks_fd;
+    SocksUsers socks_users;
+    H2Pool h2c;                                     // origins whose requests share multiplexed h2c connections
+    ParentRouter parents;                           // hosts reached through a tier of parent proxies
     bool running;
     std::mutex connections_mutex;
+    std::vector<ConnectionInfo> connections;        // the last 100 finished connections, newest first
+    uint64_t connections_version;                   // bumped with every change to `connections`
+    ConnectionRegistry registry;
+    MetricsServer metrics_server;
+    TimerService timers;
+    HttpCache cache;
+    DiskCache disk_cache;
+    // Background refreshes, run by CACHE_REFRESH_THREADS threads between start() and stop(); all
+    // guarded by revalidations_mutex.
+    struct Refresh {
+        HttpRequest request;
+        std::string key;
+        std::string conditional;
+    };
+    std::mutex revalidations_mutex;
+    std::unordered_set<std::string> revalidations;     // cache keys queued or being refreshed
+    std::deque<Refresh> refresh_queue;
+    std::condition_variable refresh_wake;
+    std::vector<std::thread> refreshers;
+    bool refreshing;
+    CollapsedForwarding collapsed;
+    AdmissionControl admissions;
+    TrafficShaper shaper;
+    IoBackend io_backend;
+    std::atomic<const SocketProfile*> socket_profile;
+    std::mutex loop_mutex;
+    std::vector<std::shared_ptr<EventLoop>> event_loops;   // set while event loops serve connections
+    std::condition_variable loops_stopped;
+    ListenerHandoff handoff;
+    std::atomic<bool> draining;     // the listeners went to a replacement; only connections already accepted remain
+    std::atomic<bool> retired;
+    std::atomic<int> acceptors_running;     // threads still accepting from the listeners
 
-    void updateConnections(ConnectionInfo conn_info);
+    void updateConnections(const ConnectionInfo& conn_info);
+    bool isBlockedAddress(const sockaddr_in& address) const;
+    // Answers a blocked request with 404, records it and throws to end the connection.
+    void rejectBlocked(socket_t client_fd, const HttpRequest& request, ConnectionInfo& conn_info);
+    bool findCached(const HttpRequest& request, CacheEntryRef& cached);
+    bool sendCached(socket_t client_fd, const HttpRequest& request, const CacheEntryRef& cached, ConnectionInfo& conn_info,
+                    std::chrono::steady_clock::time_point accepted_at);
+    void storeResponse(std::shared_ptr<CachedResponse> entry);
+    std::shared_ptr<CachedResponse> refreshCached(const HttpRequest& request, CacheEntryRef& stale, const std::string& notModifiedHead);
+    // Answers the request from the memory tier, then the disk tier, if the entry is fresh or may be served
+    // while revalidating. Otherwise returns false and leaves any stale entry in `stale`.
+    bool serveFromCache(socket_t client_fd, const HttpRequest& request, ConnectionInfo& conn_info,
+                        std::chrono::steady_clock::time_point accepted_at, CacheEntryRef& stale);
+    bool followInflight(socket_t client_fd, const HttpRequest& request, const std::shared_ptr<InflightFetch>& inflight,
+                        ConnectionInfo& conn_info, std::chrono::steady_clock::time_point accepted_at);
+    // Connects to a parent proxy for `host`, moving on to the next one in the host's ring order when a
+    // parent cannot be reached. A tunnel is asked of the parent with CONNECT `tunnel`; otherwise
+    // `request` is sent, and when it is `retryable` a parent that closes before answering is skipped
+    // too. `parent_addr` receives the parent's address. Throws runtime_error when no parent would do.
+    socket_t connectParent(const std::string& host, const std::string& tunnel, const std::string& request, bool retryable,
+                           ConnectionDeadlines& deadlines, ConnectionEntry* entry, sockaddr_in& parent_addr);
+    bool fetchFromOrigin(const HttpRequest& request, const std::string& rawRequest, std::string& response);
+    void revalidateInBackground(const HttpRequest& request, const CachedResponse& stale);
+    void refreshLoop();
     void setupServerSocket();
-    void handleClient(socket_t client_fd, sockaddr_in client_addr);
+    // One of the optional listeners; INVALID_SOCKET when the port cannot be had, as the proxy port
+    // still serves then. A transparent one may accept connections addressed to other hosts.
+    socket_t openListener(int port, bool transparent);
+    // `prefetched` holds request bytes an event loop already read from the client.
+    void handleClient(socket_t client_fd, sockaddr_in client_addr, std::chrono::steady_clock::time_point accepted_at,
+                      std::string prefetched, Admission admission, ConnectionEntry entry);
+    // Serves a redirected connection: policy from the TLS server name or Host header, then
+    // relayed to its original destination as a tunnel.
+    void handleTransparent(socket_t client_fd, sockaddr_in client_addr, std::chrono::steady_clock::time_point accepted_at,
+                           Admission admission, ConnectionEntry entry);
+    // Serves a SOCKS5 client: negotiation, then its CONNECT under the same policy as an HTTP one.
+    void handleSocks(socket_t client_fd, sockaddr_in client_addr, std::chrono::steady_clock::time_point accepted_at,
+                     Admission admission, ConnectionEntry entry);
+    // Relays an established tunnel until both sides are done; a plaintext one is recorded as
+    // transactions of `request`.
+    void relayTunnel(socket_t client_fd, socket_t remote_fd, const HttpRequest& request, const std::string& host,
+                     ConnectionInfo& conn_info, ConnectionDeadlines& deadlines, ConnectionEntry& entry,
+                     std::chrono::steady_clock::time_point accepted_at);
     void acceptConnections();
+    // A thread per connection from `listen_fd`, until the proxy stops or drains.
+    void acceptThreaded(socket_t listen_fd, ListenerKind kind);
+    void runEventLoops(const std::vector<std::shared_ptr<EventLoop>>& loops);
+    // Stops accepting, waits up to DRAIN_TIMEOUT_MS for open connections to finish, then stops.
+    void retire();
+
+    friend class AsyncConnection;
  
 public:
-    std::vector<socket_t> file_descriptors;
-    std::vector<ConnectionInfo> connections;
     FilterList BLACK_LIST;
     Proxy(int port);
 
@@ -26,6 +177,30 @@ public:
     int start();
     bool setPort(int port);
     int getPort() const;
+    // Takes effect the next time the proxy starts.
+    void setIoBackend(IoBackend backend);
+    IoBackend getIoBackend() const;
+    // Port of the listener for iptables REDIRECT/TPROXY traffic, 0 for none; takes effect the next
+    // time the proxy starts.
+    void setTransparentPort(int port);
+    int getTransparentPort() const;
+    // Port of the SOCKS5 listener, 0 for none; takes effect the next time the proxy starts.
+    void setSocksPort(int port);
+    int getSocksPort() const;
+    // Connections accepted from now on use it, the listener from the next start on; false, changing
+    // nothing, for an unknown profile.
+    bool setSocketProfile(const std::string& name);
+    std::string getSocketProfile() const;
+    // Copies the last finished connections, newest first, into `out` unless they are still the ones of
+    // `version`; returns whether it did and updates `version`.
+    bool recentConnections(std::vector<ConnectionInfo>& out, uint64_t& version);
+    // Connections open right now, in no particular order.
+    std::vector<ConnectionSnapshot> openConnections() const;
+    // Ends an open connection as an expired deadline would; false once it is gone.
+    bool closeConnection(ConnectionId id);
+    int closeAllConnections();
+    // True once a replacement process took the listeners over and this one has drained and stopped.
+    bool isRetired() const;
 
 };
 
@@ -0,0 +1,36 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include "cross_platform.h"
+
+// Profile a new proxy's listener starts with; see SOCKET_PROFILES in src/socket_options.cpp.
+#ifndef PROXY_SOCKET_PROFILE
+#define PROXY_SOCKET_PROFILE "default"
+#endif
+
+// TCP options for one listener and the connections it serves. Options a platform lacks are skipped,
+// and 0 or false leaves the system default.
+struct SocketProfile {
+    const char* name;
+    bool noDelay;               // TCP_NODELAY on client and upstream sockets
+    bool quickAck;              // TCP_QUICKACK on client and upstream sockets
+    int fastOpenQueue;          // TCP_FASTOPEN on the listener: pending fast-open handshakes allowed
+    bool fastOpenConnect;       // TCP_FASTOPEN_CONNECT on upstream sockets: the request rides on the SYN
+    int deferAcceptSeconds;     // TCP_DEFER_ACCEPT on the listener: connections surface once data arrived
+    int keepAliveIdleSeconds;   // SO_KEEPALIVE on client and upstream sockets, probing after this idle time...
+    int keepAliveIntervalSeconds;   // ...this often...
+    int keepAliveProbes;            // ...and giving up after this many unanswered probes
+    int busyPollMicros;         // SO_BUSY_POLL on client and upstream sockets
+};
+
+// nullptr when no profile has that name.
+const SocketProfile* findSocketProfile(const std::string& name);
+
+// Before listen().
+void applyListenerOptions(socket_t fd, const SocketProfile& profile);
+// Right after accept().
+void applyClientOptions(socket_t fd, const SocketProfile& profile);
+// Before connect().
+void applyUpstreamOptions(socket_t fd, const SocketProfile& profile);
+
+#endif // SOCKET_OPTIONS_H
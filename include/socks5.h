@@ -0,0 +1,55 @@
+#ifndef SOCKS5_H
+#define SOCKS5_H
+
+#include "cross_platform.h"
+
+#define SOCKS_PORT 0                                // SOCKS5 listener; 0 leaves it off
+#define SOCKS_USERS_FILE "asset/socks_users.txt"    // "user:password" per line; none lets anyone in
+
+// Reply codes of RFC 1928, section 6.
+enum SocksReply {
+    SOCKS_SUCCEEDED = 0x00,
+    SOCKS_GENERAL_FAILURE = 0x01,
+    SOCKS_NOT_ALLOWED = 0x02,               // by the rule set, i.e. the blacklist
+    SOCKS_NETWORK_UNREACHABLE = 0x03,
+    SOCKS_HOST_UNREACHABLE = 0x04,
+    SOCKS_CONNECTION_REFUSED = 0x05,
+    SOCKS_TTL_EXPIRED = 0x06,
+    SOCKS_COMMAND_NOT_SUPPORTED = 0x07,
+    SOCKS_ADDRESS_NOT_SUPPORTED = 0x08,
+};
+
+// The CONNECT a client asked for. An address type is converted for connecting straight away; a
+// domain name is left to the caller to resolve.
+struct SocksRequest {
+    std::string host;               // the name, or the address as text
+    uint16_t port = 0;
+    int family = AF_UNSPEC;         // AF_INET or AF_INET6 for an address, AF_UNSPEC for a name
+    sockaddr_storage address = {};
+
+    std::string authority() const;  // host:port, with brackets around an IPv6 address
+};
+
+// Username/password pairs for RFC 1929 authentication, read once at startup.
+class SocksUsers {
+private:
+    std::unordered_map<std::string, std::string> passwords;
+
+public:
+    // A missing file leaves the list empty.
+    void load(const char* file);
+    bool check(const std::string& user, const std::string& password) const;
+    bool empty() const { return passwords.empty(); }
+};
+
+// Runs the method negotiation, authentication when `users` has any, and reads the request.
+// Whatever the client gets wrong is answered as the protocol says and thrown as runtime_error.
+SocksRequest socksHandshake(socket_t client_fd, const SocksUsers& users);
+
+// Answers the request; a success carries the address `remote_fd` is bound to.
+void socksReply(socket_t client_fd, SocksReply reply, socket_t remote_fd = INVALID_SOCKET);
+
+// The reply for a failed connect, from the socket error it left.
+SocksReply socksReplyForError(int error);
+
+#endif // SOCKS5_H
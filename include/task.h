@@ -0,0 +1,143 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "logger.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template <typename T = void>
+class Task;
+
+namespace task_detail {
+
+// Resumes whoever awaited the finished task; symmetric transfer keeps long await chains off the stack.
+struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept {
+        std::coroutine_handle<> continuation = handle.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+    T result() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+} // namespace task_detail
+
+// Lazily started coroutine producing a T. It runs when awaited and resumes the awaiter when done;
+// exceptions travel to the awaiter like return values.
+template <typename T>
+class Task {
+public:
+    typedef task_detail::Promise<T> promise_type;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace task_detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+// Eagerly started, self-destroying coroutine that owns a detached task.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept {}
+    };
+};
+
+} // namespace task_detail
+
+// Starts `task` right away without anyone awaiting it; it frees itself when it finishes.
+inline task_detail::Detached spawn(Task<void> task) {
+    try {
+        co_await task;
+    } catch (const std::exception& e) {
+        LOG_ERROR("(spawn) Detached task failed: %s", e.what());
+    }
+}
+
+// Lets one coroutine wait for `count` others to call countDown(). Must be used from a single thread.
+class Latch {
+private:
+    int count;
+    std::coroutine_handle<> waiter;
+
+public:
+    explicit Latch(int count) : count(count) {}
+
+    void countDown() {
+        if (--count == 0 && waiter) std::exchange(waiter, nullptr).resume();
+    }
+
+    bool await_ready() const noexcept { return count <= 0; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { waiter = handle; }
+    void await_resume() const noexcept {}
+};
+
+#endif // TASK_H
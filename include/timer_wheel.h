@@ -0,0 +1,79 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "common_lib.h"
+
+#include <condition_variable>
+#include <functional>
+
+#define TIMER_TICK_MS 10
+
+// Intrusive timer node, usually embedded in the object that owns the deadline.
+// The callback returns the number of milliseconds until it should fire again, or 0 to stop.
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expiry = 0;
+    std::function<uint64_t()> callback;
+
+    bool isArmed() const { return prev != nullptr; }
+};
+
+// Hierarchical timing wheel: 4 levels of 64 slots. A node sits in the lowest level whose
+// higher tick bits match the current tick, so insert and cancel are O(1) list operations and
+// each node is cascaded at most once per level on its way down to level 0.
+class TimerWheel {
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    TimerNode slots[LEVELS][SLOTS];     // list heads (circular, sentinel)
+    uint64_t currentTick;
+    size_t count;
+
+    void place(TimerNode* node);
+    void cascade(int level);
+
+public:
+    TimerWheel(uint64_t startTick = 0);
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    void insert(TimerNode* node, uint64_t expiryTick);
+    void cancel(TimerNode* node);
+    // Moves time forward to `tick`, appending every node that expired to `expired`.
+    void advance(uint64_t tick, std::vector<TimerNode*>& expired);
+
+    uint64_t now() const;
+    size_t size() const;
+};
+
+// Runs a TimerWheel on its own thread in real time. Callbacks run on that thread while the
+// service lock is held, which guarantees that once cancel() returns the callback is not running
+// and will not run; callbacks must therefore not call back into the service.
+class TimerService {
+private:
+    TimerWheel wheel;
+    std::mutex wheel_mutex;
+    std::condition_variable wake_cv;
+    std::chrono::steady_clock::time_point epoch;
+    bool running;
+    std::thread worker;
+
+    uint64_t currentTick() const;
+    void run();
+
+public:
+    TimerService();
+    ~TimerService();
+
+    void start();
+    void stop();
+
+    void schedule(TimerNode* node, uint64_t delayMs, std::function<uint64_t()> callback);
+    void cancel(TimerNode* node);
+    size_t pending();
+};
+
+#endif // TIMER_WHEEL_H
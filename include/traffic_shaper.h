@@ -0,0 +1,68 @@
+#ifndef TRAFFIC_SHAPER_H
+#define TRAFFIC_SHAPER_H
+
+#include "common_lib.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// Tunnel bandwidth limits in bytes per second, 0 for none, each with the burst it may send at
+// full speed after being idle. A transfer draws from every level at once.
+#define SHAPING_GLOBAL_RATE 0
+#define SHAPING_GLOBAL_BURST (8 << 20)
+#define SHAPING_CLIENT_RATE 0               // per client IP
+#define SHAPING_CLIENT_BURST (2 << 20)
+#define SHAPING_HOST_RATE 0                 // per destination host
+#define SHAPING_HOST_BURST (2 << 20)
+
+// Token bucket kept as the time its debt is paid off (GCRA), so charging it is a single
+// compare-and-swap and refill needs no timer or lock.
+class TokenBucket {
+private:
+    const int64_t rate;             // bytes per second
+    const int64_t tolerance;        // the burst, in nanoseconds of sending at `rate`
+    std::atomic<int64_t> paidOff;   // steady-clock nanoseconds
+
+public:
+    TokenBucket(uint64_t rate, uint64_t burst);
+
+    // Takes `bytes` even when that overdraws the bucket; returns the nanoseconds until it is out of debt.
+    int64_t charge(size_t bytes, int64_t now);
+};
+
+// The buckets one connection draws from.
+class RateLimit {
+private:
+    std::shared_ptr<TokenBucket> buckets[3];
+
+public:
+    RateLimit() {}
+    RateLimit(std::shared_ptr<TokenBucket> global, std::shared_ptr<TokenBucket> client, std::shared_ptr<TokenBucket> host);
+
+    // Charges relayed bytes and returns how long to hold off before relaying more. The bytes
+    // themselves go out at once, so short exchanges that stay within the bursts never wait; waits
+    // under a millisecond are not worth a sleep and carry over as debt.
+    std::chrono::milliseconds charge(size_t bytes);
+};
+
+// Hands out the buckets by client IP and destination host. A bucket lives as long as a
+// connection draws from it.
+class TrafficShaper {
+private:
+    std::shared_ptr<TokenBucket> global;
+    std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<TokenBucket>> clients;
+    std::unordered_map<std::string, std::weak_ptr<TokenBucket>> hosts;
+
+    static std::shared_ptr<TokenBucket> find(std::unordered_map<std::string, std::weak_ptr<TokenBucket>>& buckets,
+                                             const std::string& key, uint64_t rate, uint64_t burst);
+
+public:
+    TrafficShaper();
+
+    // `host` may carry a port, which is ignored.
+    RateLimit limit(const std::string& client_ip, const std::string& host);
+};
+
+#endif // TRAFFIC_SHAPER_H
@@ -0,0 +1,25 @@
+#ifndef TRANSPARENT_H
+#define TRANSPARENT_H
+
+#include "cross_platform.h"
+
+#define TRANSPARENT_PORT 0                  // listener for redirected traffic; 0 leaves it off
+#define TRANSPARENT_SNIFF_MS 1000           // how long the client gets to send its opening bytes
+#define TRANSPARENT_SNIFF_BYTES 16384       // ...and how many of them are read before relaying starts
+
+// Where a connection redirected to the transparent listener on `listen_port` was headed: the
+// address netfilter rewrote for REDIRECT (SO_ORIGINAL_DST), else the socket's own local address,
+// which TPROXY leaves untouched. False for a connection made to the listener itself, which would
+// otherwise loop back into the proxy. Linux only; elsewhere nothing is ever redirected.
+bool originalDestination(socket_t client_fd, int listen_port, sockaddr_in& destination);
+
+// Reads what the client sends before it waits for an answer: a whole TLS ClientHello record or an
+// HTTP request head, whatever arrives within TRANSPARENT_SNIFF_MS. Empty for protocols where the
+// server speaks first. The bytes are consumed and must be passed on to the destination.
+std::string readOpening(socket_t client_fd);
+
+// The host name in a TLS ClientHello's server_name extension; empty when there is none or the
+// record is cut short.
+std::string tlsServerName(const std::string& opening);
+
+#endif // TRANSPARENT_H
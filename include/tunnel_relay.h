@@ -0,0 +1,65 @@
+#ifndef TUNNEL_RELAY_H
+#define TUNNEL_RELAY_H
+
+#include "cross_platform.h"
+#include "pool.h"
+#include "traffic_shaper.h"
+
+#include <functional>
+
+#define RELAY_BUFFER_MIN 4096               // a direction starts with this much buffer...
+#define RELAY_BUFFER_MAX 65536              // ...and grows while reads keep filling it, up to this; its source is not read while it is full
+#define TUNNEL_SEND_BUFFER 0                // SO_SNDBUF for both tunnel sockets in bytes; 0 keeps the kernel's autotuning
+#define TUNNEL_NOTSENT_LOWAT 0              // TCP_NOTSENT_LOWAT for both tunnel sockets in bytes; 0 keeps the system default
+#define TUNNEL_MAX_CAPTURED_RESPONSES 256   // exchanges of one plaintext tunnel recorded as transactions
+
+// Applies TUNNEL_SEND_BUFFER and TUNNEL_NOTSENT_LOWAT, where set, to a tunnel socket.
+void tuneTunnelSocket(socket_t fd);
+
+// Pumps a tunnel both ways on the calling thread until both directions have ended. Each direction
+// has a bounded buffer: its source is only read while the buffer has room, and its destination is
+// only waited on while bytes are pending, so a slow receiver holds back its own sender without
+// stalling the opposite direction, and a partial send leaves the rest for the next round. A source
+// that finishes sending is passed on as a half-close once its buffer is delivered, while the other
+// direction keeps flowing. Buffers are sized by throughput: a direction whose reads fill its buffer
+// moves up a pool size class, one whose reads stay small moves back down, and an idle direction
+// holds no buffer at all.
+class TunnelRelay {
+public:
+    // Called for every chunk read; `upstream` is true for client-to-server bytes.
+    typedef std::function<void(bool upstream, const char* data, size_t length)> DataHandler;
+
+    TunnelRelay(socket_t client_fd, socket_t remote_fd, DataHandler onData, RateLimit& rateLimit);
+
+    // Returns true once both sides have closed their sending half, false on a socket error.
+    // `proceed` is checked between rounds.
+    bool run(const std::function<bool()>& proceed);
+
+private:
+    struct Direction {
+        socket_t from;
+        socket_t to;
+        bool upstream;
+        PooledBuffer buffer;
+        size_t capacity = RELAY_BUFFER_MIN;     // what the buffer is acquired at when next needed
+        size_t start = 0;       // pending bytes are [start, end)
+        size_t end = 0;
+        bool finished = false;  // `from` closed its sending half
+        bool passedOn = false;  // ... and `to` was half-closed after the last byte
+        bool drained = false;   // the last read emptied `from`, so an empty buffer can go back to the pool
+        std::chrono::steady_clock::time_point resumeAt;     // not read before, while over its bandwidth share
+    };
+
+    Direction directions[2];
+    DataHandler onData;
+    RateLimit& rateLimit;
+
+    // Room the next read may fill.
+    static size_t room(const Direction& direction);
+    // Both return false on a socket error.
+    bool fill(Direction& direction);
+    bool flush(Direction& direction);
+    void passOn(Direction& direction);
+};
+
+#endif // TUNNEL_RELAY_H
@@ -0,0 +1,143 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include "common_lib.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+
+#define WORK_POOL_THREADS 0                 // CPU workers for side work; 0 means one per core
+#define WORK_POOL_DEQUE_CAPACITY 256        // initial slots of each worker's deque (power of two), grows as needed
+
+// Chase-Lev work-stealing deque of pointers. The owning thread pushes and pops at the bottom
+// without locks; any other thread may steal from the top. Arrays outgrown while thieves might still
+// be reading them are kept until the deque goes away.
+template <typename T>
+class ChaseLevDeque {
+private:
+    struct Array {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+
+        explicit Array(int64_t capacity) : capacity(capacity), slots(new std::atomic<T*>[capacity]) {}
+        T* get(int64_t index) const { return slots[index & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t index, T* item) { slots[index & (capacity - 1)].store(item, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> top{0};
+    std::atomic<int64_t> bottom{0};
+    std::atomic<Array*> array;
+    std::vector<std::unique_ptr<Array>> arrays;     // owner only
+
+public:
+    explicit ChaseLevDeque(int64_t capacity = WORK_POOL_DEQUE_CAPACITY) {
+        arrays.emplace_back(new Array(capacity));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+    ChaseLevDeque(const ChaseLevDeque&) = delete;
+    ChaseLevDeque& operator=(const ChaseLevDeque&) = delete;
+
+    // Owner only.
+    void push(T* item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* current = array.load(std::memory_order_relaxed);
+        if (b - t > current->capacity - 1) {
+            Array* grown = new Array(current->capacity * 2);
+            for (int64_t i = t; i < b; i++) grown->put(i, current->get(i));
+            arrays.emplace_back(grown);
+            array.store(grown, std::memory_order_release);
+            current = grown;
+        }
+        current->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only: the most recently pushed item, or nullptr when empty.
+    T* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* current = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = current->get(b);
+        if (t == b) {
+            // Last item: race any thief for it.
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) item = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread: the oldest item, or nullptr when empty or another thread won it.
+    T* steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        T* item = array.load(std::memory_order_acquire)->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+        return item;
+    }
+};
+
+// Fixed set of CPU workers for side work that must not hold up relaying: compression, connection
+// log formatting, parsing captured payloads, rebuilding the blocklist index. Each worker runs the
+// jobs it spawns itself from its own deque, newest first, takes jobs submitted from other threads
+// from a shared queue, and steals the oldest jobs of busy workers when it runs dry.
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Job;
+
+    static WorkStealingPool& instance();
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    void submit(Job job);
+    // Jobs whose caller needs the result; only wait on the future from outside the pool.
+    template <typename F>
+    auto async(F function) -> std::future<decltype(function())> {
+        auto task = std::make_shared<std::packaged_task<decltype(function())()>>(std::move(function));
+        std::future<decltype(function())> result = task->get_future();
+        submit([task]() { (*task)(); });
+        return result;
+    }
+
+    // Jobs submitted and not started yet.
+    size_t backlog() const { return queued.load(std::memory_order_relaxed); }
+    size_t workerCount() const { return workers.size(); }
+    // True on the pool's own threads, which must run dependent work inline instead of waiting on it.
+    static bool onWorker();
+
+private:
+    struct Worker {
+        ChaseLevDeque<Job> deque;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex injected_mutex;
+    std::deque<Job*> injected;
+    std::mutex sleep_mutex;
+    std::condition_variable wakeup;
+    std::atomic<size_t> queued{0};
+    std::atomic<int> sleeping{0};
+    std::atomic<bool> stopping{false};
+
+    explicit WorkStealingPool(int threads);
+    void work(size_t index);
+    Job* find(size_t index, uint32_t& seed);
+    void wakeOne();
+};
+
+#endif // WORK_POOL_H
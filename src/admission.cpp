@@ -0,0 +1,131 @@
+#include "../include/admission.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sys/resource.h>
+#endif
+
+// ----------------- Admission -----------------
+Admission& Admission::operator=(Admission&& other) noexcept {
+    if (this != &other) {
+        if (control) control->release(client_ip);
+        control = other.control;
+        client_ip = other.client_ip;
+        other.control = nullptr;
+    }
+    return *this;
+}
+
+Admission::~Admission() {
+    if (control) control->release(client_ip);
+}
+
+// ----------------- AdmissionControl -----------------
+Admission AdmissionControl::admit(const sockaddr_in& client_addr) {
+    uint32_t client_ip = client_addr.sin_addr.s_addr;
+    // The slot is taken before it is checked, so accept loops racing each other cannot both get the last one.
+    int before = total.fetch_add(1, std::memory_order_relaxed);
+    if (ADMISSION_MAX_CONNECTIONS > 0 && before >= ADMISSION_MAX_CONNECTIONS) {
+        total.fetch_sub(1, std::memory_order_relaxed);
+        LOG_WARNING("Connection limit of %d reached, turning a client away", ADMISSION_MAX_CONNECTIONS);
+        return Admission();
+    }
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        int& open = clients[client_ip];
+        if (ADMISSION_MAX_PER_CLIENT > 0 && open >= ADMISSION_MAX_PER_CLIENT) {
+            total.fetch_sub(1, std::memory_order_relaxed);
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, ip, INET_ADDRSTRLEN);
+            LOG_WARNING("Client %s already holds %d connections, turning it away", ip, open);
+            return Admission();
+        }
+        open++;
+    }
+    return Admission(this, client_ip);
+}
+
+void AdmissionControl::release(uint32_t client_ip) {
+    total.fetch_sub(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    auto it = clients.find(client_ip);
+    if (it != clients.end() && --it->second <= 0) clients.erase(it);
+}
+
+bool AdmissionControl::shouldPause() {
+    std::lock_guard<std::mutex> lock(sample_mutex);
+    sample();
+    return overloaded;
+}
+
+void AdmissionControl::sample() {
+#if defined(__linux__)
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastSample < std::chrono::milliseconds(ADMISSION_SAMPLE_MS)) return;
+    lastSample = now;
+
+    int fdPercent = 0;
+    rlimit limit;
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir && getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 0) {
+        size_t open = 0;
+        while (readdir(dir)) open++;
+        open = open > 3 ? open - 3 : 0;     // ".", ".." and the directory itself
+        fdPercent = int(open * 100 / limit.rlim_cur);
+    }
+    if (dir) closedir(dir);
+
+    int memoryPercent = 0;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    long physicalPages = sysconf(_SC_PHYS_PAGES);
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        unsigned long size = 0, resident = 0;
+        if (fscanf(statm, "%lu %lu", &size, &resident) == 2 && physicalPages > 0 && pageSize > 0) {
+            memoryPercent = int(resident * 100 / physicalPages);
+        }
+        fclose(statm);
+    }
+
+    bool wasOverloaded = overloaded;
+    if (overloaded) {
+        overloaded = fdPercent >= ADMISSION_FD_LOW_PERCENT || memoryPercent >= ADMISSION_MEMORY_LOW_PERCENT;
+    } else {
+        overloaded = fdPercent >= ADMISSION_FD_HIGH_PERCENT || memoryPercent >= ADMISSION_MEMORY_HIGH_PERCENT;
+    }
+    if (overloaded == wasOverloaded) return;
+
+    MetricsRegistry::instance().increment(METRIC_ACCEPT_PAUSED, overloaded ? 1 : -1);
+    if (overloaded) {
+        LOG_WARNING("Pausing accepts: %d%% of file descriptors and %d%% of memory in use", fdPercent, memoryPercent);
+    } else {
+        LOG_INFO("Resuming accepts: %d%% of file descriptors and %d%% of memory in use", fdPercent, memoryPercent);
+    }
+#endif
+}
+
+void AdmissionControl::reject(socket_t client_fd) {
+    static const std::string response = "HTTP/1.1 503 Service Unavailable\r\n"
+                                        "Retry-After: " + std::to_string(ADMISSION_RETRY_AFTER_SECONDS) + "\r\n"
+                                        "Content-Length: 0\r\n"
+                                        "Connection: close\r\n\r\n";
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    // The socket is fresh, so the response fits its send buffer; it must never wait or raise SIGPIPE.
+    flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#endif
+    send(client_fd, response.data(), response.size(), flags);
+
+    // Closing with the request still unread would make the kernel answer with a reset, which can
+    // overtake the 503. Whatever has already arrived is read away after the FIN, without waiting for more.
+    SHUTDOWN_SOCKET_WRITE(client_fd);
+    set_socket_blocking(client_fd, false);
+    char discard[4096];
+    size_t drained = 0;
+    ssize_t n;
+    while (drained < ADMISSION_DRAIN_BYTES && (n = recv(client_fd, discard, sizeof(discard), 0)) > 0) drained += n;
+    CLOSE_SOCKET(client_fd);
+    MetricsRegistry::instance().increment(METRIC_CONNECTIONS_REJECTED);
+}
@@ -0,0 +1,321 @@
+#include "../include/async_connection.h"
+
+AsyncConnection::AsyncConnection(Proxy& proxy, EventLoop& loop, socket_t client_fd, std::chrono::steady_clock::time_point accepted_at,
+                                 Admission admission)
+    : proxy(proxy), io(loop), client_fd(client_fd), remote_fd(INVALID_SOCKET), client_addr(), handedOff(false), shutDown(false),
+      relayError(nullptr), info(ObjectPool<ConnectionInfo>::acquire()), admission(std::move(admission)), deadlines(proxy.timers), acceptedAt(accepted_at),
+      firstUpstreamByte(true), clientSpoke(false) {}
+
+// Runs once run() has returned, so nothing is pending on either socket any more.
+AsyncConnection::~AsyncConnection() {
+    deadlines.cancelAll();
+    entry.reset();
+    if (remote_fd != INVALID_SOCKET) {
+        io.release(remote_fd);
+        CLOSE_SOCKET(remote_fd);
+    }
+    if (client_fd != INVALID_SOCKET) {
+        io.release(client_fd);
+        CLOSE_SOCKET(client_fd);
+    }
+
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE, -1);
+    if (handedOff) return;      // the threaded handler accounts for the rest
+    metrics.record(METRIC_TOTAL_DURATION, std::chrono::steady_clock::now() - acceptedAt);
+}
+
+Task<> AsyncConnection::serve(Proxy& proxy, EventLoop& loop, socket_t client_fd, std::chrono::steady_clock::time_point accepted_at,
+                              Admission admission) {
+    AsyncConnection connection(proxy, loop, client_fd, accepted_at, std::move(admission));
+    co_await connection.run();
+}
+
+Task<> AsyncConnection::run() {
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    metrics.record(METRIC_ACCEPT_LATENCY, std::chrono::steady_clock::now() - acceptedAt);
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE);
+
+    socklen_t length = sizeof(client_addr);
+    getpeername(client_fd, (sockaddr*)&client_addr, &length);
+    entry = proxy.registry.open(client_fd, client_addr);
+    inet_ntop(AF_INET, &client_addr.sin_addr, info->client.ip, INET_ADDRSTRLEN);
+    info->client.port = ntohs(client_addr.sin_port);
+    info->time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+    try {
+        deadlines.armHeaderRead(client_fd);
+        bool received = co_await readHead();
+        deadlines.cancelHeaderRead();
+        if (!received) {
+            throw std::runtime_error("Failed to receive data from client");
+        }
+
+        request = parseHttpRequest(head);
+        info->parseServerPort(request);
+        std::string host = request.getHeader("Host");
+        entry.setTarget(host, info->server.port);
+
+        if (!isValidHttpMethod(request.method)) {
+            LOG_WARNING("Method is not valid!");
+            co_await reply(BAD_REQUEST_RESPONSE);
+            throw std::runtime_error("Method is not valid!");
+        }
+
+        if (!isValidHttpVersion(request.httpVersion)) {
+            LOG_WARNING("HTTP version is not supported!");
+            co_await reply(VERSION_NOT_SUPPORTED_RESPONSE);
+            throw std::runtime_error("Version HTTP is not supported!");
+        }
+
+        if (proxy.BLACK_LIST.isBlocked(host)) {
+            co_await rejectBlocked();
+        }
+
+        // The cache, h2c streams and parent proxies are served by the threaded handler.
+        if ((request.method != "CONNECT" && HttpCache::isCacheableRequest(request)) || proxy.h2c.routes(request, info->server.port) ||
+            proxy.parents.routes(host)) {
+            handOff();
+            co_return;
+        }
+
+        co_await connectRemote(host);
+        if (request.method == "CONNECT") {
+            co_await tunnel();
+        } else {
+            co_await forward();
+        }
+        proxy.updateConnections(*info);
+    } catch (const std::exception& e) {
+        metrics.increment(METRIC_CONNECTION_ERRORS);
+        LOG_ERROR("Connection from %s:%u ended with exception: %s", info->client.ip, info->client.port, e.what());
+    }
+}
+
+Task<bool> AsyncConnection::readHead() {
+    while (true) {
+        RecvResult received = co_await io.read(client_fd);
+        if (received.result <= 0) co_return false;
+        head.append(received.buffer.data, received.result);
+        io.releaseBuffer(received.buffer);
+
+        if (head.find("\r\n\r\n") != std::string::npos || head.size() >= BUFFER_SIZE || parseHttpRequest(head).isEncrypted) {
+            co_return true;
+        }
+    }
+}
+
+Task<> AsyncConnection::reply(const char* response) {
+    co_await io.write(client_fd, response, strlen(response));
+    info->addTransaction(request, parseHttpResponse(response));
+    proxy.updateConnections(*info);
+}
+
+Task<> AsyncConnection::rejectBlocked() {
+    LOG_WARNING("This domain/ip is blocked: %s", findHeader(request.headers, "Host").c_str());
+    MetricsRegistry::instance().increment(METRIC_REQUESTS_BLOCKED);
+    co_await reply(BLOCKED_RESPONSE);
+    throw std::runtime_error("This domain/ip is blocked!");
+}
+
+Task<> AsyncConnection::connectRemote(const std::string& host) {
+    entry.setState(CONNECTION_RESOLVING);
+    ResolveResult resolved = co_await io.resolve(host, info->server.port);
+    if (!resolved.found) {
+        LOG_ERROR("(AsyncConnection::connectRemote) Failed to resolve remote domain %s", host.c_str());
+        throw std::runtime_error("Failed to connect server remote");
+    }
+
+    // Checked before connecting, so a blocked address is never contacted.
+    inet_ntop(AF_INET, &resolved.address.sin_addr, info->server.ip, INET_ADDRSTRLEN);
+    if (proxy.BLACK_LIST.isBlocked(info->server.ip)) {
+        co_await rejectBlocked();
+    }
+
+    remote_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (remote_fd == INVALID_SOCKET) {
+        LOG_ERROR("(AsyncConnection::connectRemote) Socket (remote) creation failed: %s", socketErrorText().c_str());
+        throw std::runtime_error("Failed to connect server remote");
+    }
+    entry.setRemote(remote_fd);
+    entry.setState(CONNECTION_CONNECTING);
+
+    applyUpstreamOptions(remote_fd, *proxy.socket_profile.load());
+    auto connect_start = std::chrono::steady_clock::now();
+    deadlines.armConnect(remote_fd);
+    int connected = co_await io.connect(remote_fd, resolved.address);
+    deadlines.cancelConnect();
+    if (connected < 0) {
+        LOG_ERROR("(AsyncConnection::connectRemote) Connect to remote server failed: %s", strerror(-connected));
+        throw std::runtime_error("Failed to connect server remote");
+    }
+    MetricsRegistry::instance().record(METRIC_CONNECT_LATENCY, std::chrono::steady_clock::now() - connect_start);
+    LOG_INFO("Client %s:%u connected to %s:%u", info->client.ip, info->client.port, info->server.ip, info->server.port);
+
+    deadlines.armLifetime(client_fd, remote_fd, CONNECTION_LIFETIME_MS);
+}
+
+Task<> AsyncConnection::tunnel() {
+    deadlines.armIdle(client_fd, remote_fd, TUNNEL_IDLE_TIMEOUT_MS);
+    entry.setState(CONNECTION_TUNNELING);
+    int sent = co_await io.write(client_fd, CONNECT_ESTABLISHED_RESPONSE, strlen(CONNECT_ESTABLISHED_RESPONSE));
+    if (sent != int(strlen(CONNECT_ESTABLISHED_RESPONSE))) {
+        throw std::runtime_error("Failed to answer CONNECT");
+    }
+    info->addTransaction(request, parseHttpResponse(CONNECT_ESTABLISHED_RESPONSE));
+    rateLimit = proxy.shaper.limit(info->client.ip, request.getHeader("Host"));
+    tuneTunnelSocket(client_fd);
+    tuneTunnelSocket(remote_fd);
+
+    Latch finished(2);
+    spawn(relay(client_fd, remote_fd, true, finished));
+    spawn(relay(remote_fd, client_fd, false, finished));
+    co_await finished;
+
+    if (relayError) {
+        throw std::runtime_error(relayError);
+    }
+    if (!capturedResponses.empty()) {
+        co_await io.compute([this]() {
+            for (const std::string& captured : capturedResponses) info->addTransaction(request, parseHttpResponse(captured));
+            capturedResponses.clear();
+        });
+    }
+}
+
+// One direction of the tunnel: whatever arrives on `from` is sent to `to`, and `from` is read
+// again only once that send completed, so neither side can be flooded faster than the other drains.
+// Over its bandwidth share, the direction sleeps before reading again. A direction whose source
+// closes half-closes its destination; one that fails cancels the other.
+Task<> AsyncConnection::relay(socket_t from, socket_t to, bool upstream, Latch& finished) {
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    RecvResult received = co_await io.read(from);
+    while (received.result > 0) {
+        deadlines.touch();
+        entry.addBytes(upstream, received.result);
+        if (upstream) {
+            metrics.increment(METRIC_BYTES_CLIENT_TO_SERVER, received.result);
+            clientSpoke = true;
+        } else {
+            if (firstUpstreamByte) {
+                metrics.record(METRIC_TIME_TO_FIRST_BYTE, std::chrono::steady_clock::now() - acceptedAt);
+                firstUpstreamByte = false;
+            }
+            metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, received.result);
+            // Only plaintext tunnels are recorded as transactions; TLS records are not parsed. The head
+            // the server answers each request with is kept, up to a limit so a long-lived tunnel does
+            // not grow, and parsed once the tunnel is over, on the work pool rather than between chunks.
+            if (clientSpoke && !request.isEncrypted && capturedResponses.size() < TUNNEL_MAX_CAPTURED_RESPONSES) {
+                capturedResponses.push_back(messageHead(received.buffer.data, received.result));
+            }
+            clientSpoke = false;
+        }
+
+        std::chrono::milliseconds delay = rateLimit.charge(received.result);
+        if (delay.count() > 0) {
+            int sent = co_await io.write(to, received.buffer.data, received.result);
+            io.releaseBuffer(received.buffer);
+            if (sent != received.result) {
+                received.result = sent < 0 ? sent : -EPIPE;
+                break;
+            }
+            co_await io.sleep(delay.count());
+            received = co_await io.read(from);
+            continue;
+        }
+
+        TransferResult transfer = co_await io.writeThenRead(to, received.buffer.data, received.result, from);
+        io.releaseBuffer(received.buffer);
+        if (transfer.sent != received.result) {
+            if (transfer.next.result > 0) io.releaseBuffer(transfer.next.buffer);
+            received.result = transfer.sent < 0 ? transfer.sent : -EPIPE;
+            break;
+        }
+        received = transfer.next;
+    }
+
+    if (received.result == 0 && !shutDown) {
+        // `from` is done sending but may still be reading: pass the half-close on and let the
+        // other direction run until it ends too.
+        SHUTDOWN_SOCKET_WRITE(to);
+    } else {
+        if (received.result < 0 && received.result != -ECANCELED && !shutDown && !relayError) {
+            relayError = "Tunnel relay failed";
+        }
+        cancelPending();
+    }
+    finished.countDown();      // may resume and finish the connection, so nothing may follow it
+}
+
+// Plain requests the cache does not touch, relayed until the response framing ends. Compression
+// and parsing the recorded response run on the work pool while the coroutine waits.
+Task<> AsyncConnection::forward() {
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    deadlines.armIdle(client_fd, remote_fd, HTTP_IDLE_TIMEOUT_MS);
+    entry.setState(CONNECTION_FORWARDING);
+    int sent = co_await io.write(remote_fd, request.rawRequest.data(), request.rawRequest.size());
+    if (sent != int(request.rawRequest.size())) {
+        throw std::runtime_error("Failed to send request to server remote");
+    }
+    metrics.increment(METRIC_BYTES_CLIENT_TO_SERVER, sent);
+    entry.addBytes(true, sent);
+
+    ResponseTracker tracker(request.method);
+    ResponseCompressor compressor(request);
+    std::string res;
+    while (!tracker.isComplete()) {
+        RecvResult received = co_await io.read(remote_fd);
+        if (received.result <= 0) break;
+        deadlines.touch();
+        entry.addBytes(false, received.result);
+        if (firstUpstreamByte) {
+            metrics.record(METRIC_TIME_TO_FIRST_BYTE, std::chrono::steady_clock::now() - acceptedAt);
+            firstUpstreamByte = false;
+        }
+
+        tracker.feed(received.buffer.data, received.result);
+        if (res.size() + received.result <= CACHE_MAX_OBJECT_BYTES) res.append(received.buffer.data, received.result);
+
+        std::string out;
+        const char* data = received.buffer.data;
+        size_t length = received.result;
+        if (!compressor.isPassthrough()) {
+            out = co_await io.compute([&compressor, &received]() { return compressor.feed(received.buffer.data, received.result); });
+            data = out.data();
+            length = out.size();
+        }
+        int written = length > 0 ? co_await io.write(client_fd, data, length) : 0;
+        io.releaseBuffer(received.buffer);
+        if (written != int(length)) {
+            throw std::runtime_error("Failed to send response to client");
+        }
+        metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, written);
+    }
+    // A truncated compressed body must not be terminated as if it were whole.
+    if (!compressor.isPassthrough() && (tracker.isComplete(true) || !compressor.isActive())) {
+        std::string out = co_await io.compute([&compressor]() { return compressor.finish(); });
+        if (!out.empty() && co_await io.write(client_fd, out.data(), out.size()) == int(out.size())) {
+            metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, out.size());
+        }
+    }
+
+    res += "\n";
+    HttpResponse response = co_await io.compute([&res]() { return parseHttpResponse(res); });
+    info->addTransaction(request, response);
+}
+
+void AsyncConnection::handOff() {
+    deadlines.cancelAll();
+    io.release(client_fd);
+    socket_t fd = client_fd;
+    client_fd = INVALID_SOCKET;
+    handedOff = true;
+    std::thread(&Proxy::handleClient, &proxy, fd, client_addr, acceptedAt, head, std::move(admission), std::move(entry)).detach();
+}
+
+void AsyncConnection::cancelPending() {
+    if (shutDown) return;
+    shutDown = true;
+    io.cancel(client_fd);
+    io.cancel(remote_fd);
+}
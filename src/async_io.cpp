@@ -0,0 +1,20 @@
+#include "../include/async_io.h"
+#include "../include/metrics.h"
+
+ResolveResult AsyncIo::resolveNow(const std::string& host, uint16_t port) {
+    ResolveResult resolved;
+    auto dns_start = std::chrono::steady_clock::now();
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    resolved.found = getaddrinfo(host.c_str(), nullptr, &hints, &addresses) == 0 && addresses;
+    MetricsRegistry::instance().record(METRIC_DNS_LATENCY, std::chrono::steady_clock::now() - dns_start);
+
+    if (resolved.found) {
+        memcpy(&resolved.address, addresses->ai_addr, sizeof(resolved.address));
+        resolved.address.sin_port = htons(port);
+        freeaddrinfo(addresses);
+    }
+    return resolved;
+}
@@ -0,0 +1,111 @@
+#include "../include/collapsed_forwarding.h"
+#include "../include/http_cache.h"
+
+// ----------------- InflightFetch -----------------
+InflightFetch::InflightFetch(const std::string& key, const HttpRequest& request)
+    : leader(request), tracker(request.method), key(key) {}
+
+void InflightFetch::append(const char* bytes, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (overflowed || finished) return;
+    if (data.size() + length > COLLAPSED_MAX_RESPONSE_BYTES) {
+        overflowed = true;
+        data.clear();
+        data.shrink_to_fit();
+        changed.notify_all();
+        return;
+    }
+    data.append(bytes, length);
+    tracker.feed(bytes, length);
+
+    if (!headKnown && tracker.hasHead()) {
+        std::string response = tracker.finalResponse(data);
+        head = response.substr(0, response.find("\r\n\r\n") + 4);
+        HttpResponse parsed = parseHttpResponse(head);
+
+        // Only what the cache itself would store is shared: anything personalised, not meant for
+        // shared caches or without a freshness lifetime goes to each requester separately.
+        BodyFraming framing = responseBodyFraming(parsed, "GET");
+        headKnown = true;
+        vary = findHeader(parsed.headers, "Vary");
+        shareable = HttpCache::buildEntry(leader, head) != nullptr && parsed.statusCode != 101 &&
+                    !(framing.kind == BodyFraming::CONTENT_LENGTH && framing.length > COLLAPSED_MAX_RESPONSE_BYTES);
+        sharedWithCookies = headerHasToken(findHeader(parsed.headers, "Cache-Control"), "public") || headerHasToken(vary, "Cookie");
+    }
+    changed.notify_all();
+}
+
+void InflightFetch::finish(bool completed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (finished) return;
+    finished = true;
+    complete = completed && !overflowed;
+    changed.notify_all();
+}
+
+bool InflightFetch::waitForHead(const HttpRequest& request, std::string& finalHead) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return headKnown || finished || overflowed; });
+    if (!headKnown || !shareable || overflowed) return false;
+    // A page built from one user's cookie must not reach another user.
+    bool cookies = !findHeader(request.headers, "Cookie").empty() || !findHeader(leader.headers, "Cookie").empty();
+    if (cookies && !sharedWithCookies) return false;
+
+    size_t start = 0;
+    while (start < vary.size()) {
+        size_t end = vary.find(',', start);
+        if (end == std::string::npos) end = vary.size();
+        std::string name = vary.substr(start, end - start);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (!name.empty() && findHeader(request.headers, name) != findHeader(leader.headers, name)) return false;
+        start = end + 1;
+    }
+    finalHead = head;
+    return true;
+}
+
+bool InflightFetch::read(size_t offset, std::string& chunk) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this, offset]() { return data.size() > offset || finished || overflowed; });
+    chunk.clear();
+    if (overflowed) return false;
+
+    if (data.size() > offset) {
+        chunk = data.substr(offset, std::min<size_t>(data.size() - offset, BUFFER_SIZE));
+    }
+    return !finished || offset + chunk.size() < data.size();
+}
+
+bool InflightFetch::isComplete() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return complete;
+}
+
+// ----------------- CollapsedForwarding -----------------
+std::shared_ptr<InflightFetch> CollapsedForwarding::join(const std::string& key, const HttpRequest& request, bool& leader) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = inflight.find(key);
+    leader = it == inflight.end();
+    if (!leader) return it->second;
+
+    auto fetch = std::make_shared<InflightFetch>(key, request);
+    inflight[key] = fetch;
+    return fetch;
+}
+
+void CollapsedForwarding::leave(const std::shared_ptr<InflightFetch>& fetch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = inflight.find(fetch->key);
+    if (it != inflight.end() && it->second == fetch) inflight.erase(it);
+}
+
+// ----------------- InflightLease -----------------
+InflightLease::InflightLease(CollapsedForwarding& registry, std::shared_ptr<InflightFetch> fetch)
+    : registry(registry), fetch(std::move(fetch)) {}
+
+InflightLease::~InflightLease() {
+    if (!fetch) return;
+    fetch->finish(false);
+    registry.leave(fetch);
+}
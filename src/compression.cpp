@@ -0,0 +1,207 @@
+#include "../include/compression.h"
+#include "../include/metrics.h"
+
+static const char* COMPRESSIBLE_TYPES[] = {
+    "text/", "application/json", "application/javascript", "application/xml", "application/xhtml+xml",
+    "application/rss+xml", "application/atom+xml", "image/svg+xml", "application/wasm",
+};
+
+bool acceptsEncoding(const HttpRequest& request, const std::string& coding) {
+    std::string accepted = findHeader(request.headers, "Accept-Encoding");
+    size_t start = 0;
+    while (start < accepted.size()) {
+        size_t end = accepted.find(',', start);
+        if (end == std::string::npos) end = accepted.size();
+        std::string item = accepted.substr(start, end - start);
+        start = end + 1;
+
+        std::string name = item.substr(0, item.find(';'));
+        if (!headerHasToken(name, coding) && !headerHasToken(name, "*")) continue;
+
+        size_t q = item.find("q=");
+        if (q == std::string::npos) return true;
+        try {
+            return std::stod(item.substr(q + 2)) > 0;
+        } catch (const std::exception& e) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool isCompressibleType(const std::string& contentType) {
+    std::string type = contentType.substr(0, contentType.find(';'));
+    type.erase(0, type.find_first_not_of(" \t"));
+    std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+    for (const char* prefix : COMPRESSIBLE_TYPES) {
+        if (type.compare(0, strlen(prefix), prefix) == 0) return true;
+    }
+    return false;
+}
+
+// ----------------- GzipEncoder -----------------
+GzipEncoder::GzipEncoder(int level) : stream() {
+    // windowBits 15 + 16 selects the gzip wrapper instead of zlib's own.
+    ready = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+GzipEncoder::~GzipEncoder() {
+    if (ready) deflateEnd(&stream);
+}
+
+bool GzipEncoder::isReady() const {
+    return ready;
+}
+
+std::string GzipEncoder::compress(const char* data, size_t length, bool finish) {
+    std::string out;
+    if (!ready) return out;
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = length;
+    char chunk[16384];
+    int result;
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(chunk);
+        stream.avail_out = sizeof(chunk);
+        result = deflate(&stream, finish ? Z_FINISH : Z_SYNC_FLUSH);
+        out.append(chunk, sizeof(chunk) - stream.avail_out);
+    } while (stream.avail_out == 0 && result != Z_STREAM_END);
+    return out;
+}
+
+// ----------------- ResponseCompressor -----------------
+ResponseCompressor::ResponseCompressor(const HttpRequest& request)
+    : clientAccepts(acceptsEncoding(request, "gzip") && request.httpVersion == "HTTP/1.1" && request.method != "HEAD"),
+      requestMethod(request.method) {}
+
+bool ResponseCompressor::qualifies(const HttpResponse& response) {
+    if (!clientAccepts || response.httpVersion != "HTTP/1.1") return false;
+    if (response.statusCode < 200 || response.statusCode >= 300 || response.statusCode == 206) return false;
+
+    std::string encoding = findHeader(response.headers, "Content-Encoding");
+    if (!encoding.empty() && !headerHasToken(encoding, "identity")) return false;
+    if (headerHasToken(findHeader(response.headers, "Cache-Control"), "no-transform")) return false;
+    if (!isCompressibleType(findHeader(response.headers, "Content-Type"))) return false;
+
+    framing = responseBodyFraming(response, requestMethod);
+    if (framing.kind == BodyFraming::NONE) return false;
+    if (framing.kind == BodyFraming::CONTENT_LENGTH && framing.length < COMPRESSION_MIN_BYTES) return false;
+
+    // Over budget: leave this response alone rather than queue behind other pool work.
+    if (WorkStealingPool::instance().backlog() >= COMPRESSION_MAX_BACKLOG) {
+        MetricsRegistry::instance().increment(METRIC_COMPRESSION_SKIPPED);
+        return false;
+    }
+
+    encoder = std::make_unique<GzipEncoder>();
+    return encoder->isReady();
+}
+
+std::string ResponseCompressor::rewriteHead(const std::string& head) {
+    std::string rewritten;
+    bool hasVary = false;
+    size_t lineStart = 0;
+    while (lineStart < head.size()) {
+        size_t lineEnd = head.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos || lineEnd == lineStart) break;
+        std::string line = head.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 2;
+
+        std::string name = line.substr(0, line.find(':'));
+        std::string value = line.find(':') == std::string::npos ? "" : line.substr(line.find(':') + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        if (rewritten.empty()) {
+            rewritten += line + "\r\n";
+        } else if (headerHasToken(name, "Content-Length") || headerHasToken(name, "Transfer-Encoding") ||
+                   headerHasToken(name, "Content-Encoding")) {
+            continue;
+        } else if (headerHasToken(name, "ETag")) {
+            // A different representation may not reuse a strong validator.
+            rewritten += "ETag: " + (value.compare(0, 2, "W/") == 0 ? value : "W/" + value) + "\r\n";
+        } else if (headerHasToken(name, "Vary")) {
+            hasVary = true;
+            rewritten += line + (headerHasToken(value, "Accept-Encoding") ? "" : ", Accept-Encoding") + "\r\n";
+        } else {
+            rewritten += line + "\r\n";
+        }
+    }
+    if (!hasVary) rewritten += "Vary: Accept-Encoding\r\n";
+    rewritten += "Content-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n";
+    return rewritten;
+}
+
+std::string ResponseCompressor::encodeChunk(const std::string& payload, bool finish) {
+    // Already on a pool worker (an event loop handed the whole feed() over): compress right here,
+    // since waiting on another job from inside the pool could starve it.
+    GzipEncoder* gzip = encoder.get();
+    std::string compressed = WorkStealingPool::onWorker() ? gzip->compress(payload.data(), payload.size(), finish)
+        : WorkStealingPool::instance().async([gzip, &payload, finish]() {
+              return gzip->compress(payload.data(), payload.size(), finish);
+          }).get();
+    bytesIn += payload.size();
+    bytesOut += compressed.size();
+
+    std::string out;
+    if (!compressed.empty()) {
+        char size[20];
+        snprintf(size, sizeof(size), "%zx\r\n", compressed.size());
+        out = size + compressed + "\r\n";
+    }
+    if (finish) {
+        out += "0\r\n\r\n";
+        MetricsRegistry& metrics = MetricsRegistry::instance();
+        metrics.increment(METRIC_COMPRESSION_BYTES_IN, bytesIn);
+        metrics.increment(METRIC_COMPRESSION_BYTES_OUT, bytesOut);
+    }
+    return out;
+}
+
+std::string ResponseCompressor::feed(const char* data, size_t length) {
+    if (headDone && !active) return std::string(data, length);
+
+    std::string out;
+    if (!headDone) {
+        // Hold the final head back until it is complete; interim responses go through as they are.
+        pendingHead.append(data, length);
+        size_t end;
+        while ((end = pendingHead.find("\r\n\r\n")) != std::string::npos) {
+            std::string head = pendingHead.substr(0, end + 4);
+            pendingHead.erase(0, end + 4);
+            HttpResponse response = parseHttpResponse(head);
+            if (response.statusCode >= 100 && response.statusCode < 200 && response.statusCode != 101) {
+                out += head;
+                continue;
+            }
+
+            headDone = true;
+            active = qualifies(response);
+            std::string rest = std::exchange(pendingHead, std::string());
+            if (!active) return out + head + rest;
+
+            MetricsRegistry::instance().increment(METRIC_COMPRESSED_RESPONSES);
+            out += rewriteHead(head);
+            return rest.empty() ? out : out + feed(rest.data(), rest.size());
+        }
+        return out;
+    }
+
+    std::string payload;
+    if (framing.kind == BodyFraming::CHUNKED) {
+        chunked.feed(data, length, &payload);
+    } else if (framing.kind == BodyFraming::CONTENT_LENGTH) {
+        size_t take = std::min(length, framing.length - bodyBytes);
+        payload.assign(data, take);
+        bodyBytes += take;
+    } else {
+        payload.assign(data, length);
+    }
+    if (!payload.empty()) out += encodeChunk(payload, false);
+    return out;
+}
+
+std::string ResponseCompressor::finish() {
+    // Without a final head the held-back bytes are flushed unchanged.
+    if (!active) return std::exchange(pendingHead, std::string());
+    return encodeChunk(std::string(), true);
+}
@@ -0,0 +1,208 @@
+#include "../include/connection_registry.h"
+
+const char* connectionStateName(ConnectionState state) {
+    switch (state) {
+        case CONNECTION_READING:    return "reading";
+        case CONNECTION_RESOLVING:  return "resolving";
+        case CONNECTION_CONNECTING: return "connecting";
+        case CONNECTION_TUNNELING:  return "tunneling";
+        case CONNECTION_FORWARDING: return "forwarding";
+    }
+    return "unknown";
+}
+
+// ----------------- ConnectionEntry -----------------
+ConnectionEntry& ConnectionEntry::operator=(ConnectionEntry&& other) noexcept {
+    if (this != &other) {
+        reset();
+        registry = other.registry;
+        slot = other.slot;
+        other.registry = nullptr;
+    }
+    return *this;
+}
+
+ConnectionEntry::~ConnectionEntry() {
+    reset();
+}
+
+void ConnectionEntry::reset() {
+    if (registry) registry->release(slot);
+    registry = nullptr;
+}
+
+ConnectionId ConnectionEntry::id() const {
+    ConnectionId id;
+    if (!registry) return id;
+    ConnectionRegistry::Slot& entry = registry->at(slot);
+    std::lock_guard<std::mutex> lock(entry.mutex);
+    id.slot = slot;
+    id.generation = entry.generation;
+    return id;
+}
+
+// Under the slot's mutex, so a force-close never shuts down a descriptor the owner has already let go of.
+void ConnectionEntry::setRemote(socket_t remote_fd) {
+    if (!registry) return;
+    ConnectionRegistry::Slot& entry = registry->at(slot);
+    std::lock_guard<std::mutex> lock(entry.mutex);
+    entry.remoteFd.store(remote_fd, std::memory_order_relaxed);
+}
+
+void ConnectionEntry::setState(ConnectionState state) {
+    if (registry) registry->at(slot).state.store(state, std::memory_order_relaxed);
+}
+
+void ConnectionEntry::setTarget(const std::string& host, uint16_t port) {
+    if (!registry) return;
+    ConnectionRegistry::Slot& entry = registry->at(slot);
+    std::lock_guard<std::mutex> lock(entry.mutex);
+    entry.target = host.find(':') == std::string::npos ? host + ":" + std::to_string(port) : host;
+}
+
+void ConnectionEntry::addBytes(bool upstream, size_t length) {
+    if (!registry) return;
+    ConnectionRegistry::Slot& entry = registry->at(slot);
+    (upstream ? entry.bytesUp : entry.bytesDown).fetch_add(length, std::memory_order_relaxed);
+}
+
+// ----------------- ConnectionRegistry -----------------
+ConnectionRegistry::ConnectionRegistry() {
+    for (std::atomic<Slot*>& chunk : chunks) chunk.store(nullptr, std::memory_order_relaxed);
+}
+
+ConnectionRegistry::~ConnectionRegistry() {
+    for (std::atomic<Slot*>& chunk : chunks) delete[] chunk.load();
+}
+
+ConnectionRegistry::Slot& ConnectionRegistry::at(uint32_t slot) const {
+    return chunks[slot / REGISTRY_CHUNK_SLOTS].load(std::memory_order_acquire)[slot % REGISTRY_CHUNK_SLOTS];
+}
+
+ConnectionEntry ConnectionRegistry::open(socket_t client_fd, const sockaddr_in& client_addr) {
+    uint32_t slot;
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(free_mutex);
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            slot = highWater.load(std::memory_order_relaxed);
+            if (slot == uint32_t(REGISTRY_CHUNK_SLOTS) * REGISTRY_MAX_CHUNKS) return ConnectionEntry();
+            // A new chunk is published before the high-water mark moves into it, so readers
+            // scanning below the mark never find it missing.
+            if (slot % REGISTRY_CHUNK_SLOTS == 0) {
+                chunks[slot / REGISTRY_CHUNK_SLOTS].store(new Slot[REGISTRY_CHUNK_SLOTS], std::memory_order_release);
+            }
+            highWater.store(slot + 1, std::memory_order_release);
+        }
+        if (++nextGeneration == 0) ++nextGeneration;
+        generation = nextGeneration;
+    }
+
+    Slot& entry = at(slot);
+    {
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        entry.clientFd.store(client_fd, std::memory_order_relaxed);
+        entry.remoteFd.store(INVALID_SOCKET, std::memory_order_relaxed);
+        entry.state.store(CONNECTION_READING, std::memory_order_relaxed);
+        entry.bytesUp.store(0, std::memory_order_relaxed);
+        entry.bytesDown.store(0, std::memory_order_relaxed);
+        entry.openedAt = std::chrono::steady_clock::now();
+        inet_ntop(AF_INET, &client_addr.sin_addr, entry.clientIp, INET_ADDRSTRLEN);
+        entry.clientPort = ntohs(client_addr.sin_port);
+        entry.target.clear();
+        entry.generation = generation;
+    }
+    live.fetch_add(1, std::memory_order_relaxed);
+    return ConnectionEntry(this, slot);
+}
+
+void ConnectionRegistry::release(uint32_t slot) {
+    Slot& entry = at(slot);
+    {
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        entry.generation = 0;
+        entry.clientFd.store(INVALID_SOCKET, std::memory_order_relaxed);
+        entry.remoteFd.store(INVALID_SOCKET, std::memory_order_relaxed);
+    }
+    live.fetch_sub(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(free_mutex);
+    freeSlots.push_back(slot);
+}
+
+// Called with the slot's mutex held: until the owner gives the slot back, its descriptors are its own.
+void ConnectionRegistry::shutDown(Slot& slot) {
+    socket_t client_fd = slot.clientFd.load(std::memory_order_relaxed);
+    socket_t remote_fd = slot.remoteFd.load(std::memory_order_relaxed);
+    if (client_fd != INVALID_SOCKET) SHUTDOWN_SOCKET(client_fd);
+    if (remote_fd != INVALID_SOCKET) SHUTDOWN_SOCKET(remote_fd);
+}
+
+bool ConnectionRegistry::close(ConnectionId id) {
+    if (!id || id.slot >= highWater.load(std::memory_order_acquire)) return false;
+    Slot& entry = at(id.slot);
+    std::lock_guard<std::mutex> lock(entry.mutex);
+    if (entry.generation != id.generation) return false;
+    shutDown(entry);
+    return true;
+}
+
+int ConnectionRegistry::closeAll() {
+    int closed = 0;
+    uint32_t end = highWater.load(std::memory_order_acquire);
+    for (uint32_t slot = 0; slot < end; slot++) {
+        Slot& entry = at(slot);
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        if (entry.generation == 0) continue;
+        shutDown(entry);
+        closed++;
+    }
+    return closed;
+}
+
+std::vector<ConnectionSnapshot> ConnectionRegistry::snapshot() const {
+    std::vector<ConnectionSnapshot> open;
+    open.reserve(size_t(std::max(size(), 0)));
+    uint32_t end = highWater.load(std::memory_order_acquire);
+    for (uint32_t slot = 0; slot < end; slot++) {
+        Slot& entry = at(slot);
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        if (entry.generation == 0) continue;
+
+        ConnectionSnapshot connection;
+        connection.id.slot = slot;
+        connection.id.generation = entry.generation;
+        memcpy(connection.clientIp, entry.clientIp, sizeof(connection.clientIp));
+        connection.clientPort = entry.clientPort;
+        connection.target = entry.target;
+        connection.state = ConnectionState(entry.state.load(std::memory_order_relaxed));
+        connection.bytesUp = entry.bytesUp.load(std::memory_order_relaxed);
+        connection.bytesDown = entry.bytesDown.load(std::memory_order_relaxed);
+        connection.openedAt = entry.openedAt;
+        open.push_back(std::move(connection));
+    }
+    return open;
+}
+
+// ----------------- ThroughputSampler -----------------
+void ThroughputSampler::sample(std::vector<ConnectionSnapshot>& connections) {
+    auto now = std::chrono::steady_clock::now();
+    std::unordered_map<uint64_t, Sample> current;
+    current.reserve(connections.size());
+    for (ConnectionSnapshot& connection : connections) {
+        uint64_t key = (uint64_t(connection.id.slot) << 32) | connection.id.generation;
+        Sample previous = {0, 0, connection.openedAt};
+        auto it = last.find(key);
+        if (it != last.end()) previous = it->second;
+
+        double seconds = std::chrono::duration<double>(now - previous.at).count();
+        if (seconds > 0) {
+            connection.rateUp = double(connection.bytesUp - previous.bytesUp) / seconds;
+            connection.rateDown = double(connection.bytesDown - previous.bytesDown) / seconds;
+        }
+        current[key] = {connection.bytesUp, connection.bytesDown, now};
+    }
+    last.swap(current);
+}
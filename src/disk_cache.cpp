@@ -0,0 +1,403 @@
+#include "../include/disk_cache.h"
+#include "../include/logger.h"
+
+#include <filesystem>
+
+#if !IS_WINDOWS
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #if defined(__linux__)
+        #include <sys/sendfile.h>
+    #elif defined(__APPLE__)
+        #include <sys/uio.h>
+    #endif
+#endif
+
+static const uint32_t INDEX_MAGIC = 0x50434458;     // "PCDX"
+static const uint32_t INDEX_VERSION = 2;
+static const uint32_t RECORD_MAGIC = 0x50435243;    // "PCRC"
+
+// Fixed part of every slab record; the serialized metadata and then the body follow it.
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t metaLength;
+    uint64_t bodyLength;
+    uint64_t keyHash;
+};
+
+static uint64_t keyHashOf(const std::string& key) {
+    uint64_t hash = std::hash<std::string>()(key);
+    return hash ? hash : 1;     // 0 marks an empty index way
+}
+
+static void putInt(std::string& out, int64_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putString(std::string& out, const std::string& value) {
+    putInt(out, value.size());
+    out += value;
+}
+
+// Reads back what putInt/putString wrote; any overrun marks the whole record as unreadable.
+struct MetaReader {
+    const std::string& data;
+    size_t position = 0;
+    bool ok = true;
+
+    int64_t getInt() {
+        int64_t value = 0;
+        if (position + sizeof(value) > data.size()) {
+            ok = false;
+            return 0;
+        }
+        memcpy(&value, data.data() + position, sizeof(value));
+        position += sizeof(value);
+        return value;
+    }
+
+    std::string getString() {
+        int64_t length = getInt();
+        if (!ok || length < 0 || position + length > data.size()) {
+            ok = false;
+            return std::string();
+        }
+        std::string value = data.substr(position, length);
+        position += length;
+        return value;
+    }
+};
+
+static std::string serializeMeta(const CachedResponse& entry) {
+    std::string meta;
+    putInt(meta, entry.statusCode);
+    putInt(meta, entry.storedAt);
+    putInt(meta, entry.initialAge);
+    putInt(meta, entry.freshnessLifetime);
+    putInt(meta, entry.staleWhileRevalidate);
+    putInt(meta, entry.staleIfError);
+    putInt(meta, entry.mustRevalidate);
+    putString(meta, entry.key);
+    putString(meta, entry.head);
+    putString(meta, entry.etag);
+    putString(meta, entry.lastModified);
+    putInt(meta, entry.varyHeaders.size());
+    for (const auto& [name, value] : entry.varyHeaders) {
+        putString(meta, name);
+        putString(meta, value);
+    }
+    return meta;
+}
+
+static bool deserializeMeta(const std::string& meta, CachedResponse& entry) {
+    MetaReader reader{meta};
+    entry.statusCode = reader.getInt();
+    entry.storedAt = reader.getInt();
+    entry.initialAge = reader.getInt();
+    entry.freshnessLifetime = reader.getInt();
+    entry.staleWhileRevalidate = reader.getInt();
+    entry.staleIfError = reader.getInt();
+    entry.mustRevalidate = reader.getInt() != 0;
+    entry.key = reader.getString();
+    entry.head = reader.getString();
+    entry.etag = reader.getString();
+    entry.lastModified = reader.getString();
+    int64_t varyCount = reader.getInt();
+    for (int64_t i = 0; reader.ok && i < varyCount; i++) {
+        std::string name = reader.getString();
+        std::string value = reader.getString();
+        entry.varyHeaders.push_back({name, value});
+    }
+    return reader.ok;
+}
+
+// ----------------- DiskCache -----------------
+DiskCache::DiskCache(const std::string& directory) : directory(directory), index(nullptr), indexFd(-1) {
+    for (int i = 0; i < DISK_CACHE_SLABS; i++) slabFds[i] = -1;
+}
+
+DiskCache::~DiskCache() {
+    close();
+}
+
+bool DiskCache::isOpen() const {
+    return index != nullptr;
+}
+
+#if IS_WINDOWS
+
+// The slab files rely on pread/pwrite, mmap and sendfile; Windows only gets the memory tier.
+bool DiskCache::open() {
+    LOG_WARNING("Disk cache is not supported on this platform, only the memory cache is used");
+    return false;
+}
+
+void DiskCache::close() {}
+
+bool DiskCache::validEntry(const IndexEntry& entry) const { return false; }
+DiskCache::IndexEntry* DiskCache::findEntry(uint64_t keyHash) { return nullptr; }
+bool DiskCache::reserve(uint64_t length, uint32_t& slab, uint64_t& offset) { return false; }
+bool DiskCache::lookup(const HttpRequest& request, DiskCacheHit& hit) { return false; }
+bool DiskCache::store(const CachedResponse& entry) { return false; }
+bool DiskCache::sendBody(socket_t client_fd, const DiskCacheHit& hit) { return false; }
+bool DiskCache::readBody(const DiskCacheHit& hit, std::string& body) { return false; }
+void DiskCache::remove(const std::string& key) {}
+
+#else
+
+bool DiskCache::open() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index) return true;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        LOG_ERROR("(DiskCache::open) Cannot create %s: %s", directory.c_str(), error.message().c_str());
+        return false;
+    }
+
+    for (int i = 0; i < DISK_CACHE_SLABS; i++) {
+        std::string path = directory + "slab-" + std::to_string(i) + ".dat";
+        slabFds[i] = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+        if (slabFds[i] < 0 || ftruncate(slabFds[i], DISK_CACHE_SLAB_BYTES) < 0) {
+            LOG_ERROR("(DiskCache::open) Cannot open %s: %s", path.c_str(), strerror(errno));
+            break;
+        }
+    }
+
+    std::string indexPath = directory + "index.dat";
+    indexFd = ::open(indexPath.c_str(), O_RDWR | O_CREAT, 0600);
+    struct stat info;
+    bool fresh = indexFd >= 0 && fstat(indexFd, &info) == 0 && size_t(info.st_size) != sizeof(IndexFile);
+    if (indexFd < 0 || ftruncate(indexFd, sizeof(IndexFile)) < 0) {
+        LOG_ERROR("(DiskCache::open) Cannot open %s: %s", indexPath.c_str(), strerror(errno));
+    } else {
+        void* mapped = mmap(nullptr, sizeof(IndexFile), PROT_READ | PROT_WRITE, MAP_SHARED, indexFd, 0);
+        if (mapped == MAP_FAILED) {
+            LOG_ERROR("(DiskCache::open) Cannot map %s: %s", indexPath.c_str(), strerror(errno));
+        } else {
+            index = static_cast<IndexFile*>(mapped);
+        }
+    }
+
+    bool slabsOpen = std::all_of(slabFds, slabFds + DISK_CACHE_SLABS, [](int fd) { return fd >= 0; });
+    if (!index || !slabsOpen) {
+        if (index) munmap(index, sizeof(IndexFile));
+        index = nullptr;
+        if (indexFd >= 0) ::close(indexFd);
+        indexFd = -1;
+        for (int i = 0; i < DISK_CACHE_SLABS; i++) {
+            if (slabFds[i] >= 0) ::close(slabFds[i]);
+            slabFds[i] = -1;
+        }
+        return false;
+    }
+
+    if (fresh || index->magic != INDEX_MAGIC || index->version != INDEX_VERSION ||
+        index->slabCount != DISK_CACHE_SLABS || index->slabBytes != DISK_CACHE_SLAB_BYTES) {
+        // Unknown layout: start empty. Generation 0 never matches, so zeroed entries are unused.
+        memset(index, 0, sizeof(IndexFile));
+        index->magic = INDEX_MAGIC;
+        index->version = INDEX_VERSION;
+        index->slabCount = DISK_CACHE_SLABS;
+        index->slabBytes = DISK_CACHE_SLAB_BYTES;
+        for (int i = 0; i < DISK_CACHE_SLABS; i++) index->generations[i] = 1;
+        LOG_INFO("Disk cache initialised in %s", directory.c_str());
+    } else {
+        LOG_INFO("Disk cache reopened in %s", directory.c_str());
+    }
+    return true;
+}
+
+void DiskCache::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!index) return;
+
+    // Wait for in-flight sends and writes before the descriptors go away.
+    for (int i = 0; i < DISK_CACHE_SLABS; i++) slabLocks[i].lock();
+
+    msync(index, sizeof(IndexFile), MS_SYNC);
+    munmap(index, sizeof(IndexFile));
+    index = nullptr;
+    ::close(indexFd);
+    indexFd = -1;
+    for (int i = 0; i < DISK_CACHE_SLABS; i++) {
+        ::close(slabFds[i]);
+        slabFds[i] = -1;
+        slabLocks[i].unlock();
+    }
+}
+
+bool DiskCache::validEntry(const IndexEntry& entry) const {
+    return entry.keyHash != 0 && entry.slab < DISK_CACHE_SLABS && entry.generation != 0 &&
+           entry.generation == index->generations[entry.slab];
+}
+
+DiskCache::IndexEntry* DiskCache::findEntry(uint64_t keyHash) {
+    IndexEntry* set = &index->entries[(keyHash % DISK_CACHE_INDEX_SETS) * DISK_CACHE_INDEX_WAYS];
+    for (int way = 0; way < DISK_CACHE_INDEX_WAYS; way++) {
+        if (set[way].keyHash == keyHash && validEntry(set[way])) return &set[way];
+    }
+    return nullptr;
+}
+
+// Claims `length` bytes at the write position, moving to (and recycling) the next slab when the
+// current one is full. A slab that is still pinned by a reader or writer is not recycled; the
+// store is skipped instead of waiting.
+bool DiskCache::reserve(uint64_t length, uint32_t& slab, uint64_t& offset) {
+    if (index->writeOffset + length > index->slabBytes) {
+        uint32_t next = (index->writeSlab + 1) % DISK_CACHE_SLABS;
+        if (!slabLocks[next].try_lock()) return false;
+        if (++index->generations[next] == 0) index->generations[next] = 1;
+        slabLocks[next].unlock();
+        index->writeSlab = next;
+        index->writeOffset = 0;
+    }
+    slab = index->writeSlab;
+    offset = index->writeOffset;
+    index->writeOffset += length;
+    return true;
+}
+
+bool DiskCache::lookup(const HttpRequest& request, DiskCacheHit& hit) {
+    std::string key = HttpCache::cacheKey(request);
+    uint64_t keyHash = keyHashOf(key);
+
+    IndexEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!index) return false;
+        IndexEntry* found = findEntry(keyHash);
+        if (!found) return false;
+        entry = *found;
+        hit.pin = std::shared_lock<std::shared_mutex>(slabLocks[entry.slab]);
+    }
+
+    int fd = slabFds[entry.slab];
+    RecordHeader header;
+    if (pread(fd, &header, sizeof(header), entry.offset) != ssize_t(sizeof(header)) ||
+        header.magic != RECORD_MAGIC || header.keyHash != keyHash ||
+        sizeof(header) + header.metaLength + header.bodyLength != entry.recordLength) {
+        hit.pin.unlock();
+        return false;
+    }
+
+    std::string meta(header.metaLength, '\0');
+    CachedResponse& cached = hit.meta;
+    if (pread(fd, &meta[0], meta.size(), entry.offset + sizeof(header)) != ssize_t(meta.size()) ||
+        !deserializeMeta(meta, cached) || cached.key != key) {
+        hit.pin.unlock();
+        return false;
+    }
+
+    bool matches = true;
+    for (const auto& [name, value] : cached.varyHeaders) {
+        matches = matches && findHeader(request.headers, name) == value;
+    }
+    if (!matches) {
+        hit.pin.unlock();
+        return false;
+    }
+
+    hit.slab = entry.slab;
+    hit.bodyOffset = entry.offset + sizeof(header) + header.metaLength;
+    hit.bodyLength = header.bodyLength;
+    return true;
+}
+
+bool DiskCache::store(const CachedResponse& entry) {
+    std::string meta = serializeMeta(entry);
+    RecordHeader header = {RECORD_MAGIC, uint32_t(meta.size()), entry.body.size(), keyHashOf(entry.key)};
+    uint64_t recordLength = sizeof(header) + meta.size() + entry.body.size();
+    if (entry.body.size() > DISK_CACHE_MAX_OBJECT_BYTES || recordLength > DISK_CACHE_SLAB_BYTES) return false;
+
+    uint32_t slab, generation;
+    uint64_t offset;
+    std::shared_lock<std::shared_mutex> pin;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!index || !reserve(recordLength, slab, offset)) return false;
+        generation = index->generations[slab];
+        pin = std::shared_lock<std::shared_mutex>(slabLocks[slab]);
+    }
+
+    // The region is ours alone, so the record is written without holding the index lock.
+    std::string record(reinterpret_cast<const char*>(&header), sizeof(header));
+    record += meta;
+    record += entry.body;
+    size_t written = 0;
+    while (written < record.size()) {
+        ssize_t n = pwrite(slabFds[slab], record.data() + written, record.size() - written, offset + written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            LOG_ERROR("(DiskCache::store) Write to slab %u failed: %s", slab, strerror(errno));
+            return false;
+        }
+        written += n;
+    }
+
+    // The pin goes before the index lock: close() takes them the other way round. Should the slab be
+    // recycled in between, its generation no longer matches and the record is simply not published.
+    pin.unlock();
+
+    // Publish: replace the same key, else an unused way, else the oldest record of the set.
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!index || index->generations[slab] != generation) return false;
+    IndexEntry* set = &index->entries[(header.keyHash % DISK_CACHE_INDEX_SETS) * DISK_CACHE_INDEX_WAYS];
+    IndexEntry* target = findEntry(header.keyHash);
+    for (int way = 0; !target && way < DISK_CACHE_INDEX_WAYS; way++) {
+        if (!validEntry(set[way])) target = &set[way];
+    }
+    if (!target) {
+        target = std::min_element(set, set + DISK_CACHE_INDEX_WAYS, [](const IndexEntry& a, const IndexEntry& b) {
+            return a.storedAt < b.storedAt;
+        });
+    }
+    *target = {header.keyHash, offset, recordLength, entry.storedAt, slab, generation};
+    return true;
+}
+
+bool DiskCache::sendBody(socket_t client_fd, const DiskCacheHit& hit) {
+    int fd = slabFds[hit.slab];
+    uint64_t sent = 0;
+    while (sent < hit.bodyLength) {
+#if defined(__linux__)
+        off_t offset = hit.bodyOffset + sent;
+        ssize_t n = sendfile(client_fd, fd, &offset, hit.bodyLength - sent);
+#elif defined(__APPLE__)
+        off_t length = hit.bodyLength - sent;
+        // Interrupted calls still report the bytes they sent through `length`.
+        ssize_t n = (sendfile(fd, client_fd, hit.bodyOffset + sent, &length, nullptr, 0) < 0 && length == 0) ? -1 : length;
+#else
+        char buffer[BUFFER_SIZE];
+        ssize_t n = pread(fd, buffer, std::min<uint64_t>(sizeof(buffer), hit.bodyLength - sent), hit.bodyOffset + sent);
+        if (n > 0) n = send(client_fd, buffer, n, 0);
+#endif
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool DiskCache::readBody(const DiskCacheHit& hit, std::string& body) {
+    body.resize(hit.bodyLength);
+    uint64_t done = 0;
+    while (done < hit.bodyLength) {
+        ssize_t n = pread(slabFds[hit.slab], &body[done], hit.bodyLength - done, hit.bodyOffset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+void DiskCache::remove(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!index) return;
+    IndexEntry* entry = findEntry(keyHashOf(key));
+    if (entry) entry->keyHash = 0;
+}
+
+#endif
@@ -1,6 +1,15 @@
 #include "../include/domain_process.h"
+#include "../include/work_pool.h"
  
 //------------------------ FilterList ------------------------
+FilterList::FilterList() : slot(std::make_shared<Slot>()) {
+    slot->index = std::make_shared<const Index>();
+}
+
+FilterList::FilterList(const FilterList& other) : domains(other.domains), ips(other.ips), slot(std::make_shared<Slot>()) {
+    slot->index = other.current();
+}
+
 void FilterList::addDomain(const std::string& domain) {
     domains.insert(domain);
 }
@@ -9,30 +18,63 @@ void FilterList::addIP(const std::string& ip) {
     ips.insert(ip);
 }
 
+std::shared_ptr<const FilterList::Index> FilterList::current() const {
+    std::lock_guard<std::mutex> lock(slot->mutex);
+    return slot->index;
+}
+
+void FilterList::install(Slot& slot, uint64_t generation, std::shared_ptr<const Index> index) {
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    if (generation < slot.generation) return;
+    slot.generation = generation;
+    slot.index = std::move(index);
+}
+
+// Same matches as a scan over every entry: the domain itself or any parent domain of it, and an
+// IP with trailing line breaks ignored; but one hash lookup per label instead.
 bool FilterList::isBlocked(const std::string& entry) const {
-    // Kiểm tra domain
-    for (const auto& domain : domains) {
-        if (entry == domain || 
-            (entry.size() > domain.size() && 
-             entry.compare(entry.size() - domain.size(), domain.size(), domain) == 0 &&
-             entry[entry.size() - domain.size() - 1] == '.')) {
+    std::shared_ptr<const Index> index = current();
+
+    for (size_t start = 0; start != std::string::npos; ) {
+        if (index->domains.count(entry.substr(start))) {
             return true;
         }
+        size_t dot = entry.find('.', start);
+        start = dot == std::string::npos ? dot : dot + 1;
     }
-    for (const auto& ip : ips) {
-        std::string res;
-        size_t end = entry.find_last_not_of("\r\n"); 
-        if (end != std::string::npos) {
-            res = entry.substr(0, end + 1);
-        } else {
-            res.clear();
-        }
-        if (res == ip) {
-            return true;
-        }
+
+    size_t end = entry.find_last_not_of("\r\n");
+    std::string ip = end != std::string::npos ? entry.substr(0, end + 1) : std::string();
+    return index->ips.count(ip) > 0;
+}
+
+void FilterList::rebuild() {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        generation = ++slot->generation;
     }
+    // The sets are copied here, on the thread that edits them; hashing them again happens on the pool.
+    std::shared_ptr<Slot> target = slot;
+    WorkStealingPool::instance().submit([target, generation, domains = std::vector<std::string>(domains.begin(), domains.end()),
+                                         ips = std::vector<std::string>(ips.begin(), ips.end())]() {
+        std::shared_ptr<Index> index = std::make_shared<Index>();
+        index->domains.insert(domains.begin(), domains.end());
+        index->ips.insert(ips.begin(), ips.end());
+        install(*target, generation, std::move(index));
+    });
+}
 
-    return false;
+void FilterList::reindex() {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        generation = ++slot->generation;
+    }
+    std::shared_ptr<Index> index = std::make_shared<Index>();
+    index->domains = domains;
+    index->ips = ips;
+    install(*slot, generation, std::move(index));
 }
 
 // ------------------------ Utils ------------------------
@@ -71,5 +113,6 @@ FilterList initFilterList(const char* domainFile, const char* ipFile) {
         std::cerr << "Cannot open IP file.\n";
     }
 
+    filterList.reindex();
     return filterList;
 }
@@ -0,0 +1,929 @@
+#include "../include/event_loop.h"
+#include "../include/logger.h"
+#include "../include/pool.h"
+#include "../include/work_pool.h"
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+const char* ioBackendName(IoBackend backend) {
+    switch (backend) {
+        case IO_BACKEND_EPOLL: return "epoll";
+        case IO_BACKEND_URING: return "io_uring";
+        default:               return "threads";
+    }
+}
+
+// ----------------- EventLoop -----------------
+bool EventLoop::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        if (finished) return false;
+        posted.push_back(std::move(task));
+    }
+    wake();
+    return true;
+}
+
+std::function<void()> EventLoop::handBack(std::function<void()> work, std::function<void()> then) {
+    offloaded++;
+    std::shared_ptr<EventLoop> self = shared_from_this();
+    return [self, work, then]() {
+        try {
+            work();
+        } catch (const std::exception& e) {
+            LOG_ERROR("(EventLoop) Offloaded work failed: %s", e.what());
+        }
+        // Cannot be dropped: run() does not return while anything is offloaded.
+        self->post([self, then]() {
+            self->offloaded--;
+            then();
+        });
+    };
+}
+
+void EventLoop::offload(std::function<void()> work, std::function<void()> then) {
+    std::thread(handBack(std::move(work), std::move(then))).detach();
+}
+
+void EventLoop::compute(std::function<void()> work, std::function<void()> then) {
+    WorkStealingPool::instance().submit(handBack(std::move(work), std::move(then)));
+}
+
+bool EventLoop::runPosted() {
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        tasks.swap(posted);
+    }
+    for (auto& task : tasks) task();
+    return !tasks.empty();
+}
+
+void EventLoop::run() {
+    while (!stopping) {
+        wait();
+        runPosted();
+    }
+
+    // Fail everything still pending so each handler, and each coroutine waiting on one, gets to
+    // clean up; offloaded work is waited for the same way.
+    while (true) {
+        bool outstanding = drain();
+        bool ran = runPosted();
+        if (outstanding || ran) continue;
+        if (offloaded == 0) break;
+        wait();
+    }
+
+    std::lock_guard<std::mutex> lock(posted_mutex);
+    finished = true;
+    posted.clear();
+}
+
+void EventLoop::stop() {
+    stopping = true;
+    wake();
+}
+
+void EventLoop::dispatch(Operation* op, int result) {
+    try {
+        switch (op->kind) {
+            case Operation::ACCEPT:  if (result >= 0) op->onAccept(result); break;
+            case Operation::RECV:    op->onRecv(result, op->buffer); break;
+            case Operation::SEND:
+            case Operation::CONNECT:
+            case Operation::TIMEOUT: op->onComplete(result); break;
+            case Operation::WAKE:    break;
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("(EventLoop::dispatch) Handler threw: %s", e.what());
+    }
+}
+
+#if defined(__linux__)
+
+// ----------------- EpollLoop -----------------
+// Completions emulated on readiness: sockets are registered edge-triggered once, and every
+// operation is attempted as soon as it is queued and again on each edge until it stops blocking.
+class EpollLoop : public EventLoop {
+private:
+    struct Watch {
+        Operation* reader = nullptr;    // accept or recv
+        Operation* writer = nullptr;    // send or connect
+    };
+
+    int epoll_fd;
+    int wake_fd;
+    std::unordered_map<socket_t, Watch> watches;
+    std::vector<socket_t> ready;            // sockets with freshly queued operations
+    std::vector<Operation*> cancelled;
+    std::multimap<std::chrono::steady_clock::time_point, Operation*> timers;
+
+    void watch(Operation* op) {
+        if (stopping) {
+            cancelled.push_back(op);
+            return;
+        }
+        auto it = watches.find(op->fd);
+        if (it == watches.end()) {
+            set_socket_blocking(op->fd, false);
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.fd = op->fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, op->fd, &event);
+            it = watches.emplace(op->fd, Watch()).first;
+        }
+        bool writes = op->kind == Operation::SEND || op->kind == Operation::CONNECT;
+        (writes ? it->second.writer : it->second.reader) = op;
+        ready.push_back(op->fd);
+    }
+
+    void forget(socket_t fd, bool failPending) {
+        auto it = watches.find(fd);
+        if (it == watches.end()) return;
+        for (Operation* op : {it->second.reader, it->second.writer}) {
+            if (!op) continue;
+            if (failPending) {
+                cancelled.push_back(op);
+            } else {
+                delete op;
+            }
+        }
+        watches.erase(it);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void retryAccept(socket_t listen_fd) {
+        timeout(EVENT_LOOP_ACCEPT_RETRY_MS, [this, listen_fd](int result) {
+            if (result < 0) return;
+            auto it = watches.find(listen_fd);
+            if (it != watches.end() && it->second.reader && it->second.reader->kind == Operation::ACCEPT) {
+                ready.push_back(listen_fd);
+            }
+        });
+    }
+
+    // Returns false while the operation would block.
+    bool perform(Operation* op, uint32_t events, int& result) {
+        switch (op->kind) {
+            case Operation::ACCEPT:
+                while (true) {
+                    // Also checked after each handler, which may be what paused it.
+                    if (op->cancelling) {
+                        result = -ECANCELED;
+                        return true;
+                    }
+                    socket_t client_fd = accept4(op->fd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (client_fd < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return false;
+                        if (errno == EBADF || errno == EINVAL) {
+                            result = -errno;
+                            return true;
+                        }
+                        // The backlog is still there but, edge-triggered, the listener will not report it
+                        // again; try once more when descriptors may have been freed.
+                        LOG_ERROR("(EpollLoop) Accept failed: %s", strerror(errno));
+                        retryAccept(op->fd);
+                        return false;
+                    }
+                    dispatch(op, client_fd);
+                }
+
+            case Operation::RECV: {
+                if (!op->buffer.data) op->buffer.data = BufferPool::acquire(BufferPool::classFor(EVENT_LOOP_BUFFER_SIZE));
+                ssize_t received = ::recv(op->fd, op->buffer.data, EVENT_LOOP_BUFFER_SIZE, 0);
+                if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+                result = received < 0 ? -errno : int(received);
+                if (result <= 0) releaseBuffer(op->buffer);
+                return true;
+            }
+
+            case Operation::SEND:
+                while (op->done < op->length) {
+                    ssize_t sent = ::send(op->fd, op->data + op->done, op->length - op->done, MSG_NOSIGNAL);
+                    if (sent < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+                        result = -errno;
+                        return true;
+                    }
+                    op->done += sent;
+                }
+                result = int(op->done);
+                return true;
+
+            case Operation::CONNECT:
+                if (!op->started) {
+                    op->started = true;
+                    if (::connect(op->fd, (sockaddr*)&op->address, sizeof(op->address)) == 0) {
+                        result = 0;
+                        return true;
+                    }
+                    if (errno == EINPROGRESS) return false;
+                    result = -errno;
+                    return true;
+                } else {
+                    if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return false;
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    getsockopt(op->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                    result = -error;
+                    return true;
+                }
+
+            default:
+                return false;
+        }
+    }
+
+    // A failed operation reports before its linked one, which is what resumes a waiting coroutine.
+    void finish(Operation* op, int result) {
+        std::unique_ptr<Operation> owned(op);
+        Operation* linked = op->linked;
+        if (linked && result >= 0 && size_t(result) == op->length) {
+            watch(linked);
+            linked = nullptr;
+        }
+        dispatch(op, result);
+        if (linked) {
+            std::unique_ptr<Operation> skipped(linked);
+            dispatch(linked, -ECANCELED);
+        }
+    }
+
+    // Handlers may queue, cancel or release operations on any socket, so the watch is looked up again
+    // after each of them runs.
+    void attempt(socket_t fd, uint32_t events) {
+        for (int side = 0; side < 2; side++) {
+            auto it = watches.find(fd);
+            if (it == watches.end()) return;
+            Operation* op = side == 0 ? it->second.reader : it->second.writer;
+            int result;
+            if (!op || !perform(op, events, result)) continue;
+
+            it = watches.find(fd);
+            if (it != watches.end()) (side == 0 ? it->second.reader : it->second.writer) = nullptr;
+            finish(op, result);
+        }
+    }
+
+    void failCancelled() {
+        std::vector<Operation*> failed;
+        failed.swap(cancelled);
+        for (Operation* op : failed) finish(op, -ECANCELED);
+    }
+
+    void fireTimers() {
+        auto now = std::chrono::steady_clock::now();
+        while (!timers.empty() && timers.begin()->first <= now) {
+            Operation* op = timers.begin()->second;
+            timers.erase(timers.begin());
+            finish(op, 0);
+        }
+    }
+
+    int waitTimeoutMs() const {
+        if (!ready.empty() || !cancelled.empty()) return 0;
+        if (timers.empty()) return -1;
+        auto remaining = timers.begin()->first - std::chrono::steady_clock::now();
+        // Rounded up so a timer is never polled for just before it is due.
+        return int(std::max<int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(remaining).count()));
+    }
+
+    void discard() {
+        for (auto& entry : watches) {
+            delete entry.second.reader;
+            delete entry.second.writer;
+        }
+        watches.clear();
+        for (Operation* op : cancelled) delete op;
+        cancelled.clear();
+        for (auto& entry : timers) delete entry.second;
+        timers.clear();
+    }
+
+protected:
+    void wait() override {
+        std::vector<socket_t> retry;
+        retry.swap(ready);
+        for (socket_t fd : retry) attempt(fd, 0);
+        failCancelled();
+
+        epoll_event events[256];
+        int count = epoll_wait(epoll_fd, events, 256, waitTimeoutMs());
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == wake_fd) {
+                uint64_t value;
+                ssize_t drained = read(wake_fd, &value, sizeof(value));
+                (void)drained;
+                continue;
+            }
+            attempt(events[i].data.fd, events[i].events);
+        }
+        fireTimers();
+    }
+
+    void wake() override {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    bool drain() override {
+        std::vector<socket_t> fds;
+        for (auto& entry : watches) fds.push_back(entry.first);
+        for (socket_t fd : fds) forget(fd, true);
+        for (auto& entry : timers) cancelled.push_back(entry.second);
+        timers.clear();
+        ready.clear();
+        failCancelled();
+        return !watches.empty() || !cancelled.empty() || !timers.empty();
+    }
+
+public:
+    EpollLoop() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = wake_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+    }
+
+    ~EpollLoop() override {
+        discard();
+        close(wake_fd);
+        close(epoll_fd);
+    }
+
+    bool isReady() const {
+        return epoll_fd >= 0 && wake_fd >= 0;
+    }
+
+    IoBackend backend() const override {
+        return IO_BACKEND_EPOLL;
+    }
+
+    void accept(socket_t listen_fd, AcceptHandler handler) override {
+        Operation* op = new Operation{Operation::ACCEPT, listen_fd};
+        op->onAccept = std::move(handler);
+        watch(op);
+    }
+
+    void pauseAccept(socket_t listen_fd) override {
+        auto it = watches.find(listen_fd);
+        if (it == watches.end() || !it->second.reader) return;
+        it->second.reader->cancelling = true;
+        ready.push_back(listen_fd);
+    }
+
+    void recv(socket_t fd, RecvHandler handler) override {
+        Operation* op = new Operation{Operation::RECV, fd};
+        op->onRecv = std::move(handler);
+        watch(op);
+    }
+
+    void send(socket_t fd, const char* data, size_t length, CompletionHandler onSent) override {
+        Operation* op = new Operation{Operation::SEND, fd};
+        op->data = data;
+        op->length = length;
+        op->onComplete = std::move(onSent);
+        watch(op);
+    }
+
+    void sendThenRecv(socket_t fd, const char* data, size_t length, CompletionHandler onSent,
+                      socket_t recv_fd, RecvHandler onRecv) override {
+        Operation* op = new Operation{Operation::SEND, fd};
+        op->data = data;
+        op->length = length;
+        op->onComplete = std::move(onSent);
+        op->linked = new Operation{Operation::RECV, recv_fd};
+        op->linked->onRecv = std::move(onRecv);
+        watch(op);
+    }
+
+    void connect(socket_t fd, const sockaddr_in& address, CompletionHandler onConnected) override {
+        Operation* op = new Operation{Operation::CONNECT, fd};
+        op->address = address;
+        op->onComplete = std::move(onConnected);
+        watch(op);
+    }
+
+    void timeout(uint64_t ms, CompletionHandler onExpired) override {
+        Operation* op = new Operation{Operation::TIMEOUT, -1};
+        op->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        op->onComplete = std::move(onExpired);
+        if (stopping) {
+            cancelled.push_back(op);
+        } else {
+            timers.emplace(op->deadline, op);
+        }
+    }
+
+    void cancel(socket_t fd) override {
+        shutdown(fd, SHUT_RDWR);
+        forget(fd, true);
+    }
+
+    void release(socket_t fd) override {
+        forget(fd, false);
+        set_socket_blocking(fd, true);
+    }
+
+    void releaseBuffer(IoBuffer buffer) override {
+        if (buffer.data) BufferPool::release(buffer.data, BufferPool::classFor(EVENT_LOOP_BUFFER_SIZE));
+    }
+};
+
+// ----------------- UringLoop -----------------
+// io_uring through raw syscalls: one multishot accept, receives that pick their buffer from a
+// registered buffer ring, sends linked to the next receive, and every submission of an iteration
+// handed to the kernel in the same io_uring_enter call that waits for completions.
+class UringLoop : public EventLoop {
+private:
+    int ring_fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned local_tail = 0;
+    unsigned submitted_tail = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    io_uring_buf_ring* buf_ring = (io_uring_buf_ring*)MAP_FAILED;
+    size_t buf_ring_size = 0;
+    char* buffers = nullptr;
+    uint16_t buf_tail = 0;
+
+    int wake_fd = -1;
+    uint64_t wake_value = 0;
+    Operation wake_op{Operation::WAKE, -1};
+    bool wake_armed = false;
+    std::unordered_set<Operation*> inflight;
+    std::vector<Operation*> starved;        // receives that found no free buffer
+    std::vector<Operation*> backedOff;      // accepts waiting out a shortage of descriptors
+    std::vector<Operation*> cancelled;
+
+    static int enter(int fd, unsigned submit, unsigned waitFor, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, submit, waitFor, flags, nullptr, 0);
+    }
+
+    void flush(bool waitForOne) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        unsigned pending = local_tail - submitted_tail;
+        if (pending == 0 && !waitForOne) return;
+        int result;
+        do {
+            result = enter(ring_fd, pending, waitForOne ? 1 : 0, waitForOne ? IORING_ENTER_GETEVENTS : 0);
+        } while (result < 0 && errno == EINTR);
+        if (result < 0) {
+            LOG_ERROR("(UringLoop) io_uring_enter failed: %s", strerror(errno));
+        } else {
+            submitted_tail += result;
+        }
+    }
+
+    // Reserves `count` consecutive entries so a linked pair never straddles two submissions.
+    void reserve(unsigned count) {
+        while (local_tail + count - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) > sq_entries) flush(false);
+    }
+
+    io_uring_sqe* nextSqe() {
+        reserve(1);
+        unsigned index = local_tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        local_tail++;
+        return sqe;
+    }
+
+    void prepare(io_uring_sqe* sqe, Operation* op) {
+        sqe->fd = op->fd;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        switch (op->kind) {
+            case Operation::ACCEPT:
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+                sqe->accept_flags = SOCK_CLOEXEC;
+                break;
+            case Operation::RECV:
+                sqe->opcode = IORING_OP_RECV;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = 0;
+                sqe->len = EVENT_LOOP_BUFFER_SIZE;
+                break;
+            case Operation::SEND:
+                sqe->opcode = IORING_OP_SEND;
+                sqe->addr = (uint64_t)(uintptr_t)op->data;
+                sqe->len = op->length;
+                // MSG_WAITALL makes the kernel retry until everything is sent, so a short send is a failure.
+                sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+                break;
+            case Operation::CONNECT:
+                sqe->opcode = IORING_OP_CONNECT;
+                sqe->addr = (uint64_t)(uintptr_t)&op->address;
+                sqe->off = sizeof(op->address);
+                break;
+            case Operation::TIMEOUT:
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->addr = (uint64_t)(uintptr_t)op->interval;
+                sqe->len = 1;
+                break;
+            case Operation::WAKE:
+                sqe->opcode = IORING_OP_READ;
+                sqe->addr = (uint64_t)(uintptr_t)&wake_value;
+                sqe->len = sizeof(wake_value);
+                break;
+        }
+    }
+
+    void submit(Operation* op) {
+        if (op == &wake_op) {
+            wake_armed = true;
+        } else if (stopping) {
+            cancelled.push_back(op);
+            return;
+        } else {
+            inflight.insert(op);
+        }
+        prepare(nextSqe(), op);
+    }
+
+    void submitLinked(Operation* first, Operation* second) {
+        if (stopping) {
+            cancelled.push_back(first);
+            cancelled.push_back(second);
+            return;
+        }
+        reserve(2);
+        submit(first);
+        sqes[(local_tail - 1) & sq_mask].flags |= IOSQE_IO_LINK;
+        submit(second);
+    }
+
+    void retryAccept(Operation* op) {
+        backedOff.push_back(op);
+        timeout(EVENT_LOOP_ACCEPT_RETRY_MS, [this, op](int) {
+            // Gone already when the accept was paused or the loop drained in the meantime.
+            auto it = std::find(backedOff.begin(), backedOff.end(), op);
+            if (it == backedOff.end()) return;
+            backedOff.erase(it);
+            submit(op);
+        });
+    }
+
+    void complete(Operation* op, int result, uint32_t flags) {
+        if (op == &wake_op) {
+            wake_armed = false;
+            submit(&wake_op);       // re-armed while stopping too, since draining still waits on it
+            return;
+        }
+
+        if (op->kind == Operation::ACCEPT) {
+            if (result >= 0) dispatch(op, result);
+            if (flags & IORING_CQE_F_MORE) return;
+            // Multishot accept ends on errors such as EMFILE and when cancelled; restart unless cancelled.
+            // Out of descriptors, it would only fail again at once, so it waits before restarting.
+            if (!op->cancelling && (result == -EMFILE || result == -ENFILE || result == -ENOBUFS || result == -ENOMEM)) {
+                LOG_ERROR("(UringLoop) Accept failed: %s", strerror(-result));
+                inflight.erase(op);
+                retryAccept(op);
+                return;
+            }
+            if (!op->cancelling && result != -ECANCELED && result != -EBADF && result != -EINVAL) {
+                submit(op);
+                return;
+            }
+            inflight.erase(op);
+            delete op;
+            return;
+        }
+
+        if (op->kind == Operation::RECV) {
+            if (flags & IORING_CQE_F_BUFFER) {
+                op->buffer.id = flags >> IORING_CQE_BUFFER_SHIFT;
+                op->buffer.data = buffers + size_t(op->buffer.id) * EVENT_LOOP_BUFFER_SIZE;
+                if (result <= 0) {
+                    releaseBuffer(op->buffer);
+                    op->buffer = IoBuffer();
+                }
+            }
+            if (result == -ENOBUFS) {
+                starved.push_back(op);      // retried as soon as a buffer comes back
+                return;
+            }
+        }
+        if (op->kind == Operation::TIMEOUT && result == -ETIME) result = 0;
+
+        inflight.erase(op);
+        std::unique_ptr<Operation> owned(op);
+        dispatch(op, result);
+    }
+
+    void reap() {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) return;
+
+        std::vector<io_uring_cqe> batch;
+        batch.reserve(tail - head);
+        for (; head != tail; head++) batch.push_back(cqes[head & cq_mask]);
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        for (const io_uring_cqe& cqe : batch) {
+            if (cqe.user_data == 0) continue;       // cancel requests
+            complete((Operation*)(uintptr_t)cqe.user_data, cqe.res, cqe.flags);
+        }
+    }
+
+    bool hasCompletions() const {
+        return *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    void failCancelled() {
+        std::vector<Operation*> failed;
+        failed.swap(cancelled);
+        for (Operation* op : failed) {
+            inflight.erase(op);
+            std::unique_ptr<Operation> owned(op);
+            dispatch(op, -ECANCELED);
+        }
+    }
+
+protected:
+    void wait() override {
+        failCancelled();
+        flush(!hasCompletions() && cancelled.empty());
+        reap();
+    }
+
+    void wake() override {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    bool drain() override {
+        cancelled.insert(cancelled.end(), starved.begin(), starved.end());
+        starved.clear();
+        cancelled.insert(cancelled.end(), backedOff.begin(), backedOff.end());
+        backedOff.clear();
+        failCancelled();
+        for (Operation* op : inflight) {
+            if (op->cancelling) continue;
+            op->cancelling = true;
+            // A send the kernel already started ignores the cancel until the socket shuts down.
+            if (op->kind != Operation::ACCEPT && op->fd >= 0) shutdown(op->fd, SHUT_RDWR);
+            io_uring_sqe* sqe = nextSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t)(uintptr_t)op;
+        }
+        flush(!inflight.empty() && !hasCompletions());
+        reap();
+        return !inflight.empty() || !cancelled.empty();
+    }
+
+    // Before the rings go away: cancels whatever the kernel still holds, the wake read at least,
+    // and waits for it to let go of the buffers and addresses in use.
+    void discard() {
+        if (ring_fd < 0 || sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) return;
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+        sqe->fd = -1;
+        flush(false);
+        for (int attempts = 0; attempts < 100 && (wake_armed || !inflight.empty()); attempts++) {
+            if (!hasCompletions()) flush(true);
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                const io_uring_cqe& cqe = cqes[head & cq_mask];
+                Operation* op = (Operation*)(uintptr_t)cqe.user_data;
+                if (op == &wake_op) {
+                    wake_armed = false;
+                } else if (op && !(cqe.flags & IORING_CQE_F_MORE) && inflight.erase(op)) {
+                    delete op;
+                }
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+        for (Operation* op : cancelled) inflight.insert(op);
+        for (Operation* op : backedOff) inflight.insert(op);
+        for (Operation* op : inflight) delete op;
+        inflight.clear();
+        starved.clear();
+        backedOff.clear();
+        cancelled.clear();
+    }
+
+public:
+    UringLoop() {
+        io_uring_params params = {};
+        ring_fd = (int)syscall(__NR_io_uring_setup, EVENT_LOOP_QUEUE_DEPTH, &params);
+        if (ring_fd < 0) return;
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring
+                : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) return;
+
+        char* sq = (char*)sq_ring;
+        sq_head = (unsigned*)(sq + params.sq_off.head);
+        sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        sq_entries = *(unsigned*)(sq + params.sq_off.ring_entries);
+        sq_array = (unsigned*)(sq + params.sq_off.array);
+        local_tail = submitted_tail = *sq_tail;
+        char* cq = (char*)cq_ring;
+        cq_head = (unsigned*)(cq + params.cq_off.head);
+        cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // Provided buffer ring: the kernel picks a free buffer only once data has arrived, so idle
+        // sockets hold no memory.
+        buf_ring_size = EVENT_LOOP_BUFFER_COUNT * sizeof(io_uring_buf);
+        buf_ring = (io_uring_buf_ring*)mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_ring == MAP_FAILED) return;
+        io_uring_buf_reg registration = {};
+        registration.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+        registration.ring_entries = EVENT_LOOP_BUFFER_COUNT;
+        registration.bgid = 0;
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+            munmap(buf_ring, buf_ring_size);
+            buf_ring = (io_uring_buf_ring*)MAP_FAILED;
+            return;
+        }
+        buffers = new char[size_t(EVENT_LOOP_BUFFER_COUNT) * EVENT_LOOP_BUFFER_SIZE];
+        for (int id = 0; id < EVENT_LOOP_BUFFER_COUNT; id++) {
+            IoBuffer buffer;
+            buffer.id = id;
+            buffer.data = buffers + size_t(id) * EVENT_LOOP_BUFFER_SIZE;
+            releaseBuffer(buffer);
+        }
+
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+        wake_op.fd = wake_fd;
+        if (wake_fd >= 0) submit(&wake_op);
+    }
+
+    ~UringLoop() override {
+        discard();
+        if (ring_fd >= 0) close(ring_fd);
+        if (buf_ring != MAP_FAILED) munmap(buf_ring, buf_ring_size);
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (wake_fd >= 0) close(wake_fd);
+        delete[] buffers;
+    }
+
+    bool isReady() const {
+        return ring_fd >= 0 && buffers && wake_fd >= 0;
+    }
+
+    IoBackend backend() const override {
+        return IO_BACKEND_URING;
+    }
+
+    void accept(socket_t listen_fd, AcceptHandler handler) override {
+        Operation* op = new Operation{Operation::ACCEPT, listen_fd};
+        op->onAccept = std::move(handler);
+        submit(op);
+    }
+
+    void pauseAccept(socket_t listen_fd) override {
+        for (auto it = backedOff.begin(); it != backedOff.end();) {
+            if ((*it)->fd == listen_fd) {
+                delete *it;
+                it = backedOff.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (Operation* op : inflight) {
+            if (op->kind != Operation::ACCEPT || op->fd != listen_fd || op->cancelling) continue;
+            op->cancelling = true;
+            io_uring_sqe* sqe = nextSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t)(uintptr_t)op;
+        }
+    }
+
+    void recv(socket_t fd, RecvHandler handler) override {
+        Operation* op = new Operation{Operation::RECV, fd};
+        op->onRecv = std::move(handler);
+        submit(op);
+    }
+
+    void send(socket_t fd, const char* data, size_t length, CompletionHandler onSent) override {
+        Operation* op = new Operation{Operation::SEND, fd};
+        op->data = data;
+        op->length = length;
+        op->onComplete = std::move(onSent);
+        submit(op);
+    }
+
+    void sendThenRecv(socket_t fd, const char* data, size_t length, CompletionHandler onSent,
+                      socket_t recv_fd, RecvHandler onRecv) override {
+        Operation* op = new Operation{Operation::SEND, fd};
+        op->data = data;
+        op->length = length;
+        op->onComplete = std::move(onSent);
+        Operation* next = new Operation{Operation::RECV, recv_fd};
+        next->onRecv = std::move(onRecv);
+        submitLinked(op, next);
+    }
+
+    void connect(socket_t fd, const sockaddr_in& address, CompletionHandler onConnected) override {
+        Operation* op = new Operation{Operation::CONNECT, fd};
+        op->address = address;
+        op->onComplete = std::move(onConnected);
+        submit(op);
+    }
+
+    void timeout(uint64_t ms, CompletionHandler onExpired) override {
+        Operation* op = new Operation{Operation::TIMEOUT, -1};
+        op->interval[0] = int64_t(ms / 1000);
+        op->interval[1] = int64_t(ms % 1000) * 1000000;
+        op->onComplete = std::move(onExpired);
+        submit(op);
+    }
+
+    void cancel(socket_t fd) override {
+        shutdown(fd, SHUT_RDWR);
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+
+        for (auto it = starved.begin(); it != starved.end();) {
+            if ((*it)->fd == fd) {
+                cancelled.push_back(*it);
+                it = starved.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void release(socket_t fd) override {
+        (void)fd;       // nothing is registered per socket
+    }
+
+    void releaseBuffer(IoBuffer buffer) override {
+        if (!buffer.data) return;
+        // Indexed by hand: compiled as C++, the header's flexible `bufs` array lands 8 bytes too far.
+        io_uring_buf* slot = reinterpret_cast<io_uring_buf*>(buf_ring) + (buf_tail & (EVENT_LOOP_BUFFER_COUNT - 1));
+        slot->addr = (uint64_t)(uintptr_t)buffer.data;
+        slot->len = EVENT_LOOP_BUFFER_SIZE;
+        slot->bid = buffer.id;
+        buf_tail++;
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+
+        if (!starved.empty()) {
+            Operation* op = starved.back();
+            starved.pop_back();
+            submit(op);
+        }
+    }
+};
+
+std::shared_ptr<EventLoop> EventLoop::create(IoBackend backend) {
+    if (backend == IO_BACKEND_EPOLL) {
+        auto loop = std::make_shared<EpollLoop>();
+        if (loop->isReady()) return loop;
+    } else if (backend == IO_BACKEND_URING) {
+        auto loop = std::make_shared<UringLoop>();
+        if (loop->isReady()) return loop;
+    }
+    return nullptr;
+}
+
+#else
+
+std::shared_ptr<EventLoop> EventLoop::create(IoBackend backend) {
+    (void)backend;
+    return nullptr;
+}
+
+#endif
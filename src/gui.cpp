@@ -408,6 +408,131 @@ void Table::Draw() {
 }
 
 
+// --------------------------- ConnectionMonitor Class ---------------------------
+static std::string FormatRate(double bytesPerSecond) {
+    char text[16];
+    if (bytesPerSecond >= 1024 * 1024) {
+        snprintf(text, sizeof(text), "%.1fM", bytesPerSecond / (1024 * 1024));
+    } else if (bytesPerSecond >= 1024) {
+        snprintf(text, sizeof(text), "%.1fK", bytesPerSecond / 1024);
+    } else {
+        snprintf(text, sizeof(text), "%.0f", bytesPerSecond);
+    }
+    return text;
+}
+
+static std::string FormatAge(std::chrono::steady_clock::duration age) {
+    long long seconds = std::chrono::duration_cast<std::chrono::seconds>(age).count();
+    if (seconds < 60) return std::to_string(seconds) + "s";
+    if (seconds < 3600) return std::to_string(seconds / 60) + "m";
+    return std::to_string(seconds / 3600) + "h";
+}
+
+ConnectionMonitor::ConnectionMonitor(float x, float y, float width, float height,
+                                     std::function<std::vector<ConnectionSnapshot>()> openConnections,
+                                     std::function<void(ConnectionId)> closeConnection, Font customFont, int textSize, float rowSpacing)
+    : bounds{ x, y, width, height }, font(customFont), fontSize(textSize), rowHeight(textSize + rowSpacing), scrollOffset(0),
+      selectedRow(-1), lastRefresh(-MONITOR_REFRESH_SECONDS), source(std::move(openConnections)), onClose(std::move(closeConnection)) {}
+
+void ConnectionMonitor::Refresh() {
+    ConnectionId selected = selectedRow >= 0 && selectedRow < (int)rows.size() ? rows[selectedRow].id : ConnectionId();
+    rows = source();
+    sampler.sample(rows);
+    std::sort(rows.begin(), rows.end(), [](const ConnectionSnapshot& a, const ConnectionSnapshot& b) {
+        return a.rateUp + a.rateDown > b.rateUp + b.rateDown;
+    });
+
+    // The selection follows its connection as the order changes.
+    selectedRow = -1;
+    for (size_t i = 0; i < rows.size() && selected; i++) {
+        if (rows[i].id == selected) selectedRow = i;
+    }
+}
+
+void ConnectionMonitor::Update() {
+    if (GetTime() - lastRefresh >= MONITOR_REFRESH_SECONDS) {
+        lastRefresh = GetTime();
+        Refresh();
+    }
+
+    Vector2 mousePosition = GetMousePosition();
+    if (CheckCollisionPointRec(mousePosition, bounds)) {
+        scrollOffset -= GetMouseWheelMove() * rowHeight;
+    }
+    float maxScroll = std::max(0.0f, (rows.size() + 1) * rowHeight - bounds.height);
+    scrollOffset = Clamp(scrollOffset, 0.0f, maxScroll);
+
+    Rectangle body = { bounds.x, bounds.y + rowHeight, bounds.width, bounds.height - rowHeight };
+    if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+        selectedRow = -1;
+        if (CheckCollisionPointRec(mousePosition, body)) {
+            int clickedRow = (mousePosition.y - body.y + scrollOffset) / rowHeight;
+            if (clickedRow >= 0 && clickedRow < (int)rows.size()) selectedRow = clickedRow;
+        }
+    }
+
+    if (selectedRow >= 0 && IsKeyPressed(KEY_DELETE)) {
+        onClose(rows[selectedRow].id);
+        rows.erase(rows.begin() + selectedRow);
+        selectedRow = -1;
+    }
+}
+
+void ConnectionMonitor::DrawRow(int rowIndex, float y, bool isHovered, bool isSelected) {
+    Color backgroundColor = isSelected ? DARKGRAY : (isHovered ? LIGHTGRAY : FILLED_COLOR);
+    Color textColor = isSelected ? WHITE : BLACK;
+    DrawRectangle(bounds.x, y, bounds.width, rowHeight, backgroundColor);
+
+    const ConnectionSnapshot& connection = rows[rowIndex];
+    std::string client = std::string(connection.clientIp) + ":" + std::to_string(connection.clientPort);
+    std::string target = connection.target.size() > 20 ? connection.target.substr(0, 19) + "~" : connection.target;
+    std::string age = FormatAge(std::chrono::steady_clock::now() - connection.openedAt);
+
+    float columnX[] = { bounds.x + 10, bounds.x + 190, bounds.x + 420, bounds.x + 545, bounds.x + 610, bounds.x + 700 };
+    DrawTextEx(font, client.c_str(), { columnX[0], y + 5 }, fontSize, 1, textColor);
+    DrawTextEx(font, target.c_str(), { columnX[1], y + 5 }, fontSize, 1, textColor);
+    DrawTextEx(font, connectionStateName(connection.state), { columnX[2], y + 5 }, fontSize, 1, textColor);
+    DrawTextEx(font, age.c_str(), { columnX[3], y + 5 }, fontSize, 1, textColor);
+    DrawTextEx(font, FormatRate(connection.rateUp).c_str(), { columnX[4], y + 5 }, fontSize, 1, textColor);
+    DrawTextEx(font, FormatRate(connection.rateDown).c_str(), { columnX[5], y + 5 }, fontSize, 1, textColor);
+}
+
+void ConnectionMonitor::Draw() {
+    DrawRectangleRounded(bounds, 0.01, 10, EMPTY_COLOR);
+    DrawRectangleRoundedLinesEx(bounds, 0.01, 10, 2, DARKGRAY);
+
+    float columnX[] = { bounds.x + 10, bounds.x + 190, bounds.x + 420, bounds.x + 545, bounds.x + 610, bounds.x + 700 };
+    float headerY = bounds.y;
+    std::string client = "Client (" + std::to_string(rows.size()) + ")";
+    DrawRectangle(bounds.x, headerY, bounds.width, rowHeight, DARKGRAY);
+    DrawTextEx(font, client.c_str(), { columnX[0], headerY + 5 }, fontSize, 1, WHITE);
+    DrawTextEx(font, "Target", { columnX[1], headerY + 5 }, fontSize, 1, WHITE);
+    DrawTextEx(font, "State", { columnX[2], headerY + 5 }, fontSize, 1, WHITE);
+    DrawTextEx(font, "Age", { columnX[3], headerY + 5 }, fontSize, 1, WHITE);
+    DrawTextEx(font, "Up/s", { columnX[4], headerY + 5 }, fontSize, 1, WHITE);
+    DrawTextEx(font, "Down/s", { columnX[5], headerY + 5 }, fontSize, 1, WHITE);
+
+    BeginScissorMode(bounds.x, bounds.y + rowHeight, bounds.width, bounds.height - rowHeight);
+
+    float y = bounds.y + rowHeight - scrollOffset;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        bool isHovered = CheckCollisionPointRec(GetMousePosition(), { bounds.x, y, bounds.width, rowHeight });
+        DrawRow(i, y, isHovered, (int)i == selectedRow);
+        y += rowHeight;
+    }
+
+    EndScissorMode();
+
+    float maxScroll = std::max(0.0f, (rows.size() + 1) * rowHeight - bounds.height);
+    if (maxScroll > 0) {
+        float scrollBarHeight = (bounds.height - rowHeight) * (bounds.height - rowHeight) / (rows.size() * rowHeight);
+        float scrollBarY = bounds.y + rowHeight + ((bounds.height - rowHeight - scrollBarHeight) * (scrollOffset / maxScroll));
+        DrawRectangle(bounds.x + bounds.width - 5, bounds.y + rowHeight, 5, bounds.height - rowHeight, DARKGRAY);
+        DrawRectangle(bounds.x + bounds.width - 5, scrollBarY, 5, scrollBarHeight, BLACK);
+    }
+}
+
+
 // --------------------------- InputText Class ---------------------------
 InputText::InputText(float x, float y, float width, float height, int maxLength, 
                      Font customFont, int textSize, Color baseCol)
@@ -540,11 +665,11 @@ void InputFieldWithButton::SetText(const std::string& newText) {
 // --------------------------- NameList Class ---------------------------
 NameList::NameList(std::string filename, float x, float y, float width, float height, 
                    std::unordered_set<std::string>& names, Font customFont, 
-                   const std::string& titleText, int textSize, int rowSpacing)
+                   const std::string& titleText, int textSize, int rowSpacing, std::function<void()> changed)
     : fileName(filename), bounds{x, y, width, height - 50}, nameSet(names), font(customFont),
       inputFieldWithButton(x + 10, y + height - 40, width - 120, 30, "Add", x + width - 100, y + height - 40, 90, 30, customFont, NORMAL_BUTTON_COLOR, SECONDARY_HOVERED_BUTTON_COLOR),
       showContextMenu(false), contextMenuPosition{0, 0}, selectedNameIndex(-1), scrollOffset(0.0f), title(titleText),
-      bounds_d{x, y + rowHeight, width, height - rowHeight - 50}, fontSize(textSize), lineSpacing(rowSpacing) 
+      bounds_d{x, y + rowHeight, width, height - rowHeight - 50}, fontSize(textSize), lineSpacing(rowSpacing), onChange(std::move(changed)) 
     {
         UpdateNameVector();
         visibleRows = bounds.height / (fontSize + lineSpacing);
@@ -575,6 +700,7 @@ void NameList::Update() {
             inputFieldWithButton.clear();
             SaveToFile();
             UpdateNameVector();
+            if (onChange) onChange();
         }
     }
 
@@ -633,6 +759,7 @@ void NameList::HandleContextMenu(Vector2 mousePoint) {
             nameSet.erase(nameVector[selectedNameIndex]);
             SaveToFile();
             UpdateNameVector();
+            if (onChange) onChange();
             showContextMenu = false;
         } else {
             showContextMenu = false;
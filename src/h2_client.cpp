@@ -0,0 +1,786 @@
+#include "../include/h2_client.h"
+#include "../include/logger.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_FRAME_HEADER 9
+#define H2_DEFAULT_WINDOW 65535
+#define H2_DEFAULT_MAX_FRAME 16384          // the largest frame we accept, as we never raise it
+#define H2_MAX_WINDOW 0x7fffffff
+
+// Frame types and flags, RFC 9113 section 6.
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+#define H2_SETTINGS_MAX_HEADER_LIST_SIZE 0x6
+
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_CANCEL 0x8
+#define H2_COMPRESSION_ERROR 0x9
+
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+static int64_t steadyMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void putUint32(std::string& out, uint32_t value) {
+    out += char(value >> 24);
+    out += char(value >> 16);
+    out += char(value >> 8);
+    out += char(value);
+}
+
+static uint32_t getUint32(const char* data) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+}
+
+static std::string frameHeader(size_t length, uint8_t type, uint8_t flags, uint32_t streamId) {
+    std::string header;
+    header += char(length >> 16);
+    header += char(length >> 8);
+    header += char(length);
+    header += char(type);
+    header += char(flags);
+    putUint32(header, streamId & 0x7fffffff);
+    return header;
+}
+
+static bool sendAll(socket_t fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t written = send(fd, data.data() + sent, data.size() - sent, SEND_FLAGS);
+        if (written <= 0) return false;
+        sent += size_t(written);
+    }
+    return true;
+}
+
+// Strips the padding of a PADDED frame; false when it claims more than the frame holds.
+static bool unpad(uint8_t flags, const char*& data, size_t& length) {
+    if (!(flags & H2_FLAG_PADDED)) return true;
+    if (length < 1) return false;
+    size_t padding = (unsigned char)data[0];
+    if (padding >= length) return false;
+    data++;
+    length -= 1 + padding;
+    return true;
+}
+
+static std::string addressText(const sockaddr_in& address) {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+static const char* reasonPhrase(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 103: return "Early Hints";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 500: return "Internal Server Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        default:  return "";
+    }
+}
+
+// ----------------- H2Stream -----------------
+H2Stream::H2Stream(std::shared_ptr<H2Session> session, uint32_t id, int64_t sendWindow)
+    : session(std::move(session)), id(id), readOffset(0), headSent(false), chunked(false), finished(false), failed(false),
+      sendWindow(sendWindow), received(0), credited(0) {}
+
+H2Stream::~H2Stream() {
+    bool open;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        open = !finished && !failed;
+    }
+    if (open) session->cancel(id);
+}
+
+ssize_t H2Stream::read(char* out, size_t capacity, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool ready = changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() {
+        return readOffset < pending.size() || finished || failed;
+    });
+    if (!ready) return -1;
+    if (readOffset == pending.size()) return failed ? -1 : 0;
+
+    size_t length = std::min(capacity, pending.size() - readOffset);
+    memcpy(out, pending.data() + readOffset, length);
+    readOffset += length;
+    if (readOffset == pending.size() || readOffset > pending.size() / 2) {
+        pending.erase(0, readOffset);
+        readOffset = 0;
+    }
+
+    // The window is given back once most of what it let in has been read, so a slow client holds at
+    // most about one window of this response in memory.
+    size_t increment = received - credited;
+    bool credit = !finished && !failed && increment >= H2_STREAM_WINDOW / 2 && pending.size() < H2_STREAM_WINDOW / 2;
+    if (credit) credited = received;
+    lock.unlock();
+    if (credit) session->sendWindowUpdate(id, increment);
+    return ssize_t(length);
+}
+
+// ----------------- H2Session -----------------
+H2Session::H2Session(socket_t fd, const sockaddr_in& address)
+    : fd(fd), address(address), headerStream(0), headerEndStream(false), nextStreamId(1), peerMaxStreams(100),
+      peerMaxFrame(H2_DEFAULT_MAX_FRAME), peerInitialWindow(H2_DEFAULT_WINDOW), sendWindow(H2_DEFAULT_WINDOW),
+      connectionUnacked(0), goingAway(false), closed(false), idleSince(steadyMillis()) {}
+
+// Only once the reader and every stream let go, so the descriptor is never reused under them.
+H2Session::~H2Session() {
+    CLOSE_SOCKET(fd);
+}
+
+std::shared_ptr<H2Session> H2Session::open(const sockaddr_in& address, const SocketProfile& profile) {
+    socket_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) return nullptr;
+    applyUpstreamOptions(fd, profile);
+
+    // Connections outlive any one client, so the connect is bounded here rather than by a client's deadlines.
+    set_socket_blocking(fd, false);
+    bool connected = connect(fd, (const sockaddr*)&address, sizeof(address)) == 0;
+    if (!connected && (socket_would_block() || SOCKET_ERROR_CODE == EINPROGRESS)) {
+        pollfd watched = {};
+        watched.fd = fd;
+        watched.events = POLLOUT;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        connected = POLL_SOCKETS(&watched, 1, H2_CONNECT_TIMEOUT_MS) > 0 &&
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == 0 && error == 0;
+    }
+    if (!connected) {
+        CLOSE_SOCKET(fd);
+        return nullptr;
+    }
+    set_socket_blocking(fd, true);
+
+    std::shared_ptr<H2Session> session = std::make_shared<H2Session>(fd, address);
+    std::string settings;
+    auto setting = [&settings](uint16_t id, uint32_t value) {
+        settings += char(id >> 8);
+        settings += char(id);
+        putUint32(settings, value);
+    };
+    setting(H2_SETTINGS_ENABLE_PUSH, 0);
+    setting(H2_SETTINGS_INITIAL_WINDOW_SIZE, H2_STREAM_WINDOW);
+    setting(H2_SETTINGS_MAX_HEADER_LIST_SIZE, HPACK_MAX_HEADER_LIST);
+    std::string increment;
+    putUint32(increment, H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW);
+    std::string opening = std::string(H2_PREFACE) + frameHeader(settings.size(), H2_SETTINGS, 0, 0) + settings +
+                          frameHeader(increment.size(), H2_WINDOW_UPDATE, 0, 0) + increment;
+    if (!sendAll(fd, opening)) return nullptr;
+
+    std::thread(&H2Session::run, session).detach();
+    return session;
+}
+
+bool H2Session::available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !closed && !goingAway && streams.size() < peerMaxStreams && nextStreamId <= H2_MAX_WINDOW;
+}
+
+bool H2Session::accepting() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !closed && !goingAway;
+}
+
+bool H2Session::idleFor(int64_t ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // After a GOAWAY nothing new will come, so the connection is done once its streams are.
+    return streams.empty() && (goingAway || steadyMillis() - idleSince >= ms);
+}
+
+bool H2Session::sendFrame(uint8_t type, uint8_t flags, uint32_t streamId, const std::string& payload) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    return sendAll(fd, frameHeader(payload.size(), type, flags, streamId) + payload);
+}
+
+void H2Session::sendWindowUpdate(uint32_t streamId, size_t increment) {
+    std::string payload;
+    putUint32(payload, uint32_t(increment));
+    sendFrame(H2_WINDOW_UPDATE, 0, streamId, payload);
+}
+
+std::shared_ptr<H2Stream> H2Session::submit(const std::vector<HeaderField>& headers, const std::string& body, int weight) {
+    std::shared_ptr<H2Stream> stream;
+    {
+        // Stream ids must rise in the order HEADERS go out, and the peer decodes blocks in that order too.
+        std::lock_guard<std::mutex> writeLock(write_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed || goingAway || streams.size() >= peerMaxStreams || nextStreamId > H2_MAX_WINDOW) return nullptr;
+            stream.reset(new H2Stream(shared_from_this(), nextStreamId, peerInitialWindow));
+            streams[stream->id] = stream;
+            nextStreamId += 2;
+        }
+
+        // Depends on nothing, so the weight ranks it against every other stream.
+        std::string block;
+        putUint32(block, 0);
+        block += char(weight - 1);
+        block += encoder.encode(headers);
+
+        std::string frames;
+        size_t offset = 0;
+        do {
+            size_t length = std::min(block.size() - offset, size_t(peerMaxFrame));
+            bool last = offset + length == block.size();
+            uint8_t flags = last ? H2_FLAG_END_HEADERS : 0;
+            if (offset == 0) flags |= H2_FLAG_PRIORITY | (body.empty() ? H2_FLAG_END_STREAM : 0);
+            frames += frameHeader(length, offset == 0 ? H2_HEADERS : H2_CONTINUATION, flags, stream->id);
+            frames.append(block, offset, length);
+            offset += length;
+        } while (offset < block.size());
+        if (!sendAll(fd, frames)) return stream;    // the reader fails it once the connection is found gone
+    }
+
+    size_t offset = 0;
+    while (offset < body.size()) {
+        size_t length;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bool ready = changed.wait_for(lock, std::chrono::milliseconds(H2_SEND_TIMEOUT_MS), [&]() {
+                return closed || !streams.count(stream->id) || (sendWindow > 0 && stream->sendWindow > 0);
+            });
+            if (!ready || closed || !streams.count(stream->id)) break;
+            length = std::min({body.size() - offset, size_t(peerMaxFrame), size_t(sendWindow), size_t(stream->sendWindow)});
+            sendWindow -= length;
+            stream->sendWindow -= length;
+        }
+        bool last = offset + length == body.size();
+        if (!sendFrame(H2_DATA, last ? H2_FLAG_END_STREAM : 0, stream->id, body.substr(offset, length))) break;
+        offset += length;
+    }
+    if (offset < body.size()) {
+        // Without its whole body the request must not reach the origin as if it were complete.
+        endStream(stream->id, true);
+        cancel(stream->id);
+    }
+    return stream;
+}
+
+void H2Session::goAway(uint32_t errorCode) {
+    if (closed.exchange(true)) return;
+    std::string payload;
+    putUint32(payload, 0);          // no pushed streams were ever accepted
+    putUint32(payload, errorCode);
+    sendFrame(H2_GOAWAY, 0, 0, payload);
+    SHUTDOWN_SOCKET(fd);
+    changed.notify_all();
+}
+
+void H2Session::run() {
+    std::string input;
+    char buffer[H2_DEFAULT_MAX_FRAME + H2_FRAME_HEADER];
+    while (!closed) {
+        size_t pos = 0;
+        bool fine = true;
+        while (fine && input.size() - pos >= H2_FRAME_HEADER) {
+            const unsigned char* header = (const unsigned char*)input.data() + pos;
+            size_t length = (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | header[2];
+            if (length > H2_DEFAULT_MAX_FRAME) {
+                goAway(H2_FRAME_SIZE_ERROR);
+                fine = false;
+                break;
+            }
+            if (input.size() - pos < H2_FRAME_HEADER + length) break;
+            std::string payload = input.substr(pos + H2_FRAME_HEADER, length);
+            uint32_t streamId = getUint32((const char*)header + 5) & 0x7fffffff;
+            fine = handleFrame(header[3], header[4], streamId, payload);
+            if (!fine) goAway(H2_PROTOCOL_ERROR);
+            pos += H2_FRAME_HEADER + length;
+        }
+        if (!fine) break;
+        input.erase(0, pos);
+
+        if (!wait_readable(fd, 1000)) {
+            if (idleFor(H2_SESSION_IDLE_MS)) goAway();
+            continue;
+        }
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        input.append(buffer, size_t(received));
+    }
+    if (!closed) LOG_WARNING("h2c connection to %s lost", addressText(address).c_str());
+    closed = true;
+    failAll();
+}
+
+bool H2Session::handleFrame(uint8_t type, uint8_t flags, uint32_t streamId, const std::string& payload) {
+    const char* data = payload.data();
+    size_t length = payload.size();
+    if (headerStream != 0 && (type != H2_CONTINUATION || streamId != headerStream)) return false;
+
+    switch (type) {
+        case H2_DATA: {
+            if (streamId == 0 || !unpad(flags, data, length)) break;
+            // The connection window is given back on arrival; each stream's own window bounds what
+            // waits for its reader.
+            connectionUnacked += payload.size();
+            if (connectionUnacked >= H2_CONNECTION_WINDOW / 2) {
+                sendWindowUpdate(0, connectionUnacked);
+                connectionUnacked = 0;
+            }
+            deliverData(streamId, data, length, payload.size(), flags & H2_FLAG_END_STREAM);
+            return true;
+        }
+        case H2_HEADERS: {
+            if (streamId == 0 || !unpad(flags, data, length)) break;
+            if (flags & H2_FLAG_PRIORITY) {
+                if (length < 5) break;
+                data += 5;
+                length -= 5;
+            }
+            headerBlock.assign(data, length);
+            headerEndStream = flags & H2_FLAG_END_STREAM;
+            headerStream = streamId;
+            if (!(flags & H2_FLAG_END_HEADERS)) return true;
+            headerStream = 0;
+            if (deliverHeaders(streamId, headerBlock, headerEndStream)) return true;
+            goAway(H2_COMPRESSION_ERROR);
+            return false;
+        }
+        case H2_CONTINUATION: {
+            if (headerStream == 0 || headerBlock.size() + length > HPACK_MAX_HEADER_LIST) break;
+            headerBlock.append(data, length);
+            if (!(flags & H2_FLAG_END_HEADERS)) return true;
+            headerStream = 0;
+            if (deliverHeaders(streamId, headerBlock, headerEndStream)) return true;
+            goAway(H2_COMPRESSION_ERROR);
+            return false;
+        }
+        case H2_RST_STREAM:
+            if (streamId == 0 || length != 4) break;
+            endStream(streamId, true);
+            return true;
+        case H2_SETTINGS: {
+            if (streamId != 0 || length % 6 != 0) break;
+            if (flags & H2_FLAG_ACK) return true;
+            for (size_t pos = 0; pos < length; pos += 6) {
+                uint16_t setting = uint16_t(((unsigned char)data[pos] << 8) | (unsigned char)data[pos + 1]);
+                uint32_t value = getUint32(data + pos + 2);
+                if (setting == H2_SETTINGS_INITIAL_WINDOW_SIZE && value > H2_MAX_WINDOW) return false;
+                if (setting == H2_SETTINGS_MAX_FRAME_SIZE && (value < H2_DEFAULT_MAX_FRAME || value > 0xffffff)) return false;
+                if (setting == H2_SETTINGS_HEADER_TABLE_SIZE) {
+                    std::lock_guard<std::mutex> writeLock(write_mutex);
+                    encoder.setPeerLimit(value);
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (setting == H2_SETTINGS_MAX_CONCURRENT_STREAMS) peerMaxStreams = value;
+                if (setting == H2_SETTINGS_MAX_FRAME_SIZE) peerMaxFrame = value;
+                if (setting == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+                    // Applies to the streams already open as well (RFC 9113 section 6.9.2).
+                    int64_t delta = int64_t(value) - peerInitialWindow;
+                    peerInitialWindow = value;
+                    for (auto& [id, weak] : streams) {
+                        if (std::shared_ptr<H2Stream> stream = weak.lock()) stream->sendWindow += delta;
+                    }
+                }
+                changed.notify_all();
+            }
+            sendFrame(H2_SETTINGS, H2_FLAG_ACK, 0, "");
+            return true;
+        }
+        case H2_PING:
+            if (streamId != 0 || length != 8) break;
+            if (!(flags & H2_FLAG_ACK)) sendFrame(H2_PING, H2_FLAG_ACK, 0, payload);
+            return true;
+        case H2_GOAWAY: {
+            if (streamId != 0 || length < 8) break;
+            uint32_t lastStreamId = getUint32(data) & 0x7fffffff;
+            LOG_INFO("h2c origin %s is going away after stream %u, error %u", addressText(address).c_str(), lastStreamId,
+                     getUint32(data + 4));
+            // Streams above the last one were never processed and fail now; the rest may still finish.
+            std::vector<uint32_t> refused;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                goingAway = true;
+                for (auto& [id, weak] : streams) {
+                    if (id > lastStreamId) refused.push_back(id);
+                }
+            }
+            for (uint32_t id : refused) endStream(id, true);
+            return true;
+        }
+        case H2_WINDOW_UPDATE: {
+            if (length != 4) break;
+            uint32_t increment = getUint32(data) & 0x7fffffff;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (streamId == 0) {
+                sendWindow += increment;
+            } else {
+                auto it = streams.find(streamId);
+                std::shared_ptr<H2Stream> stream = it == streams.end() ? nullptr : it->second.lock();
+                if (stream) stream->sendWindow += increment;
+            }
+            changed.notify_all();
+            return true;
+        }
+        case H2_PRIORITY:
+            return true;
+        case H2_PUSH_PROMISE:
+            break;          // push was turned off in our settings
+        default:
+            return true;    // unknown types are ignored
+    }
+    return false;
+}
+
+bool H2Session::deliverHeaders(uint32_t streamId, const std::string& block, bool endStream) {
+    // Every block goes through the decoder, even for a stream given up, to keep the tables in step.
+    std::vector<HeaderField> fields;
+    if (!decoder.decode(block, fields)) return false;
+    std::shared_ptr<H2Stream> stream = findStream(streamId);
+    if (!stream) return true;
+
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (stream->headSent) {
+            // Trailers; only a chunked body has a place for them.
+            if (stream->chunked) {
+                stream->pending += "0\r\n";
+                for (const HeaderField& field : fields) {
+                    if (field.name[0] != ':') stream->pending += field.name + ": " + field.value + "\r\n";
+                }
+                stream->pending += "\r\n";
+                stream->chunked = false;
+            }
+        } else {
+            std::string status;
+            std::string head;
+            bool hasLength = false;
+            for (const HeaderField& field : fields) {
+                if (field.name == ":status") status = field.value;
+                if (field.name.empty() || field.name[0] == ':') continue;
+                if (field.name == "content-length") hasLength = true;
+                head += field.name + ": " + field.value + "\r\n";
+            }
+            int code = atoi(status.c_str());
+            head = "HTTP/1.1 " + status + " " + reasonPhrase(code) + "\r\n" + head;
+            // An interim response is passed on as it is and the final one still follows.
+            if (code >= 200) {
+                if (!hasLength && code != 204 && code != 304) {
+                    if (endStream) {
+                        head += "content-length: 0\r\n";
+                    } else {
+                        head += "transfer-encoding: chunked\r\n";
+                        stream->chunked = true;
+                    }
+                }
+                stream->headSent = true;
+            }
+            stream->pending += head + "\r\n";
+        }
+        stream->changed.notify_all();
+    }
+    if (endStream) this->endStream(streamId, false);
+    return true;
+}
+
+void H2Session::deliverData(uint32_t streamId, const char* data, size_t length, size_t frameLength, bool endStream) {
+    std::shared_ptr<H2Stream> stream = findStream(streamId);
+    if (!stream) return;
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->received += frameLength;
+        if (stream->chunked && length > 0) {
+            char size[20];
+            snprintf(size, sizeof(size), "%zx\r\n", length);
+            stream->pending += size;
+            stream->pending.append(data, length);
+            stream->pending += "\r\n";
+        } else {
+            stream->pending.append(data, length);
+        }
+        stream->changed.notify_all();
+    }
+    if (endStream) this->endStream(streamId, false);
+}
+
+std::shared_ptr<H2Stream> H2Session::findStream(uint32_t streamId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = streams.find(streamId);
+    return it == streams.end() ? nullptr : it->second.lock();
+}
+
+void H2Session::endStream(uint32_t streamId, bool failed) {
+    std::shared_ptr<H2Stream> stream;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = streams.find(streamId);
+        if (it == streams.end()) return;
+        stream = it->second.lock();
+        streams.erase(it);
+        if (streams.empty()) idleSince = steadyMillis();
+        changed.notify_all();
+    }
+    if (!stream) return;
+
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    if (failed) {
+        stream->failed = true;
+    } else {
+        if (stream->chunked) stream->pending += "0\r\n\r\n";
+        stream->chunked = false;
+        stream->finished = true;
+    }
+    stream->changed.notify_all();
+}
+
+void H2Session::failAll() {
+    std::vector<uint32_t> open;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [id, weak] : streams) open.push_back(id);
+    }
+    for (uint32_t id : open) endStream(id, true);
+    changed.notify_all();
+}
+
+void H2Session::cancel(uint32_t streamId) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        streams.erase(streamId);
+        if (streams.empty()) idleSince = steadyMillis();
+        changed.notify_all();
+    }
+    std::string payload;
+    putUint32(payload, H2_CANCEL);
+    sendFrame(H2_RST_STREAM, 0, streamId, payload);
+}
+
+// ----------------- H2Pool -----------------
+// "host:port" for a Host header that may or may not name the port.
+static std::string originKey(const std::string& host, int port) {
+    size_t end = host[0] == '[' ? host.find(']') + 1 : host.find(':');
+    return host.substr(0, end) + ":" + std::to_string(port);
+}
+
+// Fields that only mean something on one HTTP/1.1 connection are not sent (RFC 9113 section 8.2.2).
+static bool connectionSpecific(const std::string& name, const std::string& connection) {
+    return name == "host" || name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade" || name == "te" || headerHasToken(connection, name);
+}
+
+// RFC 9218 urgency (0 most urgent, 7 least) guessed from what the request is for: the document,
+// then what blocks rendering, then the rest, with images and media last and delivered incrementally.
+static int requestUrgency(const HttpRequest& request, const std::string& path, bool& incremental) {
+    std::string destination = findHeader(request.headers, "Sec-Fetch-Dest");
+    std::string accept = findHeader(request.headers, "Accept");
+    std::string file = path.substr(0, path.find('?'));
+    std::string extension = file.find('.') == std::string::npos ? "" : file.substr(file.rfind('.') + 1);
+    for (char& c : extension) c = char(tolower((unsigned char)c));
+    auto oneOf = [&](std::initializer_list<const char*> names) {
+        for (const char* name : names) {
+            if (extension == name || destination == name) return true;
+        }
+        return false;
+    };
+
+    incremental = false;
+    if (destination == "document" || accept.rfind("text/html", 0) == 0 || oneOf({"html", "htm"})) return 0;
+    if (oneOf({"style", "css"})) return 1;
+    if (oneOf({"script", "js", "mjs", "font", "woff", "woff2", "ttf", "otf"})) return 2;
+    incremental = true;
+    if (oneOf({"image", "png", "jpg", "jpeg", "gif", "webp", "avif", "svg", "ico"}) || accept.rfind("image/", 0) == 0) return 5;
+    if (oneOf({"video", "audio", "mp4", "webm", "mp3", "m4s", "ts"})) return 6;
+    incremental = false;
+    return 3;
+}
+
+void H2Pool::load(const char* file) {
+    std::ifstream in(file);
+    if (!in.is_open()) return;
+    std::string line;
+    std::lock_guard<std::mutex> lock(mutex);
+    while (std::getline(in, line)) {
+        trimNewlineChars(line);
+        if (line.empty() || line[0] == '#') continue;
+        size_t colon = line[0] == '[' ? line.find(':', line.find(']')) : line.find(':');
+        std::string key = colon == std::string::npos ? line + ":80" : line;
+        origins[key] = std::make_unique<Origin>();
+    }
+    LOG_INFO("Loaded %zu h2c origins from %s", origins.size(), file);
+}
+
+bool H2Pool::routes(const HttpRequest& request, int port) const {
+    std::string host = findHeader(request.headers, "Host");
+    if (host.empty() || request.isEncrypted || request.method == "CONNECT") return false;
+    if (!findHeader(request.headers, "Transfer-Encoding").empty()) return false;
+    // The body goes out with the stream in one piece, so all of it must have arrived with the head.
+    std::string length = findHeader(request.headers, "Content-Length");
+    if (!length.empty()) {
+        size_t headEnd = request.rawRequest.find("\r\n\r\n");
+        try {
+            if (headEnd == std::string::npos || request.rawRequest.size() - headEnd - 4 < std::stoull(length)) return false;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    return origins.count(originKey(host, port)) > 0;
+}
+
+std::shared_ptr<H2Session> H2Pool::pickSession(Origin& origin, const std::string& host, const std::string& key, int port,
+                                               const SocketProfile& profile, sockaddr_in& address,
+                                               const std::function<bool(const sockaddr_in&)>& blocked) {
+    std::unique_lock<std::mutex> lock(origin.mutex);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(H2_CONNECT_TIMEOUT_MS);
+    while (true) {
+        origin.sessions.erase(std::remove_if(origin.sessions.begin(), origin.sessions.end(),
+                                             [](const std::shared_ptr<H2Session>& s) { return !s->accepting(); }),
+                              origin.sessions.end());
+        for (const std::shared_ptr<H2Session>& candidate : origin.sessions) {
+            if (candidate->available()) return candidate;
+        }
+        if (origin.connecting == 0) break;
+        // A burst shares the connection being opened rather than each opening its own.
+        if (origin.changed.wait_until(lock, deadline) == std::cv_status::timeout) {
+            throw std::runtime_error("Timed out waiting for an h2c connection to " + key);
+        }
+    }
+    if (origin.sessions.size() >= H2_MAX_SESSIONS_PER_ORIGIN) {
+        throw std::runtime_error("Every h2c connection to " + key + " is at its stream limit");
+    }
+
+    // Resolved and connected without the lock, so requests an existing connection can take are not held up.
+    origin.connecting++;
+    lock.unlock();
+    std::shared_ptr<H2Session> session;
+    std::string name = host.substr(0, key.rfind(':'));
+    if (name[0] == '[') name = name.substr(1, name.size() - 2);
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* resolved = nullptr;
+    bool found = getaddrinfo(name.c_str(), std::to_string(port).c_str(), &hints, &resolved) == 0 && resolved;
+    bool refused = false;
+    if (found) {
+        address = *(sockaddr_in*)resolved->ai_addr;
+        freeaddrinfo(resolved);
+        // Checked before connecting, so a blocked address is never contacted.
+        refused = blocked(address);
+        if (!refused) session = H2Session::open(address, profile);
+    }
+    lock.lock();
+    origin.connecting--;
+    if (session) {
+        origin.sessions.push_back(session);
+        LOG_INFO("Opened h2c connection %zu to %s", origin.sessions.size(), key.c_str());
+    }
+    origin.changed.notify_all();
+
+    if (!found) throw std::runtime_error("Failed to resolve h2c origin " + key);
+    if (refused) return nullptr;
+    if (!session) throw std::runtime_error("Failed to connect to h2c origin " + key);
+    return session;
+}
+
+std::shared_ptr<H2Stream> H2Pool::open(const std::string& rawRequest, int port, const SocketProfile& profile, sockaddr_in& address,
+                                       const std::function<bool(const sockaddr_in&)>& blocked) {
+    HttpRequest request = parseHttpRequest(rawRequest);
+    std::string host = findHeader(request.headers, "Host");
+    std::string key = originKey(host, port);
+    Origin* origin;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = origins.find(key);
+        if (it == origins.end()) throw std::runtime_error("Not an h2c origin: " + key);
+        origin = it->second.get();
+    }
+
+    std::string path = request.url;
+    size_t scheme = path.find("://");
+    if (scheme != std::string::npos) {
+        size_t slash = path.find('/', scheme + 3);
+        path = slash == std::string::npos ? "/" : path.substr(slash);
+    }
+    std::vector<HeaderField> headers = {{":method", request.method}, {":scheme", "http"}, {":authority", host}, {":path", path}};
+    std::string connection = findHeader(request.headers, "Connection");
+    bool hasPriority = false;
+    for (const auto& [name, value] : request.headers) {
+        std::string lower = name;
+        for (char& c : lower) c = char(tolower((unsigned char)c));
+        if (connectionSpecific(lower, connection)) continue;
+        hasPriority = hasPriority || lower == "priority";
+        headers.push_back({lower, value});
+    }
+    bool incremental;
+    int urgency = requestUrgency(request, path, incremental);
+    // A client's own priority is passed on as it is; without one, the guess is sent in its stead.
+    if (!hasPriority && (urgency != 3 || incremental)) {
+        headers.push_back({"priority", "u=" + std::to_string(urgency) + (incremental ? ", i" : "")});
+    }
+    int weight = 256 - urgency * 32;
+
+    // `routes` made sure the whole body is here; anything past it is not part of this request.
+    size_t headEnd = rawRequest.find("\r\n\r\n");
+    std::string body;
+    std::string length = findHeader(request.headers, "Content-Length");
+    if (headEnd != std::string::npos && !length.empty()) body = rawRequest.substr(headEnd + 4, std::stoull(length));
+
+    // A session picked with room may fill up before the stream is started; then another is tried.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        std::shared_ptr<H2Session> session = pickSession(*origin, host, key, port, profile, address, blocked);
+        if (!session) return nullptr;
+        // A connection opened earlier is checked too; the list may have changed since.
+        address = session->getAddress();
+        if (blocked(address)) return nullptr;
+        std::shared_ptr<H2Stream> stream = session->submit(headers, body, weight);
+        if (stream) return stream;
+    }
+    throw std::runtime_error("No h2c connection to " + key + " took the request");
+}
+
+void H2Pool::closeAll() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& [key, origin] : origins) {
+        std::lock_guard<std::mutex> originLock(origin->mutex);
+        for (const std::shared_ptr<H2Session>& session : origin->sessions) session->goAway();
+        origin->sessions.clear();
+    }
+}
@@ -0,0 +1,393 @@
+#include "../include/hpack.h"
+
+// RFC 7541 Appendix A; index 1 is the first entry.
+static const HeaderField STATIC_TABLE[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 Appendix B, by symbol; EOS (256) is 0x3fffffff, 30 bits.
+static const uint32_t HUFFMAN_CODES[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+static const uint8_t HUFFMAN_LENGTHS[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+#define HUFFMAN_EOS 256
+
+// ----------------- Huffman -----------------
+// The code as a binary tree, built once; decoding walks it a bit at a time.
+struct HuffmanTree {
+    struct Node {
+        int16_t child[2] = {-1, -1};
+        int16_t symbol = -1;
+    };
+    std::vector<Node> nodes;
+
+    HuffmanTree() : nodes(1) {
+        for (int symbol = 0; symbol <= HUFFMAN_EOS; symbol++) {
+            uint32_t code = symbol == HUFFMAN_EOS ? 0x3fffffff : HUFFMAN_CODES[symbol];
+            int length = symbol == HUFFMAN_EOS ? 30 : HUFFMAN_LENGTHS[symbol];
+            size_t node = 0;
+            for (int bit = length - 1; bit >= 0; bit--) {
+                int branch = (code >> bit) & 1;
+                if (nodes[node].child[branch] < 0) {
+                    nodes[node].child[branch] = int16_t(nodes.size());
+                    nodes.emplace_back();
+                }
+                node = nodes[node].child[branch];
+            }
+            nodes[node].symbol = int16_t(symbol);
+        }
+    }
+};
+
+std::string huffmanEncode(const std::string& text) {
+    std::string out;
+    uint64_t bits = 0;
+    int pending = 0;
+    for (unsigned char c : text) {
+        bits = (bits << HUFFMAN_LENGTHS[c]) | HUFFMAN_CODES[c];
+        pending += HUFFMAN_LENGTHS[c];
+        while (pending >= 8) {
+            pending -= 8;
+            out += char(bits >> pending);
+        }
+    }
+    // Padded with the most significant bits of EOS, i.e. ones.
+    if (pending > 0) out += char((bits << (8 - pending)) | (0xff >> pending));
+    return out;
+}
+
+static size_t huffmanLength(const std::string& text) {
+    size_t bits = 0;
+    for (unsigned char c : text) bits += HUFFMAN_LENGTHS[c];
+    return (bits + 7) / 8;
+}
+
+bool huffmanDecode(const unsigned char* data, size_t length, std::string& out) {
+    static const HuffmanTree tree;
+    size_t node = 0;
+    int depth = 0;              // bits into the current code
+    bool allOnes = true;
+    for (size_t i = 0; i < length; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            int branch = (data[i] >> bit) & 1;
+            int16_t next = tree.nodes[node].child[branch];
+            if (next < 0) return false;
+            node = size_t(next);
+            depth++;
+            allOnes = allOnes && branch == 1;
+            int16_t symbol = tree.nodes[node].symbol;
+            if (symbol < 0) continue;
+            if (symbol == HUFFMAN_EOS) return false;
+            out += char(symbol);
+            node = 0;
+            depth = 0;
+            allOnes = true;
+        }
+    }
+    // Only a prefix of EOS shorter than a byte may be left over.
+    return depth < 8 && allOnes;
+}
+
+// ----------------- Primitives -----------------
+static void encodeInteger(std::string& out, uint8_t flags, int prefixBits, size_t value) {
+    size_t limit = (size_t(1) << prefixBits) - 1;
+    if (value < limit) {
+        out += char(flags | value);
+        return;
+    }
+    out += char(flags | limit);
+    value -= limit;
+    while (value >= 128) {
+        out += char((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static void encodeString(std::string& out, const std::string& text) {
+    size_t compressed = huffmanLength(text);
+    if (compressed < text.size()) {
+        encodeInteger(out, 0x80, 7, compressed);
+        out += huffmanEncode(text);
+    } else {
+        encodeInteger(out, 0x00, 7, text.size());
+        out += text;
+    }
+}
+
+static bool decodeInteger(const unsigned char*& pos, const unsigned char* end, int prefixBits, size_t& value) {
+    if (pos >= end) return false;
+    size_t limit = (size_t(1) << prefixBits) - 1;
+    value = *pos++ & limit;
+    if (value < limit) return true;
+    for (int shift = 0; shift <= 28; shift += 7) {
+        if (pos >= end) return false;
+        unsigned char byte = *pos++;
+        value += size_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;       // longer than any length this side accepts
+}
+
+static bool decodeString(const unsigned char*& pos, const unsigned char* end, std::string& out) {
+    if (pos >= end) return false;
+    bool huffman = *pos & 0x80;
+    size_t length;
+    if (!decodeInteger(pos, end, 7, length) || length > size_t(end - pos)) return false;
+    if (huffman) {
+        if (!huffmanDecode(pos, length, out)) return false;
+    } else {
+        out.assign((const char*)pos, length);
+    }
+    pos += length;
+    return true;
+}
+
+// ----------------- HpackTable -----------------
+HpackTable::HpackTable() : size(0), capacity(HPACK_DEFAULT_TABLE_SIZE) {}
+
+void HpackTable::evict(size_t room) {
+    while (!entries.empty() && size + room > capacity) {
+        size -= entries.back().name.size() + entries.back().value.size() + HPACK_ENTRY_OVERHEAD;
+        entries.pop_back();
+    }
+}
+
+void HpackTable::add(const HeaderField& field) {
+    size_t entrySize = field.name.size() + field.value.size() + HPACK_ENTRY_OVERHEAD;
+    evict(entrySize);
+    // An entry larger than the whole table empties it and is not kept.
+    if (entrySize > capacity) return;
+    entries.push_front(field);
+    size += entrySize;
+}
+
+void HpackTable::resize(size_t capacity) {
+    this->capacity = capacity;
+    evict(0);
+}
+
+const HeaderField* HpackTable::at(size_t index) const {
+    if (index == 0) return nullptr;
+    if (index <= HPACK_STATIC_ENTRIES) return &STATIC_TABLE[index - 1];
+    index -= HPACK_STATIC_ENTRIES + 1;
+    return index < entries.size() ? &entries[index] : nullptr;
+}
+
+size_t HpackTable::find(const std::string& name, const std::string& value, bool& exact) const {
+    size_t byName = 0;
+    exact = false;
+    for (size_t i = 0; i < HPACK_STATIC_ENTRIES + entries.size(); i++) {
+        const HeaderField& field = i < HPACK_STATIC_ENTRIES ? STATIC_TABLE[i] : entries[i - HPACK_STATIC_ENTRIES];
+        if (field.name != name) continue;
+        if (field.value == value) {
+            exact = true;
+            return i + 1;
+        }
+        if (byName == 0) byName = i + 1;
+    }
+    return byName;
+}
+
+// ----------------- HpackEncoder -----------------
+HpackEncoder::HpackEncoder() : peerLimit(HPACK_DEFAULT_TABLE_SIZE), announceSize(false) {}
+
+void HpackEncoder::setPeerLimit(size_t limit) {
+    peerLimit = limit;
+    // Never more than the default: a bigger table only costs the origin memory for little gain.
+    size_t capacity = std::min<size_t>(limit, HPACK_DEFAULT_TABLE_SIZE);
+    if (capacity != table.getCapacity()) {
+        table.resize(capacity);
+        announceSize = true;
+    }
+}
+
+// Credentials are never indexed, so no intermediary learns them from the table; values unique
+// to one request would only evict the ones worth keeping.
+static bool neverIndexed(const std::string& name) {
+    return name == "authorization" || name == "proxy-authorization";
+}
+
+static bool notIndexed(const std::string& name) {
+    return name == ":path" || name == "content-length" || name == "if-none-match" || name == "if-modified-since" ||
+           name == "range" || name == "referer";
+}
+
+std::string HpackEncoder::encode(const std::vector<HeaderField>& headers) {
+    std::string out;
+    if (announceSize) {
+        encodeInteger(out, 0x20, 5, table.getCapacity());
+        announceSize = false;
+    }
+    for (const HeaderField& field : headers) {
+        bool exact;
+        size_t index = table.find(field.name, field.value, exact);
+        bool sensitive = neverIndexed(field.name);
+        if (exact && !sensitive) {
+            encodeInteger(out, 0x80, 7, index);
+            continue;
+        }
+        if (sensitive) {
+            encodeInteger(out, 0x10, 4, index);
+        } else if (notIndexed(field.name)) {
+            encodeInteger(out, 0x00, 4, index);
+        } else {
+            encodeInteger(out, 0x40, 6, index);
+            table.add(field);
+        }
+        if (index == 0) encodeString(out, field.name);
+        encodeString(out, field.value);
+    }
+    return out;
+}
+
+// ----------------- HpackDecoder -----------------
+HpackDecoder::HpackDecoder() : limit(HPACK_DEFAULT_TABLE_SIZE) {}
+
+bool HpackDecoder::decode(const std::string& block, std::vector<HeaderField>& headers) {
+    const unsigned char* pos = (const unsigned char*)block.data();
+    const unsigned char* end = pos + block.size();
+    size_t listSize = 0;
+    while (pos < end) {
+        unsigned char first = *pos;
+        size_t index;
+        HeaderField field;
+        if (first & 0x80) {
+            if (!decodeInteger(pos, end, 7, index)) return false;
+            const HeaderField* found = table.at(index);
+            if (!found) return false;
+            field = *found;
+        } else if ((first & 0xe0) == 0x20) {
+            size_t capacity;
+            if (!decodeInteger(pos, end, 5, capacity) || capacity > limit) return false;
+            table.resize(capacity);
+            continue;
+        } else {
+            // Literal: with incremental indexing (01), never indexed (0001) or without indexing (0000).
+            bool indexed = first & 0x40;
+            if (!decodeInteger(pos, end, indexed ? 6 : 4, index)) return false;
+            if (index > 0) {
+                const HeaderField* found = table.at(index);
+                if (!found) return false;
+                field.name = found->name;
+            } else if (!decodeString(pos, end, field.name)) {
+                return false;
+            }
+            if (!decodeString(pos, end, field.value)) return false;
+            if (indexed) table.add(field);
+        }
+        listSize += field.name.size() + field.value.size() + HPACK_ENTRY_OVERHEAD;
+        if (listSize > HPACK_MAX_HEADER_LIST) return false;
+        headers.push_back(std::move(field));
+    }
+    return true;
+}
@@ -0,0 +1,339 @@
+#include "../include/http_cache.h"
+
+// Value of a "name=value" directive in a Cache-Control header, or -1 if absent/invalid.
+static int64_t directiveSeconds(const std::string& cacheControl, const std::string& name) {
+    size_t start = 0;
+    while (start < cacheControl.size()) {
+        size_t end = cacheControl.find(',', start);
+        if (end == std::string::npos) end = cacheControl.size();
+        std::string item = cacheControl.substr(start, end - start);
+        item.erase(0, item.find_first_not_of(" \t"));
+
+        size_t eq = item.find('=');
+        if (eq != std::string::npos && headerHasToken(item.substr(0, eq), name)) {
+            std::string value = item.substr(eq + 1);
+            value.erase(std::remove(value.begin(), value.end(), '"'), value.end());
+            try {
+                return std::max<int64_t>(0, std::stoll(value));
+            } catch (const std::exception& e) {
+                return -1;
+            }
+        }
+        start = end + 1;
+    }
+    return -1;
+}
+
+static bool isHeuristicallyCacheable(int statusCode) {
+    switch (statusCode) {
+        case 200: case 203: case 204: case 300: case 301: case 404: case 405: case 410: case 414: case 501:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint64_t mixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// ----------------- CachedResponse -----------------
+size_t CachedResponse::size() const {
+    return key.size() + head.size() + body.size() + sizeof(CachedResponse);
+}
+
+int64_t CachedResponse::currentAge(std::time_t now) const {
+    return initialAge + std::max<int64_t>(0, now - storedAt);
+}
+
+bool CachedResponse::isFresh(std::time_t now) const {
+    return currentAge(now) < freshnessLifetime;
+}
+
+bool CachedResponse::canServeWhileRevalidating(std::time_t now) const {
+    return !mustRevalidate && currentAge(now) < freshnessLifetime + staleWhileRevalidate;
+}
+
+bool CachedResponse::canServeOnError(std::time_t now) const {
+    return !mustRevalidate && currentAge(now) < freshnessLifetime + staleIfError;
+}
+
+std::string CachedResponse::headWithAge(std::time_t now) const {
+    return head + "Age: " + std::to_string(currentAge(now)) + "\r\n\r\n";
+}
+
+// ----------------- FrequencySketch -----------------
+FrequencySketch::FrequencySketch(size_t width) : additions(0) {
+    size_t size = 1;
+    while (size < width) size <<= 1;
+    table.assign(size * DEPTH, 0);
+    mask = size - 1;
+    sampleSize = size * 10;
+}
+
+size_t FrequencySketch::indexOf(uint64_t hash, int row) const {
+    uint64_t h = mixHash(hash + 0x9e3779b97f4a7c15ULL * (row + 1));
+    return row * (mask + 1) + (h & mask);
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+    for (int row = 0; row < DEPTH; row++) {
+        uint8_t& counter = table[indexOf(hash, row)];
+        if (counter < 15) counter++;
+    }
+    if (++additions >= sampleSize) {
+        for (auto& counter : table) counter >>= 1;
+        additions /= 2;
+    }
+}
+
+int FrequencySketch::estimate(uint64_t hash) const {
+    int minimum = 15;
+    for (int row = 0; row < DEPTH; row++) {
+        minimum = std::min<int>(minimum, table[indexOf(hash, row)]);
+    }
+    return minimum;
+}
+
+// ----------------- HttpCache -----------------
+HttpCache::HttpCache(size_t capacityBytes) : shardCapacity(capacityBytes / CACHE_SHARDS) {}
+
+std::string HttpCache::cacheKey(const HttpRequest& request) {
+    std::string url = request.url;
+    if (url.find("://") == std::string::npos) {
+        url = "http://" + findHeader(request.headers, "Host") + url;
+    }
+    return request.method + " " + url;
+}
+
+bool HttpCache::isCacheableRequest(const HttpRequest& request) {
+    if (request.method != "GET" || request.isEncrypted) return false;
+    if (!findHeader(request.headers, "Authorization").empty()) return false;
+    if (!findHeader(request.headers, "Range").empty()) return false;
+    if (headerHasToken(findHeader(request.headers, "Cache-Control"), "no-store")) return false;
+    return true;
+}
+
+std::shared_ptr<CachedResponse> HttpCache::buildEntry(const HttpRequest& request, const std::string& rawResponse) {
+    size_t headerEnd = rawResponse.find("\r\n\r\n");
+    if (headerEnd == std::string::npos) return nullptr;
+
+    HttpResponse response = parseHttpResponse(rawResponse.substr(0, headerEnd + 4));
+    if (response.statusCode == 206 || response.statusCode == 304 || response.statusCode < 200) return nullptr;
+    std::string cacheControl = findHeader(response.headers, "Cache-Control");
+    std::string vary = findHeader(response.headers, "Vary");
+    if (headerHasToken(cacheControl, "no-store") || headerHasToken(cacheControl, "private") ||
+        !findHeader(response.headers, "Set-Cookie").empty() || vary.find('*') != std::string::npos) {
+        return nullptr;
+    }
+
+    auto entry = std::make_shared<CachedResponse>();
+    entry->key = cacheKey(request);
+    entry->statusCode = response.statusCode;
+    entry->storedAt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    entry->etag = findHeader(response.headers, "ETag");
+    entry->lastModified = findHeader(response.headers, "Last-Modified");
+
+    // Freshness lifetime: s-maxage, then max-age, then Expires, then the Last-Modified heuristic.
+    std::time_t date = parseHttpDate(findHeader(response.headers, "Date"));
+    if (date < 0) date = entry->storedAt;
+    int64_t lifetime = directiveSeconds(cacheControl, "s-maxage");
+    if (lifetime < 0) lifetime = directiveSeconds(cacheControl, "max-age");
+    if (lifetime < 0) {
+        std::string expiresHeader = findHeader(response.headers, "Expires");
+        std::time_t expires = parseHttpDate(expiresHeader);
+        if (!expiresHeader.empty()) lifetime = expires < 0 ? 0 : std::max<int64_t>(0, expires - date);
+    }
+    if (lifetime < 0 && isHeuristicallyCacheable(response.statusCode)) {
+        std::time_t lastModified = parseHttpDate(entry->lastModified);
+        if (lastModified >= 0 && lastModified < date) {
+            lifetime = std::min<int64_t>((date - lastModified) / 10, CACHE_HEURISTIC_MAX_SECONDS);
+        }
+    }
+    if (headerHasToken(cacheControl, "no-cache")) lifetime = 0;
+    if (lifetime <= 0) return nullptr;
+
+    int64_t ageHeader = 0;
+    try {
+        std::string age = findHeader(response.headers, "Age");
+        if (!age.empty()) ageHeader = std::max<int64_t>(0, std::stoll(age));
+    } catch (const std::exception& e) {}
+    entry->initialAge = std::max<int64_t>(ageHeader, entry->storedAt - date);
+    entry->freshnessLifetime = lifetime;
+    entry->staleWhileRevalidate = std::max<int64_t>(0, directiveSeconds(cacheControl, "stale-while-revalidate"));
+    entry->staleIfError = std::max<int64_t>(0, directiveSeconds(cacheControl, "stale-if-error"));
+    entry->mustRevalidate = headerHasToken(cacheControl, "must-revalidate") ||
+                            headerHasToken(cacheControl, "proxy-revalidate");
+
+    // Keep every header line except Age, which is regenerated on each hit.
+    size_t lineStart = 0;
+    while (lineStart < headerEnd + 2) {
+        size_t lineEnd = rawResponse.find("\r\n", lineStart);
+        std::string line = rawResponse.substr(lineStart, lineEnd - lineStart + 2);
+        if (lineStart == 0 || !headerHasToken(line.substr(0, line.find(':')), "Age")) {
+            entry->head += line;
+        }
+        lineStart = lineEnd + 2;
+    }
+    entry->body = rawResponse.substr(headerEnd + 4);
+
+    size_t start = 0;
+    while (start < vary.size()) {
+        size_t end = vary.find(',', start);
+        if (end == std::string::npos) end = vary.size();
+        std::string name = vary.substr(start, end - start);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (!name.empty()) entry->varyHeaders.push_back({name, findHeader(request.headers, name)});
+        start = end + 1;
+    }
+    return entry;
+}
+
+std::string HttpCache::conditionalRequest(const HttpRequest& request, const CachedResponse& stale) {
+    std::string validators;
+    if (!stale.etag.empty()) validators += "If-None-Match: " + stale.etag + "\r\n";
+    if (!stale.lastModified.empty()) validators += "If-Modified-Since: " + stale.lastModified + "\r\n";
+
+    std::string raw = request.rawRequest;
+    size_t requestLineEnd = raw.find("\r\n");
+    if (requestLineEnd == std::string::npos) return raw;
+    return raw.insert(requestLineEnd + 2, validators);
+}
+
+std::shared_ptr<CachedResponse> HttpCache::refreshEntry(const HttpRequest& request, const CachedResponse& stale,
+                                                        const std::string& body, const std::string& notModifiedHead) {
+    // Header lines of the 304 by lower-case name; framing headers describe the 304 itself.
+    std::unordered_map<std::string, std::string> updates;
+    size_t lineStart = notModifiedHead.find("\r\n");
+    while (lineStart != std::string::npos && lineStart + 2 < notModifiedHead.size()) {
+        lineStart += 2;
+        size_t lineEnd = notModifiedHead.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos || lineEnd == lineStart) break;
+        std::string line = notModifiedHead.substr(lineStart, lineEnd - lineStart);
+        std::string name = line.substr(0, line.find(':'));
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name != "content-length" && name != "transfer-encoding" && name != "connection" && name != "keep-alive") {
+            updates[name] = line + "\r\n";
+        }
+        lineStart = lineEnd;
+    }
+
+    std::string head;
+    lineStart = 0;
+    while (lineStart < stale.head.size()) {
+        size_t lineEnd = stale.head.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos) break;
+        std::string line = stale.head.substr(lineStart, lineEnd - lineStart + 2);
+        std::string name = line.substr(0, line.find(':'));
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        auto update = updates.find(name);
+        if (lineStart == 0 || update == updates.end()) {
+            head += line;
+        } else if (!update->second.empty()) {
+            head += update->second;
+            update->second.clear();     // repeated stored headers collapse into the updated one
+        }
+        lineStart = lineEnd + 2;
+    }
+    for (const auto& [name, line] : updates) {
+        if (!line.empty()) head += line;
+    }
+    return buildEntry(request, head + "\r\n" + body);
+}
+
+HttpCache::Shard& HttpCache::shardFor(const std::string& key) {
+    return shards[std::hash<std::string>()(key) % CACHE_SHARDS];
+}
+
+void HttpCache::unlink(Shard& shard, const std::string& key) {
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) return;
+    shard.bytes -= (*it->second)->size();
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+}
+
+std::shared_ptr<const CachedResponse> HttpCache::lookup(const HttpRequest& request) {
+    std::string key = cacheKey(request);
+    Shard& shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sketch.increment(std::hash<std::string>()(key));
+
+    // The client asked for an end-to-end reload; the response may still be stored afterwards.
+    std::string cacheControl = findHeader(request.headers, "Cache-Control");
+    if (headerHasToken(cacheControl, "no-cache") || directiveSeconds(cacheControl, "max-age") == 0 ||
+        headerHasToken(findHeader(request.headers, "Pragma"), "no-cache")) {
+        return nullptr;
+    }
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) return nullptr;
+
+    std::shared_ptr<CachedResponse> entry = *it->second;
+    for (const auto& [name, value] : entry->varyHeaders) {
+        if (findHeader(request.headers, name) != value) return nullptr;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return entry;
+}
+
+bool HttpCache::store(std::shared_ptr<CachedResponse> entry) {
+    if (!entry || entry->body.size() > CACHE_MAX_OBJECT_BYTES || entry->size() > shardCapacity) return false;
+
+    Shard& shard = shardFor(entry->key);
+    uint64_t candidateHash = std::hash<std::string>()(entry->key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto existing = shard.index.find(entry->key);
+    size_t bytes = shard.bytes - (existing == shard.index.end() ? 0 : (*existing->second)->size());
+
+    // TinyLFU admission, decided before anything changes: the LRU victims that would make room are
+    // counted up first, and the newcomer is turned away unless it is more popular than each of them.
+    std::vector<std::string> victims;
+    int candidateFrequency = shard.sketch.estimate(candidateHash);
+    for (auto it = shard.lru.rbegin(); it != shard.lru.rend() && bytes + entry->size() > shardCapacity; ++it) {
+        if ((*it)->key == entry->key) continue;
+        if (candidateFrequency <= shard.sketch.estimate(std::hash<std::string>()((*it)->key))) return false;
+        bytes -= (*it)->size();
+        victims.push_back((*it)->key);
+    }
+
+    unlink(shard, entry->key);
+    for (const std::string& victim : victims) unlink(shard, victim);
+    shard.lru.push_front(entry);
+    shard.index[entry->key] = shard.lru.begin();
+    shard.bytes += entry->size();
+    return true;
+}
+
+void HttpCache::remove(const std::string& key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    unlink(shard, key);
+}
+
+size_t HttpCache::sizeBytes() {
+    size_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.bytes;
+    }
+    return total;
+}
+
+size_t HttpCache::objectCount() {
+    size_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.index.size();
+    }
+    return total;
+}
@@ -1,5 +1,6 @@
 #include "../include/common_lib.h"
 #include "../include/http_parser.h"
+#include "../include/logger.h"
 
 // ----------------- HttpRequest methods -----------------
 void HttpRequest::addHeader(const std::string& key, const std::string& value) {
@@ -148,6 +149,7 @@ HttpResponse parseHttpResponse(const std::string& rawMessage) {
                 std::string value = line.substr(colonPos + 1);
                 key.erase(key.find_last_not_of(" \t\r\n") + 1);
                 value.erase(0, value.find_first_not_of(" \t"));
+                trimNewlineChars(value);
                 response.headers[key] = value;
             }
         }
@@ -165,6 +167,242 @@ HttpResponse parseHttpResponse(const std::string& rawMessage) {
     return response;
 }
 
+std::string messageHead(const char* data, size_t length) {
+    std::string_view chunk(data, length);
+    size_t end = chunk.find("\r\n\r\n");
+    return std::string(chunk.substr(0, end == std::string_view::npos ? length : end + 4));
+}
+
+static bool equalsIgnoreCase(const std::string& a, const std::string& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+                                              [](char x, char y) { return ::tolower(x) == ::tolower(y); });
+}
+
+// Header names are case-insensitive, but the parsed maps keep them as received.
+std::string findHeader(const std::unordered_map<std::string, std::string>& headers, const std::string& name) {
+    auto it = headers.find(name);
+    if (it != headers.end()) return it->second;
+    for (const auto& [key, value] : headers) {
+        if (equalsIgnoreCase(key, name)) return value;
+    }
+    return "";
+}
+
+// True if a comma separated header value contains `token`, ignoring case and any "=argument".
+bool headerHasToken(const std::string& value, const std::string& token) {
+    size_t start = 0;
+    while (start < value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) end = value.size();
+        std::string item = value.substr(start, end - start);
+        item = item.substr(0, item.find('='));
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (equalsIgnoreCase(item, token)) return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+BodyFraming responseBodyFraming(const HttpResponse& response, const std::string& requestMethod) {
+    BodyFraming framing;
+    if (requestMethod == "HEAD" || (response.statusCode >= 100 && response.statusCode < 200) ||
+        response.statusCode == 204 || response.statusCode == 304) {
+        framing.kind = BodyFraming::NONE;
+        return framing;
+    }
+
+    if (headerHasToken(findHeader(response.headers, "Transfer-Encoding"), "chunked")) {
+        framing.kind = BodyFraming::CHUNKED;
+        return framing;
+    }
+
+    std::string length = findHeader(response.headers, "Content-Length");
+    if (!length.empty()) {
+        try {
+            framing.length = std::stoull(length);
+            framing.kind = BodyFraming::CONTENT_LENGTH;
+        } catch (const std::exception& e) {
+            framing.kind = BodyFraming::UNTIL_CLOSE;
+        }
+    }
+    return framing;
+}
+
+// ----------------- ResponseTracker -----------------
+ResponseTracker::ResponseTracker(const std::string& requestMethod) : requestMethod(requestMethod) {}
+
+void ResponseTracker::feed(const char* data, size_t length) {
+    totalBytes += length;
+    while (length > 0 && !done) {
+        if (headDone) {
+            if (framing.kind == BodyFraming::CONTENT_LENGTH) {
+                bodyBytes += std::min(length, framing.length - bodyBytes);
+                done = bodyBytes >= framing.length;
+            } else if (framing.kind == BodyFraming::CHUNKED) {
+                chunked.feed(data, length);
+                done = chunked.isComplete();
+            }
+            return;
+        }
+
+        size_t before = pendingHead.size();
+        pendingHead.append(data, length);
+        size_t end = pendingHead.find("\r\n\r\n", before >= 3 ? before - 3 : 0);
+        if (end == std::string::npos) return;
+
+        size_t used = end + 4 - before;
+        HttpResponse head = parseHttpResponse(pendingHead.substr(0, end + 4));
+        pendingHead.clear();
+        data += used;
+        length -= used;
+
+        // 100 Continue and friends precede the real response; 101 hands the connection over.
+        if (head.statusCode >= 100 && head.statusCode < 200 && head.statusCode != 101) {
+            interimBytes += end + 4;
+            continue;
+        }
+        headDone = true;
+        status = head.statusCode;
+        framing = responseBodyFraming(head, requestMethod);
+        if (head.statusCode == 101) framing.kind = BodyFraming::UNTIL_CLOSE;
+        done = framing.kind == BodyFraming::NONE ||
+               (framing.kind == BodyFraming::CONTENT_LENGTH && framing.length == 0);
+    }
+}
+
+bool ResponseTracker::isComplete(bool closed) const {
+    if (done) return true;
+    return closed && headDone && framing.kind == BodyFraming::UNTIL_CLOSE;
+}
+
+std::string ResponseTracker::finalResponse(const std::string& relayed) const {
+    return interimBytes < relayed.size() ? relayed.substr(interimBytes) : std::string();
+}
+
+// ----------------- HTTP dates -----------------
+static const char* MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+static const char* WEEKDAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+
+// Days since 1970-01-01 for a proleptic Gregorian date (portable replacement for timegm).
+static int64_t daysFromCivil(int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = (unsigned)(year - era * 400);
+    unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int64_t)dayOfEra - 719468;
+}
+
+// Parses the IMF-fixdate form ("Sun, 06 Nov 1994 08:49:37 GMT"); returns -1 when invalid.
+std::time_t parseHttpDate(const std::string& value) {
+    char month[4] = {0};
+    int day, year, hour, minute, second;
+    size_t comma = value.find(',');
+    std::string rest = comma == std::string::npos ? value : value.substr(comma + 1);
+    if (sscanf(rest.c_str(), " %d %3s %d %d:%d:%d", &day, month, &year, &hour, &minute, &second) != 6) {
+        return -1;
+    }
+    for (unsigned m = 0; m < 12; m++) {
+        if (strcmp(month, MONTHS[m]) == 0) {
+            return (std::time_t)(daysFromCivil(year, m + 1, day) * 86400 + hour * 3600 + minute * 60 + second);
+        }
+    }
+    return -1;
+}
+
+std::string formatHttpDate(std::time_t time) {
+    int64_t days = time / 86400, secs = time % 86400;
+    // civil_from_days
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned dayOfEra = (unsigned)(z - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned mp = (5 * dayOfYear + 2) / 153;
+    unsigned day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = (int64_t)yearOfEra + era * 400 + (month <= 2);
+
+    char text[64];
+    snprintf(text, sizeof(text), "%s, %02u %s %04lld %02lld:%02lld:%02lld GMT",
+             WEEKDAYS[(days % 7 + 11) % 7], day, MONTHS[month - 1], (long long)year,
+             (long long)(secs / 3600), (long long)(secs % 3600 / 60), (long long)(secs % 60));
+    return text;
+}
+
+// ----------------- ChunkedScanner -----------------
+size_t ChunkedScanner::feed(const char* data, size_t length, std::string* payload) {
+    size_t i = 0;
+    while (i < length && state != DONE && !malformed) {
+        char c = data[i];
+        switch (state) {
+            case SIZE:
+                if (isxdigit((unsigned char)c)) {
+                    remaining = remaining * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+                    sawDigit = true;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    state = SIZE_EXTENSION;
+                } else if (c == '\r') {
+                    state = SIZE_LF;
+                } else {
+                    malformed = true;
+                }
+                i++;
+                break;
+            case SIZE_EXTENSION:
+                if (c == '\r') state = SIZE_LF;
+                i++;
+                break;
+            case SIZE_LF:
+                if (c != '\n' || !sawDigit) {
+                    malformed = true;
+                } else if (remaining == 0) {
+                    state = TRAILER_START;
+                } else {
+                    state = DATA;
+                }
+                i++;
+                break;
+            case DATA: {
+                size_t take = std::min(remaining, length - i);
+                if (payload) payload->append(data + i, take);
+                remaining -= take;
+                i += take;
+                if (remaining == 0) state = DATA_CR;
+                break;
+            }
+            case DATA_CR:
+                malformed = c != '\r';
+                state = DATA_LF;
+                i++;
+                break;
+            case DATA_LF:
+                malformed = c != '\n';
+                state = SIZE;
+                sawDigit = false;
+                i++;
+                break;
+            case TRAILER_START:
+                state = (c == '\r') ? TRAILER_LF : TRAILER_LINE;
+                i++;
+                break;
+            case TRAILER_LINE:
+                if (c == '\n') state = TRAILER_START;
+                i++;
+                break;
+            case TRAILER_LF:
+                malformed = c != '\n';
+                state = DONE;
+                i++;
+                break;
+            case DONE:
+                break;
+        }
+    }
+    return i;
+}
+
 bool isValidHttpMethod(const std::string method) {
     const std::unordered_set<std::string> validMethods = {"GET", "POST", "PUT", "DELETE", "PATCH", "HEAD", "OPTIONS", "TRACE", "CONNECT"};
 
@@ -183,7 +421,7 @@ std::string ConnectionInfoToString(const ConnectionInfo& connection) {
     std::ostringstream oss;
     oss << "Client IP: " << connection.client.ip << ":" << connection.client.port << "\n";
     oss << "Server IP: " << connection.server.ip << ":" << connection.server.port << "\n";
-    oss << "Time: " << std::ctime(&connection.time) << "\n";
+    oss << "Time: " << formatTimestamp(connection.time) << "\n";
 
     for (size_t i = 0; i < connection.transactions.size(); ++i) {
         const Transaction& transaction = connection.transactions[i];
@@ -216,7 +454,7 @@ void log_connection(ConnectionInfo connection, FILE* f) {
 void log_connection_to_file(ConnectionInfo connection, const char* filename) {
     FILE* f = fopen(filename, "a");
     if (f == NULL) {
-        perror("Error opening file");
+        LOG_ERROR("Error opening file %s: %s", filename, strerror(errno));
         return;
     }
     log_connection(connection, f);
@@ -0,0 +1,224 @@
+#include "../include/listener_handoff.h"
+#include "../include/logger.h"
+
+#if !IS_WINDOWS
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#define HANDOFF_MAX_LISTENERS 4
+static const char HANDOFF_ACK = 'A';
+
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+#if !IS_WINDOWS
+// A directory nobody else can create, replace or look into: $XDG_RUNTIME_DIR, which the session
+// manager sets up that way, or one made here and refused unless it is still exactly that.
+static bool handoffDirectory(std::string& directory) {
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && runtime[0] == '/') {
+        directory = runtime;
+    } else {
+        char path[64];
+        snprintf(path, sizeof(path), HANDOFF_DIR_FORMAT, unsigned(geteuid()));
+        directory = path;
+        if (mkdir(path, 0700) < 0 && errno != EEXIST) return false;
+    }
+
+    struct stat info;
+    if (lstat(directory.c_str(), &info) < 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid() ||
+        (info.st_mode & 077) != 0) {
+        LOG_WARNING("(ListenerHandoff) %s is not a private directory of this user; no handoff", directory.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Empty when there is no safe place for the socket.
+static std::string handoffPath(int port) {
+    std::string directory;
+    if (!handoffDirectory(directory)) return std::string();
+    char path[sizeof(sockaddr_un::sun_path)];
+    if (snprintf(path, sizeof(path), HANDOFF_SOCKET_FORMAT, directory.c_str(), port) >= int(sizeof(path))) {
+        return std::string();
+    }
+    return path;
+}
+
+// Listening sockets only ever go to, or come from, a process of the same user.
+static bool peerIsSameUser(socket_t fd) {
+#if defined(SO_PEERCRED)
+    ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+static sockaddr_un handoffAddress(const std::string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+static void setTimeouts(socket_t fd) {
+    timeval tv;
+    tv.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+    tv.tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+#endif
+
+// ----------------- ListenerHandoff -----------------
+ListenerHandoff::ListenerHandoff() : server_fd(INVALID_SOCKET), serving(false) {}
+
+std::vector<socket_t> ListenerHandoff::takeOver(int port) {
+    std::vector<socket_t> received;
+#if !IS_WINDOWS
+    std::string path = handoffPath(port);
+    if (path.empty()) return received;
+    sockaddr_un address = handoffAddress(path);
+    socket_t fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) return received;
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);          // nobody is running, or a crashed proxy left its path behind
+        return received;
+    }
+    if (!peerIsSameUser(fd)) {
+        LOG_WARNING("(ListenerHandoff::takeOver) %s is served by another user; not taking its listeners", path.c_str());
+        close(fd);
+        return received;
+    }
+    setTimeouts(fd);
+
+    char count = 0;
+    iovec payload = {&count, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_LISTENERS)];
+    msghdr message = {};
+    message.msg_iov = &payload;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &message, 0) == 1) {
+        for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+            size_t fds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* data = (const int*)CMSG_DATA(header);
+            received.assign(data, data + fds);
+        }
+    }
+    // Only an acknowledged handoff makes the old process stop accepting; without it both keep the listeners.
+    if (!received.empty() && (size_t(count) != received.size() || send(fd, &HANDOFF_ACK, 1, SEND_FLAGS) != 1)) {
+        for (socket_t listener : received) close(listener);
+        received.clear();
+    }
+    close(fd);
+#else
+    (void)port;
+#endif
+    return received;
+}
+
+bool ListenerHandoff::offer(int port, std::vector<socket_t> listeners, std::function<void()> onHandedOff) {
+#if !IS_WINDOWS
+    if (serving || listeners.empty() || listeners.size() > HANDOFF_MAX_LISTENERS) return false;
+    std::string path = handoffPath(port);
+    if (path.empty()) return false;
+    sockaddr_un address = handoffAddress(path);
+    // Whoever held the path before has handed off or died; either way it is ours now.
+    unlink(path.c_str());
+    if ((server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET) return false;
+    if (bind(server_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(server_fd, 4) < 0) {
+        LOG_WARNING("(ListenerHandoff::offer) Cannot listen on %s: %s", path.c_str(), socketErrorText().c_str());
+        close(server_fd);
+        server_fd = INVALID_SOCKET;
+        return false;
+    }
+
+    this->listeners = std::move(listeners);
+    handedOff = std::move(onHandedOff);
+    serving = true;
+    std::thread(&ListenerHandoff::serve, this, path).detach();
+    return true;
+#else
+    (void)port;
+    (void)listeners;
+    (void)onHandedOff;
+    return false;
+#endif
+}
+
+void ListenerHandoff::serve(std::string path) {
+#if !IS_WINDOWS
+    // The socket is this thread's to close. close() from another thread would not wake a blocked
+    // accept() on Linux, so the wait is a poll that rechecks `serving`.
+    socket_t listen_fd = server_fd;
+    while (serving) {
+        if (!wait_readable(listen_fd, HANDOFF_TIMEOUT_MS)) continue;
+        socket_t fd = accept(listen_fd, NULL, NULL);
+        if (fd == INVALID_SOCKET) continue;
+        if (!peerIsSameUser(fd)) {
+            LOG_WARNING("A process of another user asked for the listeners; refused");
+            close(fd);
+            continue;
+        }
+        setTimeouts(fd);
+
+        char count = char(listeners.size());
+        iovec payload = {&count, 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_LISTENERS)];
+        memset(control, 0, sizeof(control));
+        msghdr message = {};
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+        memcpy(CMSG_DATA(header), listeners.data(), sizeof(int) * listeners.size());
+
+        char ack = 0;
+        bool acknowledged = sendmsg(fd, &message, SEND_FLAGS) == 1 && recv(fd, &ack, 1, 0) == 1 && ack == HANDOFF_ACK;
+        close(fd);
+        if (!acknowledged) {
+            LOG_WARNING("A replacement process asked for the listeners but did not take them");
+            continue;
+        }
+
+        LOG_INFO("Listeners handed over through %s", path.c_str());
+        serving = false;
+        close(listen_fd);
+        handedOff();
+        return;
+    }
+    close(listen_fd);
+#else
+    (void)path;
+#endif
+}
+
+void ListenerHandoff::withdraw(int port) {
+#if !IS_WINDOWS
+    if (!serving.exchange(false)) return;
+    // Wakes the serving thread's poll where the platform allows; otherwise it notices within
+    // HANDOFF_TIMEOUT_MS, and closes the socket itself. Once handed off the path is the
+    // replacement's, but then `serving` was already false.
+    SHUTDOWN_SOCKET(server_fd);
+    std::string path = handoffPath(port);
+    if (!path.empty()) unlink(path.c_str());
+#else
+    (void)port;
+#endif
+}
@@ -0,0 +1,334 @@
+// Offline load generator for the proxy.
+// Spins up a local origin HTTP server and a local TLS-like echo endpoint on loopback,
+// then drives concurrent HTTP GETs and CONNECT tunnels through a running proxy and
+// reports requests/sec, latency and time-to-first-byte percentiles and relayed bytes/sec.
+//
+// Usage: loadgen [--proxy host:port] [--mode http|connect|mixed] [--concurrency N]
+//                [--duration seconds] [--body-size bytes] [--tunnel-bytes bytes]
+
+#include "../include/cross_platform.h"
+
+#include <atomic>
+
+#define LOADGEN_IO_TIMEOUT_MS 5000      // a worker gives up on a proxy that stops sending or reading for this long
+
+struct LoadConfig {
+    std::string proxyHost = "127.0.0.1";
+    int proxyPort = LISTEN_PORT;
+    std::string mode = "mixed";
+    int concurrency = 16;
+    int duration = 10;
+    size_t bodySize = 16384;
+    size_t tunnelBytes = 65536;
+};
+
+struct WorkerStats {
+    std::vector<double> latencies;      // milliseconds, one per completed request/tunnel
+    std::vector<double> firstBytes;     // milliseconds from connecting until the response head, HTTP only
+    uint64_t bytes = 0;                 // payload bytes received through the proxy
+    uint64_t errors = 0;
+};
+
+static std::atomic<bool> g_running{true};
+
+// ----------------- Socket helpers -----------------
+static socket_t listenLoopback(int& port) {
+    socket_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) {
+        print_socket_error(ANSI_RED "ERROR (loadgen):" ANSI_RESET " Socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+    int opt = 1;
+    SETSOCKOPT(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1024) < 0) {
+        print_socket_error(ANSI_RED "ERROR (loadgen):" ANSI_RESET " Bind/listen failed");
+        exit(EXIT_FAILURE);
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static socket_t connectTo(const std::string& host, int port) {
+    socket_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) return INVALID_SOCKET;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        CLOSE_SOCKET(fd);
+        return INVALID_SOCKET;
+    }
+
+    // A stalled proxy fails the request instead of holding its worker past the end of the run.
+#if IS_WINDOWS
+    DWORD timeout = LOADGEN_IO_TIMEOUT_MS;
+#else
+    timeval timeout;
+    timeout.tv_sec = LOADGEN_IO_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (LOADGEN_IO_TIMEOUT_MS % 1000) * 1000;
+#endif
+    SETSOCKOPT(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    SETSOCKOPT(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static bool sendAll(socket_t fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, 0);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads until the header terminator, leaving any body bytes already received in `head`.
+static bool recvHeaders(socket_t fd, std::string& head) {
+    char buffer[4096];
+    while (head.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) return false;
+        head.append(buffer, n);
+    }
+    return true;
+}
+
+// ----------------- Local origin and echo endpoints -----------------
+static void serveOrigin(socket_t client_fd, const std::string* response) {
+    std::string head;
+    if (recvHeaders(client_fd, head)) {
+        sendAll(client_fd, response->data(), response->size());
+    }
+    CLOSE_SOCKET(client_fd);
+}
+
+// Echoes everything back; the client frames its payload as TLS records so the proxy
+// treats it like an opaque HTTPS tunnel.
+static void serveEcho(socket_t client_fd) {
+    char buffer[BUFFER_SIZE];
+    while (true) {
+        ssize_t n = recv(client_fd, buffer, sizeof(buffer), 0);
+        if (n <= 0 || !sendAll(client_fd, buffer, n)) break;
+    }
+    CLOSE_SOCKET(client_fd);
+}
+
+static void acceptLoop(socket_t server_fd, bool echo, const std::string* response) {
+    while (g_running) {
+        socket_t client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd == INVALID_SOCKET) {
+            if (!g_running) break;
+            continue;
+        }
+        if (echo) {
+            std::thread(serveEcho, client_fd).detach();
+        } else {
+            std::thread(serveOrigin, client_fd, response).detach();
+        }
+    }
+}
+
+// ----------------- Clients -----------------
+static bool runHttpRequest(const LoadConfig& cfg, int originPort, WorkerStats& stats) {
+    auto begin = std::chrono::steady_clock::now();
+    socket_t fd = connectTo(cfg.proxyHost, cfg.proxyPort);
+    if (fd == INVALID_SOCKET) return false;
+
+    std::string target = "127.0.0.1:" + std::to_string(originPort);
+    std::string request = "GET http://" + target + "/object HTTP/1.1\r\n"
+                          "Host: " + target + "\r\n"
+                          "Connection: close\r\n\r\n";
+    std::string head;
+    bool ok = sendAll(fd, request.data(), request.size()) && recvHeaders(fd, head)
+              && head.compare(0, 12, "HTTP/1.1 200") == 0;
+
+    if (ok) {
+        stats.firstBytes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+        size_t received = head.size() - (head.find("\r\n\r\n") + 4);
+        char buffer[BUFFER_SIZE];
+        while (received < cfg.bodySize) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) break;
+            received += n;
+        }
+        ok = received >= cfg.bodySize;
+        stats.bytes += received;
+    }
+    CLOSE_SOCKET(fd);
+    return ok;
+}
+
+static bool runTunnel(const LoadConfig& cfg, int echoPort, WorkerStats& stats) {
+    socket_t fd = connectTo(cfg.proxyHost, cfg.proxyPort);
+    if (fd == INVALID_SOCKET) return false;
+
+    std::string target = "127.0.0.1:" + std::to_string(echoPort);
+    std::string request = "CONNECT " + target + " HTTP/1.1\r\n"
+                          "Host: " + target + "\r\n\r\n";
+    std::string head;
+    bool ok = sendAll(fd, request.data(), request.size()) && recvHeaders(fd, head)
+              && head.find(" 200 ") != std::string::npos;
+
+    // One TLS application-data-looking record at a time, each echoed back before the next.
+    char record[16384];
+    memset(record, 'x', sizeof(record));
+    record[0] = 0x17;
+    record[1] = 0x03;
+    size_t sent = 0;
+    while (ok && sent < cfg.tunnelBytes) {
+        size_t chunk = std::min(sizeof(record), cfg.tunnelBytes - sent);
+        if (!sendAll(fd, record, chunk)) {
+            ok = false;
+            break;
+        }
+        size_t echoed = 0;
+        char buffer[sizeof(record)];
+        while (echoed < chunk) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            echoed += n;
+        }
+        sent += chunk;
+        stats.bytes += echoed;
+    }
+    CLOSE_SOCKET(fd);
+    return ok;
+}
+
+static void worker(int id, const LoadConfig& cfg, int originPort, int echoPort, WorkerStats& stats) {
+    bool tunnel = cfg.mode == "connect" || (cfg.mode == "mixed" && id % 2 == 1);
+    while (g_running) {
+        auto begin = std::chrono::steady_clock::now();
+        bool ok = tunnel ? runTunnel(cfg, echoPort, stats) : runHttpRequest(cfg, originPort, stats);
+        auto end = std::chrono::steady_clock::now();
+        if (!g_running) break;
+
+        if (ok) {
+            stats.latencies.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+        } else {
+            stats.errors++;
+        }
+    }
+}
+
+// ----------------- Reporting -----------------
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t index = std::min(sorted.size() - 1, size_t(p * (sorted.size() - 1) + 0.5));
+    return sorted[index];
+}
+
+static void report(const LoadConfig& cfg, const std::vector<WorkerStats>& stats, double elapsed) {
+    std::vector<double> latencies, firstBytes;
+    uint64_t bytes = 0, errors = 0;
+    for (const auto& s : stats) {
+        latencies.insert(latencies.end(), s.latencies.begin(), s.latencies.end());
+        firstBytes.insert(firstBytes.end(), s.firstBytes.begin(), s.firstBytes.end());
+        bytes += s.bytes;
+        errors += s.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(firstBytes.begin(), firstBytes.end());
+
+    printf(ANSI_GREEN "Load test finished" ANSI_RESET " (mode=%s, concurrency=%d, %.1fs)\n",
+           cfg.mode.c_str(), cfg.concurrency, elapsed);
+    printf("  completed : %zu\n", latencies.size());
+    printf("  errors    : %llu\n", (unsigned long long)errors);
+    printf("  rps       : %.1f\n", latencies.size() / elapsed);
+    printf("  latency   : p50 %.3f ms | p99 %.3f ms | p999 %.3f ms\n",
+           percentile(latencies, 0.50), percentile(latencies, 0.99), percentile(latencies, 0.999));
+    if (!firstBytes.empty()) {
+        printf("  ttfb      : p50 %.3f ms | p99 %.3f ms | p999 %.3f ms\n",
+               percentile(firstBytes, 0.50), percentile(firstBytes, 0.99), percentile(firstBytes, 0.999));
+    }
+    printf("  throughput: %.2f MiB/s\n", bytes / elapsed / (1024.0 * 1024.0));
+}
+
+static bool parseArgs(int argc, char** argv, LoadConfig& cfg) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i], value = argv[i + 1];
+        if (key == "--proxy") {
+            size_t pos = value.rfind(':');
+            if (pos == std::string::npos) return false;
+            cfg.proxyHost = value.substr(0, pos);
+            cfg.proxyPort = std::stoi(value.substr(pos + 1));
+        } else if (key == "--mode") {
+            cfg.mode = value;
+        } else if (key == "--concurrency") {
+            cfg.concurrency = std::max(1, std::stoi(value));
+        } else if (key == "--duration") {
+            cfg.duration = std::max(1, std::stoi(value));
+        } else if (key == "--body-size") {
+            cfg.bodySize = std::stoul(value);
+        } else if (key == "--tunnel-bytes") {
+            cfg.tunnelBytes = std::stoul(value);
+        } else {
+            return false;
+        }
+    }
+    return (argc % 2 == 1) && (cfg.mode == "http" || cfg.mode == "connect" || cfg.mode == "mixed");
+}
+
+int main(int argc, char** argv) {
+    LoadConfig cfg;
+    try {
+        if (!parseArgs(argc, argv, cfg)) throw std::invalid_argument("bad arguments");
+    } catch (const std::exception&) {
+        fprintf(stderr, "Usage: %s [--proxy host:port] [--mode http|connect|mixed] [--concurrency N]\n"
+                        "       [--duration seconds] [--body-size bytes] [--tunnel-bytes bytes]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    INIT_SOCKET();
+#if !IS_WINDOWS
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    std::string response = "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: application/octet-stream\r\n"
+                           "Content-Length: " + std::to_string(cfg.bodySize) + "\r\n"
+                           "Connection: close\r\n\r\n" + std::string(cfg.bodySize, 'a');
+
+    int originPort = 0, echoPort = 0;
+    socket_t origin_fd = listenLoopback(originPort);
+    socket_t echo_fd = listenLoopback(echoPort);
+    std::thread(acceptLoop, origin_fd, false, &response).detach();
+    std::thread(acceptLoop, echo_fd, true, nullptr).detach();
+
+    printf("Origin on 127.0.0.1:%d, echo on 127.0.0.1:%d, proxy at %s:%d\n",
+           originPort, echoPort, cfg.proxyHost.c_str(), cfg.proxyPort);
+
+    std::vector<WorkerStats> stats(cfg.concurrency);
+    std::vector<std::thread> workers;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < cfg.concurrency; i++) {
+        workers.emplace_back(worker, i, std::cref(cfg), originPort, echoPort, std::ref(stats[i]));
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(cfg.duration));
+    g_running = false;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    // Workers finish their current request, which LOADGEN_IO_TIMEOUT_MS bounds on a stalled proxy.
+    CLOSE_SOCKET(origin_fd);
+    CLOSE_SOCKET(echo_fd);
+    for (auto& t : workers) t.join();
+
+    report(cfg, stats, elapsed);
+    CLEANUP_SOCKET();
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "../include/logger.h"
+
+#include <cstdarg>
+#include <system_error>
+
+static const char* LEVEL_TAGS[] = {
+    "DEBUG ",
+    ANSI_GREEN "INFO  " ANSI_RESET,
+    ANSI_YELLOW "WARN  " ANSI_RESET,
+    ANSI_RED "ERROR " ANSI_RESET,
+};
+
+// ----------------- Utils -----------------
+std::string formatTimestamp(std::time_t time) {
+    std::tm local;
+#if IS_WINDOWS
+    localtime_s(&local, &time);
+#else
+    localtime_r(&time, &local);
+#endif
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    return text;
+}
+
+std::string socketErrorText() {
+#if IS_WINDOWS
+    int code = WSAGetLastError();
+    return std::to_string(code) + " " + std::system_category().message(code);
+#else
+    return std::generic_category().message(errno);
+#endif
+}
+
+// The timestamp only changes once a second, so each thread reformats it at most that often.
+static const std::string& cachedTimestamp() {
+    thread_local std::time_t cachedSecond = 0;
+    thread_local std::string cachedText;
+
+    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    if (now != cachedSecond) {
+        cachedSecond = now;
+        cachedText = formatTimestamp(now);
+    }
+    return cachedText;
+}
+
+// ----------------- LogRateLimiter -----------------
+bool LogRateLimiter::allow(uint32_t& suppressedBefore) {
+    int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+                         std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t current = window.load(std::memory_order_relaxed);
+    if (current != second && window.compare_exchange_strong(current, second, std::memory_order_relaxed)) {
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    if (count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_PER_SECOND) {
+        suppressedBefore = suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+    suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+// ----------------- Logger -----------------
+Logger::Logger() : queue(), dropped(0), running(true), writing(false) {
+    writer = std::thread(&Logger::writeLoop, this);
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        running = false;
+    }
+    queue_cv.notify_one();
+    if (writer.joinable()) writer.join();
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+void Logger::log(LogLevel level, uint32_t suppressed, const char* format, ...) {
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    std::string line;
+    line.reserve(64 + strlen(message));
+    line += "[ ";
+    line += cachedTimestamp();
+    line += " ] ";
+    line += LEVEL_TAGS[level];
+    line += message;
+    if (suppressed > 0) {
+        line += " (" + std::to_string(suppressed) + " similar messages suppressed)";
+    }
+    line += '\n';
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (queue.size() >= LOG_QUEUE_CAPACITY) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        queue.push_back(std::move(line));
+    }
+    queue_cv.notify_one();
+}
+
+void Logger::flush() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    idle_cv.wait_for(lock, std::chrono::seconds(1), [this] { return queue.empty() && !writing; });
+}
+
+// Single writer thread: callers only format and enqueue, so stderr never serialises workers.
+void Logger::writeLoop() {
+    std::vector<std::string> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return !queue.empty() || !running; });
+            if (queue.empty() && !running) break;
+            batch.swap(queue);
+            writing = true;
+        }
+
+        for (const auto& line : batch) {
+            fwrite(line.data(), 1, line.size(), stderr);
+        }
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost > 0) {
+            fprintf(stderr, "[ %s ] " ANSI_YELLOW "WARN  " ANSI_RESET "Logger queue full, %llu messages dropped\n",
+                    cachedTimestamp().c_str(), (unsigned long long)lost);
+        }
+        fflush(stderr);
+        batch.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            writing = false;
+        }
+        idle_cv.notify_all();
+    }
+}
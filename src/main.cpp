@@ -15,22 +15,31 @@ int main() {
 
     Proxy proxy(8080);
     
-    Table connectionRecord(50, 200, 800, 500, proxy.connections, customFont);
-
-    NameList blockedDomain(domainFile, 950, 350, 600, 200, proxy.BLACK_LIST.domains, customFont, "Blocked Domain List");
-    NameList blockedIp(ipFile, 950, 125, 600, 200, proxy.BLACK_LIST.ips, customFont, "Blocked IP List");
+    std::vector<ConnectionInfo> recentConnections;
+    uint64_t recentVersion = 0;
+    Table connectionRecord(50, 200, 800, 500, recentConnections, customFont);
+    // Shown instead of the finished ones while the view button is on.
+    ConnectionMonitor openConnections(50, 200, 800, 500, [&proxy]() { return proxy.openConnections(); },
+                                      [&proxy](ConnectionId id) { proxy.closeConnection(id); }, customFont);
+
+    NameList blockedDomain(domainFile, 950, 350, 600, 200, proxy.BLACK_LIST.domains, customFont, "Blocked Domain List", 20, 5.0f,
+                           [&proxy]() { proxy.BLACK_LIST.rebuild(); });
+    NameList blockedIp(ipFile, 950, 125, 600, 200, proxy.BLACK_LIST.ips, customFont, "Blocked IP List", 20, 5.0f,
+                       [&proxy]() { proxy.BLACK_LIST.rebuild(); });
 
     InputFieldWithButton portButton(150, 135, 100, 30, "Change Port", 300, 130, 150, 40, customFont); 
     portButton.SetText(std::to_string(proxy.getPort()));
 
     ToggleButton startButton(550, 125, 200, 50, "Stop Proxy", "Start Proxy", 20, 10.0f, customFont, PRIMARY_BUTTON_COLOR, PRIMARY_HOVERED_BUTTON_COLOR, PRESS_COLOR, WHITE, WHITE);
+    ToggleButton viewButton(770, 135, 80, 30, "History", "Live", 20, 10.0f, customFont, NORMAL_BUTTON_COLOR, SECONDARY_HOVERED_BUTTON_COLOR, PRESS_COLOR, WHITE, WHITE);
 
 
     TextBox Usage(950, 600, 600, 275, readFile("asset/instruction.txt"), customFont);
     TextBox dev(50, 725, 800, 150, readFile("asset/project-creator.txt"), customFont);
     SetTargetFPS(60);
 
-    while (!WindowShouldClose()) {
+    // Ends too once a newly started proxy took the port over and this one has drained.
+    while (!WindowShouldClose() && !proxy.isRetired()) {
         blockedDomain.Update();
         blockedIp.Update();
 
@@ -38,7 +47,13 @@ int main() {
             proxy.setPort(std::stoi(portButton.GetInputText()));
         }
 
-        connectionRecord.Update(proxy.connections);
+        viewButton.Update();
+        if (viewButton.GetState()) {
+            openConnections.Update();
+        } else {
+            proxy.recentConnections(recentConnections, recentVersion);
+            connectionRecord.Update(recentConnections);
+        }
         Usage.Update();
         
         int flag = startButton.Update() ;
@@ -61,14 +76,17 @@ int main() {
         startButton.Draw();
 
 
-        connectionRecord.Draw();
+        viewButton.Draw();
+        if (viewButton.GetState()) {
+            openConnections.Draw();
+        } else {
+            connectionRecord.Draw();
+        }
 
         EndDrawing();
     }
 
-    for (auto& fd : proxy.file_descriptors) {
-        if (fd != INVALID_SOCKET) CLOSE_SOCKET(fd);
-    }
+    proxy.closeAllConnections();
     UnloadFont(customFont);
     CloseWindow();
     return 0;
@@ -0,0 +1,310 @@
+#include "../include/metrics.h"
+
+static const char* COUNTER_NAMES[METRIC_COUNTER_COUNT][3] = {
+    {"proxy_connections_accepted_total", "counter", "Client connections accepted."},
+    {"proxy_connections_active", "gauge", "Client connections currently being handled."},
+    {"proxy_requests_blocked_total", "counter", "Requests refused by the domain/IP blocklist."},
+    {"proxy_connection_errors_total", "counter", "Connections that ended with an error."},
+    {"proxy_bytes_client_to_server_total", "counter", "Bytes relayed from clients to upstream servers."},
+    {"proxy_bytes_server_to_client_total", "counter", "Bytes relayed from upstream servers to clients."},
+    {"proxy_cache_hits_total", "counter", "Cacheable requests answered from the cache."},
+    {"proxy_cache_misses_total", "counter", "Cacheable requests forwarded to the origin."},
+    {"proxy_cache_hit_bytes_total", "counter", "Response bytes served from the cache."},
+    {"proxy_cache_miss_bytes_total", "counter", "Response bytes of cacheable requests fetched from the origin."},
+    {"proxy_disk_cache_hits_total", "counter", "Cache hits answered from the disk tier (included in proxy_cache_hits_total)."},
+    {"proxy_cache_revalidated_total", "counter", "Stale entries refreshed by a 304 from the origin."},
+    {"proxy_cache_stale_served_total", "counter", "Stale entries served while revalidating or instead of an origin error."},
+    {"proxy_collapsed_requests_total", "counter", "Requests answered by replaying another request's in-flight origin fetch."},
+    {"proxy_compressed_responses_total", "counter", "Responses gzip-compressed on the way to the client."},
+    {"proxy_compression_skipped_total", "counter", "Compressible responses passed through because the compression workers were saturated."},
+    {"proxy_compression_bytes_in_total", "counter", "Body bytes fed to the response compressor."},
+    {"proxy_compression_bytes_out_total", "counter", "Compressed bytes produced by the response compressor."},
+    {"proxy_connections_rejected_total", "counter", "Connections turned away with 503 by admission control."},
+    {"proxy_accept_paused", "gauge", "1 while accepting is paused because fd or memory usage is too high."},
+    {"proxy_transfers_throttled_total", "counter", "Times a tunnel was held back by bandwidth shaping."},
+    {"proxy_parent_retries_total", "counter", "Requests tried again on another parent proxy."},
+    {"proxy_parent_ejections_total", "counter", "Times a parent proxy was ejected after repeated failures."},
+};
+
+// Ratios derived from pairs of counters, rendered as gauges.
+static const struct {
+    const char* name;
+    const char* help;
+    MetricCounter numerator;
+    MetricCounter other;
+} RATIO_GAUGES[] = {
+    {"proxy_cache_hit_ratio", "Fraction of cacheable requests served from the cache.", METRIC_CACHE_HITS, METRIC_CACHE_MISSES},
+    {"proxy_cache_byte_hit_ratio", "Fraction of cacheable response bytes served from the cache.", METRIC_CACHE_HIT_BYTES, METRIC_CACHE_MISS_BYTES},
+};
+
+static const char* HISTOGRAM_NAMES[METRIC_HISTOGRAM_COUNT][2] = {
+    {"proxy_accept_seconds", "Delay between accept() and the connection handler starting."},
+    {"proxy_dns_seconds", "Upstream host name resolution time."},
+    {"proxy_connect_seconds", "Upstream TCP connect time."},
+    {"proxy_time_to_first_byte_seconds", "Time from accept() to the first byte received from upstream."},
+    {"proxy_connection_duration_seconds", "Total lifetime of a client connection."},
+};
+
+// Prometheus bucket bounds (seconds) exported from the fine-grained internal buckets.
+static const double EXPORT_BOUNDS[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+                                       0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+
+// ----------------- LatencyHistogram -----------------
+int LatencyHistogram::bucketIndex(uint64_t micros) {
+    if (micros < (uint64_t)SUB_BUCKETS) return (int)micros;
+    if (micros >= (1ULL << MAX_MAGNITUDE)) micros = (1ULL << MAX_MAGNITUDE) - 1;
+
+    int magnitude = 63 - __builtin_clzll(micros);
+    int shift = magnitude - SUB_BUCKET_BITS;
+    int mantissa = (int)(micros >> shift) - SUB_BUCKETS;
+    return (shift + 1) * SUB_BUCKETS + mantissa;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int index) {
+    if (index < SUB_BUCKETS) return index;
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t mantissa = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+    buckets[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(micros, std::memory_order_relaxed);
+}
+
+// ----------------- MetricsRegistry -----------------
+// Returns the shard to the pool when its owning thread exits. The counts stay in the shard,
+// so totals remain monotonic when another thread picks it up.
+struct ShardLease {
+    MetricsRegistry::Shard* shard = nullptr;
+    ~ShardLease() {
+        if (shard) MetricsRegistry::instance().releaseShard(shard);
+    }
+};
+
+MetricsRegistry::MetricsRegistry() {
+    for (auto& shard : shards) {
+        for (auto& counter : shard.counters) counter.store(0, std::memory_order_relaxed);
+        for (auto& histogram : shard.histograms) {
+            for (auto& bucket : histogram.buckets) bucket.store(0, std::memory_order_relaxed);
+            histogram.count.store(0, std::memory_order_relaxed);
+            histogram.sum.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Shard& MetricsRegistry::localShard() {
+    thread_local ShardLease lease;
+    if (!lease.shard) {
+        for (int i = 0; i < MAX_SHARDS; i++) {
+            bool expected = false;
+            if (shards[i].inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                lease.shard = &shards[i];
+                break;
+            }
+        }
+        if (!lease.shard) return shards[MAX_SHARDS];
+    }
+    return *lease.shard;
+}
+
+void MetricsRegistry::releaseShard(Shard* shard) {
+    shard->inUse.store(false, std::memory_order_release);
+}
+
+void MetricsRegistry::increment(MetricCounter counter, int64_t value) {
+    localShard().counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void MetricsRegistry::record(MetricHistogram histogram, std::chrono::steady_clock::duration elapsed) {
+    int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    localShard().histograms[histogram].record(micros < 0 ? 0 : (uint64_t)micros);
+}
+
+int64_t MetricsRegistry::counterValue(MetricCounter counter) const {
+    int64_t total = 0;
+    for (const auto& shard : shards) {
+        total += shard.counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::string MetricsRegistry::renderPrometheus() const {
+    std::ostringstream out;
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        out << "# HELP " << COUNTER_NAMES[c][0] << " " << COUNTER_NAMES[c][2] << "\n";
+        out << "# TYPE " << COUNTER_NAMES[c][0] << " " << COUNTER_NAMES[c][1] << "\n";
+        out << COUNTER_NAMES[c][0] << " " << counterValue((MetricCounter)c) << "\n";
+    }
+
+    for (const auto& ratio : RATIO_GAUGES) {
+        int64_t numerator = counterValue(ratio.numerator);
+        int64_t total = numerator + counterValue(ratio.other);
+        out << "# HELP " << ratio.name << " " << ratio.help << "\n";
+        out << "# TYPE " << ratio.name << " gauge\n";
+        out << ratio.name << " " << (total > 0 ? (double)numerator / total : 0.0) << "\n";
+    }
+
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        std::vector<uint64_t> merged(LatencyHistogram::BUCKET_COUNT, 0);
+        uint64_t count = 0, sum = 0;
+        for (const auto& shard : shards) {
+            const LatencyHistogram& histogram = shard.histograms[h];
+            for (int b = 0; b < LatencyHistogram::BUCKET_COUNT; b++) {
+                merged[b] += histogram.buckets[b].load(std::memory_order_relaxed);
+            }
+            count += histogram.count.load(std::memory_order_relaxed);
+            sum += histogram.sum.load(std::memory_order_relaxed);
+        }
+
+        const char* name = HISTOGRAM_NAMES[h][0];
+        out << "# HELP " << name << " " << HISTOGRAM_NAMES[h][1] << "\n";
+        out << "# TYPE " << name << " histogram\n";
+
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (double bound : EXPORT_BOUNDS) {
+            uint64_t boundMicros = (uint64_t)(bound * 1e6);
+            while (b < LatencyHistogram::BUCKET_COUNT && LatencyHistogram::bucketUpperBound(b) <= boundMicros) {
+                cumulative += merged[b++];
+            }
+            out << name << "_bucket{le=\"" << bound << "\"} " << cumulative << "\n";
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << count << "\n";
+        out << name << "_sum " << sum / 1e6 << "\n";
+        out << name << "_count " << count << "\n";
+
+        // Exact-bucket quantiles, which the coarse exported buckets cannot provide. A histogram family
+        // may not carry them, so they get a summary family of their own.
+        std::string summary = std::string(name) + "_summary";
+        out << "# HELP " << summary << " " << HISTOGRAM_NAMES[h][1] << " Quantiles from the internal buckets.\n";
+        out << "# TYPE " << summary << " summary\n";
+        const double quantiles[] = {0.5, 0.99, 0.999};
+        for (double q : quantiles) {
+            uint64_t rank = (uint64_t)(q * count), seen = 0;
+            uint64_t value = 0;
+            for (int i = 0; i < LatencyHistogram::BUCKET_COUNT && count > 0; i++) {
+                seen += merged[i];
+                if (seen > rank) {
+                    value = LatencyHistogram::bucketUpperBound(i);
+                    break;
+                }
+            }
+            out << summary << "{quantile=\"" << q << "\"} " << value / 1e6 << "\n";
+        }
+        out << summary << "_sum " << sum / 1e6 << "\n";
+        out << summary << "_count " << count << "\n";
+    }
+    return out.str();
+}
+
+// ----------------- MetricsServer -----------------
+MetricsServer::MetricsServer(int port) : port(port), server_fd(INVALID_SOCKET), running(false) {}
+
+bool MetricsServer::start(socket_t inherited) {
+    if (running) return true;
+
+    if (inherited != INVALID_SOCKET) {
+        server_fd = inherited;
+        running = true;
+        std::thread(&MetricsServer::serve, this).detach();
+        return true;
+    }
+
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET) {
+        print_socket_error(ANSI_RED "ERROR (MetricsServer::start):" ANSI_RESET " Socket creation failed");
+        return false;
+    }
+
+    int opt = 1;
+    SETSOCKOPT(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = htons(port);
+
+    if (bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0 || listen(server_fd, 16) < 0) {
+        print_socket_error(ANSI_RED "ERROR (MetricsServer::start):" ANSI_RESET " Bind/listen failed");
+        CLOSE_SOCKET(server_fd);
+        server_fd = INVALID_SOCKET;
+        return false;
+    }
+
+    running = true;
+    std::thread(&MetricsServer::serve, this).detach();
+    return true;
+}
+
+void MetricsServer::stop() {
+    running = false;
+    // Released rather than shut down: a replacement process may be serving on it too.
+    if (server_fd != INVALID_SOCKET) {
+        RELEASE_SOCKET(server_fd);
+        server_fd = INVALID_SOCKET;
+    }
+}
+
+int MetricsServer::getPort() const {
+    return port;
+}
+
+socket_t MetricsServer::getListener() const {
+    return server_fd;
+}
+
+void MetricsServer::serve() {
+    socket_t listen_fd = server_fd;
+    // Polled, since releasing the listener in stop() does not wake a blocked accept().
+    set_socket_blocking(listen_fd, false);
+    while (running && listen_fd == server_fd) {
+        if (!wait_readable(listen_fd, 500)) continue;
+        socket_t client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd == INVALID_SOCKET) {
+            if (!running || listen_fd != server_fd) break;
+            continue;
+        }
+        set_socket_blocking(client_fd, true);
+        // Scrapes are rare and cheap to render, so they are answered inline.
+        handleScrape(client_fd);
+    }
+}
+
+void MetricsServer::handleScrape(socket_t client_fd) {
+    char buffer[1024];
+    // Scrapes are answered one at a time, so a client that connects and says nothing must not hold up the rest.
+    ssize_t bytes_read = wait_readable(client_fd, METRICS_SCRAPE_TIMEOUT_MS) ? recv(client_fd, buffer, sizeof(buffer) - 1, 0) : -1;
+    if (bytes_read <= 0) {
+        CLOSE_SOCKET(client_fd);
+        return;
+    }
+    buffer[bytes_read] = '\0';
+
+    std::string response;
+    if (strncmp(buffer, "GET /metrics ", 13) == 0) {
+        std::string body = MetricsRegistry::instance().renderPrometheus();
+        response = "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                   "Connection: close\r\n\r\n" + body;
+    } else {
+        response = "HTTP/1.1 404 Not Found\r\n"
+                   "Content-Length: 0\r\n"
+                   "Connection: close\r\n\r\n";
+    }
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(client_fd, response.data() + sent, response.size() - sent, 0);
+        if (n <= 0) break;
+        sent += n;
+    }
+    CLOSE_SOCKET(client_fd);
+}
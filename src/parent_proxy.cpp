@@ -0,0 +1,260 @@
+#include "../include/parent_proxy.h"
+#include "../include/http_parser.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+
+static int64_t steadyMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// FNV-1a rather than std::hash, so every proxy in front of the same parents, whatever it was
+// built with, sends a host to the same one.
+static uint64_t ringHash(const std::string& key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    // FNV alone leaves keys differing only at the end close together on the ring.
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// The host a request is for, without its port and lower-cased, as routes and the ring see it.
+static std::string hostKey(const std::string& host) {
+    std::string key = host[0] == '[' ? host.substr(0, host.find(']') + 1) : host.substr(0, host.find(':'));
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    return key;
+}
+
+// ----------------- ParentProxy -----------------
+ParentProxy::ParentProxy(const std::string& host, int port, int weight)
+    : name(host + ":" + std::to_string(port)), host(host), port(port), weight(weight), address(), resolved(false), up(true),
+      checkStreak(0), failures(0), ejectedUntil(0) {}
+
+bool ParentProxy::available() const {
+    return up && steadyMillis() >= ejectedUntil;
+}
+
+bool ParentProxy::getAddress(sockaddr_in& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out = address;
+    return resolved;
+}
+
+bool ParentProxy::resolve() {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 || !found) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    address = *(sockaddr_in*)found->ai_addr;
+    resolved = true;
+    freeaddrinfo(found);
+    return true;
+}
+
+// ----------------- ParentPool -----------------
+void ParentPool::buildRing() {
+    ring.clear();
+    for (size_t i = 0; i < parents.size(); i++) {
+        for (int point = 0; point < PARENT_VIRTUAL_NODES * parents[i]->weight; point++) {
+            ring.push_back({ringHash(parents[i]->name + "#" + std::to_string(point)), i});
+        }
+    }
+    std::sort(ring.begin(), ring.end());
+}
+
+// ----------------- ParentRouter -----------------
+ParentRouter::ParentRouter() : fallback(nullptr), checking(false) {}
+
+ParentRouter::~ParentRouter() {
+    stop();
+}
+
+void ParentRouter::load(const char* file) {
+    std::ifstream in(file);
+    if (!in.is_open()) return;
+
+    std::unordered_map<std::string, ParentPool*> byName;
+    std::vector<std::pair<std::string, std::string>> routeLines;    // domain, pool name
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        trimNewlineChars(line);
+        std::istringstream fields(line);
+        std::string keyword, pool, target;
+        if (!(fields >> keyword) || keyword[0] == '#') continue;
+        if (!(fields >> pool >> target)) {
+            LOG_WARNING("(ParentRouter::load) %s:%d: expected \"%s <pool> <target>\"", file, lineNumber, keyword.c_str());
+            continue;
+        }
+
+        if (keyword == "route") {
+            routeLines.push_back({hostKey(target), pool});
+        } else if (keyword == "parent") {
+            size_t colon = target.rfind(':');
+            int port = 0;
+            int weight = 1;
+            try {
+                if (colon != std::string::npos) port = std::stoi(target.substr(colon + 1));
+                std::string extra;
+                if (fields >> extra) weight = std::stoi(extra);
+            } catch (const std::exception&) {}
+            if (port <= 0 || port > 65535 || weight <= 0 || pool == "direct") {
+                LOG_WARNING("(ParentRouter::load) %s:%d: bad parent %s", file, lineNumber, line.c_str());
+                continue;
+            }
+            ParentPool*& found = byName[pool];
+            if (!found) {
+                pools.push_back(std::make_unique<ParentPool>());
+                found = pools.back().get();
+                found->name = pool;
+            }
+            found->parents.push_back(std::make_shared<ParentProxy>(target.substr(0, colon), port, weight));
+        } else {
+            LOG_WARNING("(ParentRouter::load) %s:%d: unknown keyword %s", file, lineNumber, keyword.c_str());
+        }
+    }
+
+    for (auto& [domain, pool] : routeLines) {
+        auto found = byName.find(pool);
+        if (pool != "direct" && found == byName.end()) {
+            LOG_WARNING("(ParentRouter::load) Route for %s names unknown pool %s", domain.c_str(), pool.c_str());
+            continue;
+        }
+        domain_routes.push_back({domain, pool == "direct" ? nullptr : found->second});
+    }
+    auto defaultPool = byName.find("default");
+    fallback = defaultPool == byName.end() ? nullptr : defaultPool->second;
+
+    size_t parentCount = 0;
+    for (auto& pool : pools) {
+        pool->buildRing();
+        for (auto& parent : pool->parents) {
+            if (!parent->resolve()) LOG_WARNING("(ParentRouter::load) Cannot resolve parent %s yet", parent->name.c_str());
+        }
+        parentCount += pool->parents.size();
+    }
+    LOG_INFO("Loaded %zu parent proxies in %zu pools and %zu routes from %s", parentCount, pools.size(), domain_routes.size(), file);
+}
+
+ParentPool* ParentRouter::poolFor(const std::string& host) const {
+    if (pools.empty() || host.empty()) return nullptr;
+    std::string key = hostKey(host);
+    for (const auto& [domain, pool] : domain_routes) {
+        bool matches = domain == "*" || key == domain ||
+                       (key.size() > domain.size() && key.compare(key.size() - domain.size(), domain.size(), domain) == 0 &&
+                        key[key.size() - domain.size() - 1] == '.');
+        if (matches) return pool;
+    }
+    return fallback;
+}
+
+bool ParentRouter::routes(const std::string& host) const {
+    return poolFor(host) != nullptr;
+}
+
+std::vector<std::shared_ptr<ParentProxy>> ParentRouter::candidates(const std::string& host) const {
+    std::vector<std::shared_ptr<ParentProxy>> available;
+    std::vector<std::shared_ptr<ParentProxy>> all;
+    ParentPool* pool = poolFor(host);
+    if (!pool) return available;
+
+    // Clockwise from the host's point, each parent once, in the order its first point comes up.
+    std::vector<bool> seen(pool->parents.size(), false);
+    auto start = std::lower_bound(pool->ring.begin(), pool->ring.end(), std::make_pair(ringHash(hostKey(host)), size_t(0)));
+    size_t first = size_t(start - pool->ring.begin());
+    for (size_t step = 0; step < pool->ring.size() && all.size() < pool->parents.size(); step++) {
+        size_t index = pool->ring[(first + step) % pool->ring.size()].second;
+        if (seen[index]) continue;
+        seen[index] = true;
+        const std::shared_ptr<ParentProxy>& parent = pool->parents[index];
+        all.push_back(parent);
+        if (parent->available() && available.size() < PARENT_MAX_ATTEMPTS) available.push_back(parent);
+    }
+    if (available.empty() && all.size() > PARENT_MAX_ATTEMPTS) all.resize(PARENT_MAX_ATTEMPTS);
+    return available.empty() ? all : available;
+}
+
+void ParentRouter::reportSuccess(ParentProxy& parent) {
+    parent.failures = 0;
+}
+
+void ParentRouter::reportFailure(ParentProxy& parent) {
+    if (++parent.failures < PARENT_MAX_FAILS) return;
+    // Back after the ejection it is on probation: one more failure sends it away again.
+    parent.failures = PARENT_MAX_FAILS - 1;
+    parent.ejectedUntil = steadyMillis() + PARENT_EJECT_MS;
+    MetricsRegistry::instance().increment(METRIC_PARENT_EJECTIONS);
+    LOG_WARNING("Parent proxy %s ejected for %d ms after repeated failures", parent.name.c_str(), PARENT_EJECT_MS);
+}
+
+void ParentRouter::start() {
+    if (pools.empty() || checker.joinable()) return;
+    checking = true;
+    checker = std::thread(&ParentRouter::checkLoop, this);
+}
+
+void ParentRouter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(checker_mutex);
+        checking = false;
+    }
+    checker_wake.notify_all();
+    if (checker.joinable()) checker.join();
+}
+
+// A check is a TCP connect within PARENT_HEALTH_TIMEOUT_MS: it costs the parent nothing and,
+// unlike a request, never makes the parent reach out to an origin.
+static bool probe(ParentProxy& parent) {
+    sockaddr_in address;
+    if (!parent.getAddress(address) && !(parent.resolve() && parent.getAddress(address))) return false;
+    socket_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) return false;
+
+    set_socket_blocking(fd, false);
+    bool connected = connect(fd, (const sockaddr*)&address, sizeof(address)) == 0;
+    if (!connected && (socket_would_block() || SOCKET_ERROR_CODE == EINPROGRESS)) {
+        pollfd watched = {};
+        watched.fd = fd;
+        watched.events = POLLOUT;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        connected = POLL_SOCKETS(&watched, 1, PARENT_HEALTH_TIMEOUT_MS) > 0 &&
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == 0 && error == 0;
+    }
+    CLOSE_SOCKET(fd);
+    return connected;
+}
+
+void ParentRouter::checkLoop() {
+    std::unique_lock<std::mutex> lock(checker_mutex);
+    while (checking) {
+        lock.unlock();
+        for (auto& pool : pools) {
+            for (auto& parent : pool->parents) {
+                bool passed = probe(*parent);
+                if (passed == parent->up) {
+                    parent->checkStreak = 0;
+                    continue;
+                }
+                if (++parent->checkStreak < (passed ? PARENT_HEALTH_RISE : PARENT_HEALTH_FALL)) continue;
+                parent->checkStreak = 0;
+                parent->up = passed;
+                if (passed) {
+                    LOG_INFO("Parent proxy %s is up again", parent->name.c_str());
+                } else {
+                    LOG_WARNING("Parent proxy %s is down", parent->name.c_str());
+                }
+            }
+        }
+        lock.lock();
+        checker_wake.wait_for(lock, std::chrono::milliseconds(PARENT_HEALTH_INTERVAL_MS), [this]() { return !checking; });
+    }
+}
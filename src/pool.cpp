@@ -0,0 +1,140 @@
+#include "../include/pool.h"
+
+const size_t BufferPool::CLASS_SIZES[BufferPool::CLASS_COUNT] = {4096, 16384, 65536};
+
+static const size_t BUFFER_CACHE_LIMIT = 4;
+static const size_t BUFFER_DEPOT_LIMITS[BufferPool::CLASS_COUNT] = {1024, 256, 64};
+
+struct BufferDepot {
+    std::mutex mutex;
+    std::vector<char*> buffers;
+};
+
+static BufferDepot& bufferDepot(int sizeClass) {
+    static BufferDepot depots[BufferPool::CLASS_COUNT];
+    return depots[sizeClass];
+}
+
+static void pushToDepot(char* buffer, int sizeClass) {
+    BufferDepot& depot = bufferDepot(sizeClass);
+    {
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        if (depot.buffers.size() < BUFFER_DEPOT_LIMITS[sizeClass]) {
+            depot.buffers.push_back(buffer);
+            return;
+        }
+    }
+    delete[] buffer;
+}
+
+struct BufferCache {
+    std::vector<char*> buffers[BufferPool::CLASS_COUNT];
+    ~BufferCache() {
+        for (int c = 0; c < BufferPool::CLASS_COUNT; c++) {
+            for (char* buffer : buffers[c]) pushToDepot(buffer, c);
+        }
+    }
+};
+
+static BufferCache& bufferCache() {
+    thread_local BufferCache cache;
+    return cache;
+}
+
+// ----------------- BufferPool -----------------
+int BufferPool::classFor(size_t size) {
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (size <= CLASS_SIZES[c]) return c;
+    }
+    return CLASS_COUNT - 1;
+}
+
+char* BufferPool::acquire(int sizeClass) {
+    std::vector<char*>& cached = bufferCache().buffers[sizeClass];
+    if (!cached.empty()) {
+        char* buffer = cached.back();
+        cached.pop_back();
+        return buffer;
+    }
+
+    BufferDepot& depot = bufferDepot(sizeClass);
+    {
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        if (!depot.buffers.empty()) {
+            char* buffer = depot.buffers.back();
+            depot.buffers.pop_back();
+            return buffer;
+        }
+    }
+    return new char[CLASS_SIZES[sizeClass]];
+}
+
+void BufferPool::release(char* buffer, int sizeClass, bool toDepot) {
+    std::vector<char*>& cached = bufferCache().buffers[sizeClass];
+    if (!toDepot && cached.size() < BUFFER_CACHE_LIMIT) {
+        cached.push_back(buffer);
+    } else {
+        pushToDepot(buffer, sizeClass);
+    }
+}
+
+size_t BufferPool::cachedBytes() {
+    size_t total = 0;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        BufferDepot& depot = bufferDepot(c);
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        total += depot.buffers.size() * CLASS_SIZES[c];
+    }
+    return total;
+}
+
+// ----------------- PooledBuffer -----------------
+PooledBuffer::PooledBuffer() : buffer(nullptr), sizeClass(0) {}
+
+PooledBuffer::PooledBuffer(size_t size) : buffer(nullptr), sizeClass(0) {
+    acquire(size);
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept : buffer(other.buffer), sizeClass(other.sizeClass) {
+    other.buffer = nullptr;
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        buffer = other.buffer;
+        sizeClass = other.sizeClass;
+        other.buffer = nullptr;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer() {
+    release();
+}
+
+void PooledBuffer::acquire(size_t size) {
+    int wanted = BufferPool::classFor(size);
+    if (buffer && wanted == sizeClass) return;
+    release();
+    sizeClass = wanted;
+    buffer = BufferPool::acquire(sizeClass);
+}
+
+void PooledBuffer::release(bool toDepot) {
+    if (!buffer) return;
+    BufferPool::release(buffer, sizeClass, toDepot);
+    buffer = nullptr;
+}
+
+char* PooledBuffer::data() const {
+    return buffer;
+}
+
+size_t PooledBuffer::capacity() const {
+    return buffer ? BufferPool::CLASS_SIZES[sizeClass] : 0;
+}
+
+bool PooledBuffer::empty() const {
+    return buffer == nullptr;
+}
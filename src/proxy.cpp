@@ -1,13 +1,123 @@
 #include "../include/proxy.h"
+#include "../include/async_connection.h"
 
-#define ANSI_RED         "\033[31m"
-#define ANSI_RESET       "\033[0m"
-#define ANSI_GREEN       "\033[32m"
-#define ANSI_YELLOW      "\033[33m"
-#define ANSI_CONCEALED   "\033[8m"
+static int64_t steadyMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Conditional requests from the client are its own business and are never answered on its behalf.
+static bool hasClientValidators(const HttpRequest& request) {
+    return !findHeader(request.headers, "If-None-Match").empty() || !findHeader(request.headers, "If-Modified-Since").empty();
+}
+
+//------------------------ ConnectionDeadlines ------------------------
+ConnectionDeadlines::ConnectionDeadlines(TimerService& timers) : timers(timers), lastActivity(steadyMillis()) {}
+
+ConnectionDeadlines::~ConnectionDeadlines() {
+    cancelAll();
+}
+
+void ConnectionDeadlines::armHeaderRead(socket_t client_fd) {
+    timers.schedule(&headerRead, HEADER_READ_TIMEOUT_MS, [client_fd]() -> uint64_t {
+        LOG_WARNING("Timeout reached while waiting for the request header.");
+        SHUTDOWN_SOCKET(client_fd);
+        return 0;
+    });
+}
+
+void ConnectionDeadlines::cancelHeaderRead() {
+    timers.cancel(&headerRead);
+}
+
+void ConnectionDeadlines::armConnect(socket_t remote_fd) {
+    timers.schedule(&connect, CONNECT_TIMEOUT_MS, [remote_fd]() -> uint64_t {
+        LOG_WARNING("Timeout reached while connecting to the remote server.");
+        SHUTDOWN_SOCKET(remote_fd);
+        return 0;
+    });
+}
+
+void ConnectionDeadlines::cancelConnect() {
+    timers.cancel(&connect);
+}
+
+// Activity only bumps an atomic; the timer re-arms itself for the remaining idle time instead of
+// being rescheduled on every read.
+void ConnectionDeadlines::armIdle(socket_t client_fd, socket_t remote_fd, uint64_t idleMs) {
+    touch();
+    timers.schedule(&idle, idleMs, [this, client_fd, remote_fd, idleMs]() -> uint64_t {
+        int64_t idleFor = steadyMillis() - lastActivity.load(std::memory_order_relaxed);
+        if (idleFor < (int64_t)idleMs) return idleMs - idleFor;
+
+        LOG_WARNING("Idle timeout reached, closing connection.");
+        SHUTDOWN_SOCKET(client_fd);
+        SHUTDOWN_SOCKET(remote_fd);
+        return 0;
+    });
+}
+
+void ConnectionDeadlines::armLifetime(socket_t client_fd, socket_t remote_fd, uint64_t lifetimeMs) {
+    timers.schedule(&lifetime, lifetimeMs, [client_fd, remote_fd]() -> uint64_t {
+        LOG_WARNING("Connection lifetime reached, closing connection.");
+        SHUTDOWN_SOCKET(client_fd);
+        SHUTDOWN_SOCKET(remote_fd);
+        return 0;
+    });
+}
+
+void ConnectionDeadlines::touch() {
+    lastActivity.store(steadyMillis(), std::memory_order_relaxed);
+}
+
+void ConnectionDeadlines::cancelAll() {
+    timers.cancel(&headerRead);
+    timers.cancel(&connect);
+    timers.cancel(&idle);
+    timers.cancel(&lifetime);
+}
 
-Proxy::Proxy(int port) : port(port), server_fd(-1), running(false), file_descriptors(), connections(),
-                         BLACK_LIST(initFilterList("asset/blocked_domains.txt", "asset/blocked_ips.txt")) {}
+const char BAD_REQUEST_RESPONSE[] =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 0\r\n\r\n";
+
+const char VERSION_NOT_SUPPORTED_RESPONSE[] =
+    "HTTP/1.1 505 HTTP Version Not Supported\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 0\r\n\r\n";
+
+const char BLOCKED_RESPONSE[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Type: text/html; charset=UTF-8\r\n"
+    "Content-Length: 123\r\n"
+    "Server: Apache/2.4.41 (Ubuntu)\r\n"
+    "\r\n"
+    "<!DOCTYPE html>\n"
+    "<html>\n"
+    "<head><title>404 Not Found</title></head>\n"
+    "<body>\n"
+    "    <h1>404 Not Found</h1>\n"
+    "    <p>The requested resource was not found on this server.</p>\n"
+    "</body>\n"
+    "</html>";
+
+const char CONNECT_ESTABLISHED_RESPONSE[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+
+//------------------------ Proxy ------------------------
+Proxy::Proxy(int port) : port(port), server_fd(-1), transparent_port(TRANSPARENT_PORT), transparent_fd(INVALID_SOCKET),
+                         socks_port(SOCKS_PORT), socks_fd(INVALID_SOCKET), running(false), connections(), connections_version(0),
+                         metrics_server(METRICS_PORT), refreshing(false), io_backend(PROXY_IO_BACKEND),
+                         socket_profile(findSocketProfile(PROXY_SOCKET_PROFILE)), draining(false), retired(false), acceptors_running(0),
+                         BLACK_LIST(initFilterList("asset/blocked_domains.txt", "asset/blocked_ips.txt")) {
+    if (!socket_profile) {
+        LOG_WARNING("Unknown socket profile %s, using the default one", PROXY_SOCKET_PROFILE);
+        socket_profile = findSocketProfile("default");
+    }
+    socks_users.load(SOCKS_USERS_FILE);
+    h2c.load(H2C_ORIGINS_FILE);
+    parents.load(PARENT_PROXIES_FILE);
+}
 
 void Proxy::setupServerSocket() {
     sockaddr_in server_addr;
@@ -15,10 +125,10 @@ void Proxy::setupServerSocket() {
         print_socket_error(ANSI_RED "ERROR(Proxy::setupServerSocket):" ANSI_RESET " Socket creation failed");
         exit(EXIT_FAILURE);
     }
-    file_descriptors.push_back(server_fd);
 
     int opt = 1;
     SETSOCKOPT(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    applyListenerOptions(server_fd, *socket_profile.load());
 
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
@@ -35,29 +145,147 @@ void Proxy::setupServerSocket() {
     }
 }
 
+socket_t Proxy::openListener(int port, bool transparent) {
+    socket_t listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == INVALID_SOCKET) {
+        LOG_ERROR("(Proxy::openListener) Socket creation failed: %s", socketErrorText().c_str());
+        return INVALID_SOCKET;
+    }
+
+    int opt = 1;
+    SETSOCKOPT(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#ifdef IP_TRANSPARENT
+    // TPROXY delivers connections addressed to other hosts, which only a transparent socket may
+    // accept. It takes CAP_NET_ADMIN; REDIRECT works without it.
+    if (transparent) SETSOCKOPT(listen_fd, SOL_IP, IP_TRANSPARENT, &opt, sizeof(opt));
+#else
+    (void)transparent;
+#endif
+    applyListenerOptions(listen_fd, *socket_profile.load());
+
+    sockaddr_in listen_addr;
+    memset(&listen_addr, 0, sizeof(listen_addr));
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_addr.s_addr = INADDR_ANY;
+    listen_addr.sin_port = htons(port);
+
+    if (bind(listen_fd, (sockaddr*)&listen_addr, sizeof(listen_addr)) < 0 || listen(listen_fd, MAX_CONNECTIONS) < 0) {
+        LOG_ERROR("(Proxy::openListener) Cannot listen on port %d: %s", port, socketErrorText().c_str());
+        CLOSE_SOCKET(listen_fd);
+        return INVALID_SOCKET;
+    }
+    return listen_fd;
+}
+
+// The handed-over listener bound to `port`, taken out of `inherited`; the old process may have
+// had listeners this one does not, or lack some it has.
+static socket_t adoptListener(std::vector<socket_t>& inherited, int port) {
+    for (auto it = inherited.begin(); it != inherited.end(); ++it) {
+        sockaddr_in address;
+        socklen_t length = sizeof(address);
+        if (getsockname(*it, (sockaddr*)&address, &length) < 0 || ntohs(address.sin_port) != port) continue;
+        socket_t listener = *it;
+        inherited.erase(it);
+        return listener;
+    }
+    return INVALID_SOCKET;
+}
+
 int Proxy::start() {
     running = true;
+    draining = false;
+    retired = false;
 
     INIT_SOCKET();
-    setupServerSocket();
+    // A proxy already serving this port hands its listeners over instead of refusing the bind.
+    std::vector<socket_t> inherited = ListenerHandoff::takeOver(port);
+    server_fd = adoptListener(inherited, port);
+    if (server_fd != INVALID_SOCKET) {
+        LOG_INFO("Took over the listeners of the proxy running on port %d", port);
+    } else {
+        setupServerSocket();
+    }
+    metrics_server.start(adoptListener(inherited, METRICS_PORT));
+    auto optionalListener = [&](int listen_port, bool transparent) {
+        if (listen_port <= 0) return INVALID_SOCKET;
+        socket_t listen_fd = adoptListener(inherited, listen_port);
+        return listen_fd != INVALID_SOCKET ? listen_fd : openListener(listen_port, transparent);
+    };
+    transparent_fd = optionalListener(transparent_port, true);
+    socks_fd = optionalListener(socks_port, false);
+    for (socket_t unused : inherited) RELEASE_SOCKET(unused);
 
-    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    std::cerr << ANSI_RED << "[ " << std::ctime(&now) << " ] " << ANSI_RESET << "Proxy server started on port " << port << "\n";
+    std::vector<socket_t> listeners = {server_fd};
+    if (metrics_server.getListener() != INVALID_SOCKET) listeners.push_back(metrics_server.getListener());
+    if (transparent_fd != INVALID_SOCKET) listeners.push_back(transparent_fd);
+    if (socks_fd != INVALID_SOCKET) listeners.push_back(socks_fd);
+    handoff.offer(port, listeners, [this]() { std::thread(&Proxy::retire, this).detach(); });
+    timers.start();
+    disk_cache.open();
+    parents.start();
+    {
+        std::lock_guard<std::mutex> lock(revalidations_mutex);
+        refreshing = true;
+    }
+    for (int i = 0; i < CACHE_REFRESH_THREADS; i++) refreshers.emplace_back(&Proxy::refreshLoop, this);
+
+    LOG_INFO("Proxy server started on port %d", port);
    
     std::this_thread::sleep_for(std::chrono::milliseconds(500));
     
+    acceptors_running = 1;
     std::thread(&Proxy::acceptConnections, this).detach();
+    if (transparent_fd != INVALID_SOCKET) {
+        LOG_INFO("Transparent listener started on port %d", transparent_port);
+        acceptors_running++;
+        std::thread(&Proxy::acceptThreaded, this, transparent_fd, LISTENER_TRANSPARENT).detach();
+    }
+    if (socks_fd != INVALID_SOCKET) {
+        LOG_INFO("SOCKS5 listener started on port %d", socks_port);
+        acceptors_running++;
+        std::thread(&Proxy::acceptThreaded, this, socks_fd, LISTENER_SOCKS).detach();
+    }
     return server_fd;    
 }
 
 void Proxy::stop() {
     running = false;
+    {
+        std::unique_lock<std::mutex> lock(loop_mutex);
+        for (auto& loop : event_loops) loop->stop();
+        // Every coroutine unwinds on its loop first, so none outlives what it uses.
+        loops_stopped.wait(lock, [this]() { return event_loops.empty(); });
+    }
+    // Threaded handlers end on their own once their sockets are shut down.
+    registry.closeAll();
+    handoff.withdraw(port);
+    // Another process may share the listener, so it is only released; shutting it down would stop
+    // that one accepting too.
     if (server_fd != INVALID_SOCKET) {
-        CLOSE_SOCKET(server_fd);
+        RELEASE_SOCKET(server_fd);
+        server_fd = INVALID_SOCKET;
+    }
+    for (socket_t* listen_fd : {&transparent_fd, &socks_fd}) {
+        if (*listen_fd == INVALID_SOCKET) continue;
+        RELEASE_SOCKET(*listen_fd);
+        *listen_fd = INVALID_SOCKET;
     }
+    h2c.closeAll();
+    parents.stop();
+    metrics_server.stop();
+    // A refresh in flight still writes to both caches; queued ones are dropped.
+    {
+        std::lock_guard<std::mutex> lock(revalidations_mutex);
+        refreshing = false;
+        refresh_queue.clear();
+        revalidations.clear();
+    }
+    refresh_wake.notify_all();
+    for (std::thread& refresher : refreshers) refresher.join();
+    refreshers.clear();
+    disk_cache.close();
 
-    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    std::cerr << ANSI_RED << "[ " << std::ctime(&now) << " ] " << ANSI_RESET << "Proxy server stopped." << "\n";
+    LOG_INFO("Proxy server stopped.");
 
     std::this_thread::sleep_for(std::chrono::milliseconds(500));
 }
@@ -74,246 +302,1315 @@ int Proxy::getPort() const {
     return port;
 }
 
+void Proxy::setIoBackend(IoBackend backend) {
+    io_backend = backend;
+}
+
+IoBackend Proxy::getIoBackend() const {
+    return io_backend;
+}
+
+void Proxy::setTransparentPort(int port) {
+    transparent_port = port;
+}
+
+int Proxy::getTransparentPort() const {
+    return transparent_port;
+}
+
+void Proxy::setSocksPort(int port) {
+    socks_port = port;
+}
+
+int Proxy::getSocksPort() const {
+    return socks_port;
+}
+
+bool Proxy::setSocketProfile(const std::string& name) {
+    const SocketProfile* profile = findSocketProfile(name);
+    if (!profile) return false;
+    socket_profile = profile;
+    return true;
+}
+
+std::string Proxy::getSocketProfile() const {
+    return socket_profile.load()->name;
+}
+
+bool Proxy::recentConnections(std::vector<ConnectionInfo>& out, uint64_t& version) {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    if (version == connections_version) return false;
+    out = connections;
+    version = connections_version;
+    return true;
+}
+
+std::vector<ConnectionSnapshot> Proxy::openConnections() const {
+    return registry.snapshot();
+}
+
+bool Proxy::closeConnection(ConnectionId id) {
+    return registry.close(id);
+}
+
+int Proxy::closeAllConnections() {
+    return registry.closeAll();
+}
+
+bool Proxy::isRetired() const {
+    return retired;
+}
+
+void Proxy::retire() {
+    draining = true;
+    {
+        std::lock_guard<std::mutex> lock(loop_mutex);
+        if (!event_loops.empty()) {
+            std::shared_ptr<EventLoop> acceptor = event_loops[0];
+            socket_t listen_fd = server_fd;
+            // A cancelled io_uring accept may still complete once, so the loop goes round one more
+            // time before it counts as stopped.
+            acceptor->post([this, acceptor, listen_fd]() {
+                acceptor->pauseAccept(listen_fd);
+                if (!acceptor->post([this]() { acceptors_running--; })) acceptors_running--;
+            });
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_TIMEOUT_MS);
+    // Connections accepted until then are admitted, and so counted, before the acceptor stops.
+    while (acceptors_running > 0 && running && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    LOG_INFO("Draining %d connections before exiting", admissions.active());
+    while (admissions.active() > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (admissions.active() > 0) {
+        LOG_WARNING("Closing %d connections still open after %d ms", admissions.active(), DRAIN_TIMEOUT_MS);
+    }
+    stop();
+    retired = true;
+}
+
 void Proxy::acceptConnections() {
-    while (running) {
+    if (io_backend != IO_BACKEND_THREADS) {
+        std::vector<std::shared_ptr<EventLoop>> loops;
+        for (int i = 0; i < EVENT_LOOP_THREADS; i++) {
+            std::shared_ptr<EventLoop> loop = EventLoop::create(io_backend);
+            if (!loop) break;
+            loops.push_back(loop);
+        }
+        if (!loops.empty()) {
+            runEventLoops(loops);
+            return;
+        }
+        LOG_WARNING("%s backend is not available here, using a thread per connection", ioBackendName(io_backend));
+    }
+
+    acceptThreaded(server_fd, LISTENER_PROXY);
+}
+
+void Proxy::acceptThreaded(socket_t listen_fd, ListenerKind kind) {
+    // A listener shared with another process may have its connection taken between the wakeup and
+    // accept(), so it never blocks; waiting with a timeout also notices stop() and a handoff.
+    set_socket_blocking(listen_fd, false);
+    while (running && !draining) {
+        // New connections wait in the listen backlog meanwhile.
+        if (admissions.shouldPause()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ADMISSION_PAUSE_MS));
+            continue;
+        }
+        if (!wait_readable(listen_fd, ADMISSION_PAUSE_MS)) continue;
+
         sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
-        socket_t client_fd = accept(server_fd, (sockaddr*)&client_addr, &client_len);
+        socket_t client_fd = accept(listen_fd, (sockaddr*)&client_addr, &client_len);
 
         if (client_fd == INVALID_SOCKET) {
-            if (!running) break;
-            print_socket_error(ANSI_RED "ERROR (Proxy::acceptConnections):" ANSI_RESET " Accept failed");
+            if (!running || draining || socket_would_block()) continue;
+            // Mostly out of descriptors: the listener stays readable, so retrying at once would spin
+            // and flood the log until some are freed.
+            LOG_ERROR("(Proxy::acceptThreaded) Accept failed: %s", socketErrorText().c_str());
+            std::this_thread::sleep_for(std::chrono::milliseconds(EVENT_LOOP_ACCEPT_RETRY_MS));
             continue;
         }
-        file_descriptors.push_back(client_fd);
+        MetricsRegistry::instance().increment(METRIC_CONNECTIONS_ACCEPTED);
+        // Some platforms pass the listener's non-blocking mode on.
+        set_socket_blocking(client_fd, true);
+
+        Admission admission = admissions.admit(client_addr);
+        if (!admission) {
+            AdmissionControl::reject(client_fd);
+            continue;
+        }
+        applyClientOptions(client_fd, *socket_profile.load());
         
-        std::thread(&Proxy::handleClient, this, client_fd, client_addr).detach();
+        auto accepted_at = std::chrono::steady_clock::now();
+        ConnectionEntry entry = registry.open(client_fd, client_addr);
+        switch (kind) {
+            case LISTENER_PROXY:
+                std::thread(&Proxy::handleClient, this, client_fd, client_addr, accepted_at, std::string(),
+                            std::move(admission), std::move(entry)).detach();
+                break;
+            case LISTENER_TRANSPARENT:
+                std::thread(&Proxy::handleTransparent, this, client_fd, client_addr, accepted_at,
+                            std::move(admission), std::move(entry)).detach();
+                break;
+            case LISTENER_SOCKS:
+                std::thread(&Proxy::handleSocks, this, client_fd, client_addr, accepted_at,
+                            std::move(admission), std::move(entry)).detach();
+                break;
+        }
     }
+    acceptors_running--;
 }
 
-void Proxy::updateConnections(ConnectionInfo conn_info) {
-    std::lock_guard<std::mutex> lock(connections_mutex);
-    connections.insert(connections.begin(), conn_info);
-    if (connections.size() > 100) {
-        connections.pop_back();
+// Serves connections from a few loop threads, this one included. The first loop also accepts and
+// deals connections out round-robin; each stays on its loop for good, as a coroutine in
+// AsyncConnection. Requests it does not serve itself go on to handleClient threads.
+void Proxy::runEventLoops(const std::vector<std::shared_ptr<EventLoop>>& loops) {
+    {
+        std::lock_guard<std::mutex> lock(loop_mutex);
+        if (!running) return;
+        event_loops = loops;
+    }
+    LOG_INFO("Serving connections on %zu %s event loops", loops.size(), ioBackendName(loops[0]->backend()));
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < loops.size(); i++) workers.emplace_back(&EventLoop::run, loops[i].get());
+
+    size_t next = 0;
+    bool accepting = true;
+    std::function<void()> listen;
+    std::function<void()> resumeLater;
+
+    listen = [&]() {
+        loops[0]->accept(server_fd, [&](socket_t client_fd) {
+            MetricsRegistry::instance().increment(METRIC_CONNECTIONS_ACCEPTED);
+            auto accepted_at = std::chrono::steady_clock::now();
+
+            // Under pressure the loop stops accepting, leaving new connections in the listen backlog,
+            // and looks again after a while. This one, and any the kernel accepted meanwhile, are turned away.
+            if (!accepting || admissions.shouldPause()) {
+                AdmissionControl::reject(client_fd);
+                if (accepting) {
+                    accepting = false;
+                    loops[0]->pauseAccept(server_fd);
+                    resumeLater();
+                }
+                return;
+            }
+
+            sockaddr_in client_addr = {};
+            socklen_t client_len = sizeof(client_addr);
+            getpeername(client_fd, (sockaddr*)&client_addr, &client_len);
+            Admission admission = admissions.admit(client_addr);
+            if (!admission) {
+                AdmissionControl::reject(client_fd);
+                return;
+            }
+            applyClientOptions(client_fd, *socket_profile.load());
+
+            EventLoop& target = *loops[next++ % loops.size()];
+            if (&target == loops[0].get()) {
+                spawn(AsyncConnection::serve(*this, target, client_fd, accepted_at, std::move(admission)));
+                return;
+            }
+            // Posted tasks must be copyable, so the admission travels behind a pointer.
+            std::shared_ptr<Admission> moved = std::make_shared<Admission>(std::move(admission));
+            if (!target.post([this, &target, client_fd, accepted_at, moved]() {
+                    spawn(AsyncConnection::serve(*this, target, client_fd, accepted_at, std::move(*moved)));
+                })) {
+                CLOSE_SOCKET(client_fd);    // that loop has already shut down
+            }
+        });
+    };
+    resumeLater = [&]() {
+        loops[0]->timeout(ADMISSION_PAUSE_MS, [&](int result) {
+            if (result < 0 || draining) return;     // the loop is stopping, or the listener was handed over
+            if (admissions.shouldPause()) {
+                resumeLater();
+                return;
+            }
+            accepting = true;
+            listen();
+        });
+    };
+    listen();
+    loops[0]->run();
+    for (std::thread& worker : workers) worker.join();
+
+    std::lock_guard<std::mutex> lock(loop_mutex);
+    event_loops.clear();
+    loops_stopped.notify_all();
+}
+
+// Keeps records appended from different workers from interleaving in the log file.
+static std::mutex connection_log_mutex;
+
+void Proxy::updateConnections(const ConnectionInfo& conn_info) {
+    // Every finishing connection takes the lock, so the record is copied before it and the one
+    // pushed out is destroyed after it; inside, records only move.
+    ConnectionInfo record = conn_info;
+    ConnectionInfo evicted;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        connections.insert(connections.begin(), std::move(record));
+        if (connections.size() > 100) {
+            evicted = std::move(connections.back());
+            connections.pop_back();
+        }
+        connections_version++;
     }
 
-    log_connection_to_file(conn_info, TextFormat("log/%s-log.txt", std::to_string(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now())).c_str()));
+    // Formatting and writing the record is left to the work pool; the name is taken here because
+    // TextFormat returns a shared buffer.
+    std::string filename = TextFormat("log/%s-log.txt", std::to_string(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now())).c_str());
+    WorkStealingPool::instance().submit([conn_info, filename]() {
+        std::lock_guard<std::mutex> lock(connection_log_mutex);
+        log_connection_to_file(conn_info, filename.c_str());
+    });
 }
 
+bool Proxy::isBlockedAddress(const sockaddr_in& address) const {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address.sin_addr, ip, INET_ADDRSTRLEN);
+    return BLACK_LIST.isBlocked(ip);
+}
 
-void Proxy::handleClient(socket_t client_fd, sockaddr_in client_addr) {
-    char buffer[BUFFER_SIZE];
-    socket_t remote_fd = -1;
-    ConnectionInfo conn_info;
-    
-    inet_ntop(AF_INET, &(client_addr.sin_addr), conn_info.client.ip, INET_ADDRSTRLEN);
-    conn_info.client.port = ntohs(client_addr.sin_port);
+void Proxy::rejectBlocked(socket_t client_fd, const HttpRequest& request, ConnectionInfo& conn_info) {
+    LOG_WARNING("This domain/ip is blocked: %s", findHeader(request.headers, "Host").c_str());
+    MetricsRegistry::instance().increment(METRIC_REQUESTS_BLOCKED);
 
-    conn_info.time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    send(client_fd, BLOCKED_RESPONSE, strlen(BLOCKED_RESPONSE), 0);
 
-    try {
-        ssize_t bytes_read = recv(client_fd, buffer, BUFFER_SIZE, 0);
-        if (bytes_read <= 0) {
-            throw std::runtime_error("Failed to receive data from client");
+    HttpResponse response = parseHttpResponse(BLOCKED_RESPONSE);
+    conn_info.addTransaction(request, response);
+    updateConnections(conn_info);
+
+    throw std::runtime_error("This domain/ip is blocked!");
+}
+
+bool Proxy::findCached(const HttpRequest& request, CacheEntryRef& cached) {
+    cached.memory = cache.lookup(request);
+    cached.onDisk = !cached.memory && disk_cache.lookup(request, cached.disk);
+    return bool(cached);
+}
+
+bool Proxy::sendCached(socket_t client_fd, const HttpRequest& request, const CacheEntryRef& cached, ConnectionInfo& conn_info,
+                       std::chrono::steady_clock::time_point accepted_at) {
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::string head = cached.meta().headWithAge(now);
+    size_t bodyLength = cached.onDisk ? cached.disk.bodyLength : cached.memory->body.size();
+
+    send(client_fd, head.c_str(), head.size(), 0);
+    if (cached.onDisk) {
+        if (!disk_cache.sendBody(client_fd, cached.disk)) return false;
+        metrics.increment(METRIC_DISK_CACHE_HITS);
+    } else {
+        send(client_fd, cached.memory->body.c_str(), bodyLength, 0);
+    }
+
+    metrics.record(METRIC_TIME_TO_FIRST_BYTE, std::chrono::steady_clock::now() - accepted_at);
+    metrics.increment(METRIC_CACHE_HITS);
+    metrics.increment(METRIC_CACHE_HIT_BYTES, head.size() + bodyLength);
+    metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, head.size() + bodyLength);
+    LOG_DEBUG("Cache hit: %s", HttpCache::cacheKey(request).c_str());
+
+    // The transaction record only needs the head; disk bodies never pass through user space.
+    HttpResponse response = parseHttpResponse(cached.onDisk ? head : head + cached.memory->body);
+    conn_info.addTransaction(request, response);
+    return true;
+}
+
+void Proxy::storeResponse(std::shared_ptr<CachedResponse> entry) {
+    if (entry && entry->body.size() >= DISK_CACHE_MIN_OBJECT_BYTES && disk_cache.isOpen()) {
+        disk_cache.store(*entry);
+    } else {
+        cache.store(entry);
+    }
+}
+
+std::shared_ptr<CachedResponse> Proxy::refreshCached(const HttpRequest& request, CacheEntryRef& stale, const std::string& notModifiedHead) {
+    std::string body;
+    if (stale.onDisk) {
+        if (!disk_cache.readBody(stale.disk, body)) return nullptr;
+    } else {
+        body = stale.memory->body;
+    }
+
+    std::shared_ptr<CachedResponse> refreshed = HttpCache::refreshEntry(request, stale.meta(), body, notModifiedHead);
+    if (refreshed) {
+        // The refreshed copy is self-contained; unpin the old slab before the disk tier writes again.
+        stale = CacheEntryRef();
+        storeResponse(refreshed);
+        MetricsRegistry::instance().increment(METRIC_CACHE_REVALIDATED);
+    }
+    return refreshed;
+}
+
+bool Proxy::serveFromCache(socket_t client_fd, const HttpRequest& request, ConnectionInfo& conn_info,
+                           std::chrono::steady_clock::time_point accepted_at, CacheEntryRef& stale) {
+    CacheEntryRef cached;
+    if (!findCached(request, cached)) return false;
+
+    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    bool fresh = cached.meta().isFresh(now);
+    if (!fresh && !cached.meta().canServeWhileRevalidating(now)) {
+        stale = std::move(cached);
+        return false;
+    }
+
+    if (!sendCached(client_fd, request, cached, conn_info, accepted_at)) {
+        throw std::runtime_error("Failed to send cached body from disk");
+    }
+    if (!fresh) {
+        MetricsRegistry::instance().increment(METRIC_CACHE_STALE_SERVED);
+        revalidateInBackground(request, cached.meta());
+    }
+    return true;
+}
+
+// Replays a collapsed fetch led by another handler. Returns false, having sent nothing, when the
+// response turns out not to be shareable with this request.
+bool Proxy::followInflight(socket_t client_fd, const HttpRequest& request, const std::shared_ptr<InflightFetch>& inflight,
+                           ConnectionInfo& conn_info, std::chrono::steady_clock::time_point accepted_at) {
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    std::string head;
+    if (!inflight->waitForHead(request, head)) return false;
+
+    size_t offset = 0;
+    std::string chunk;
+    bool more = true;
+    while (more) {
+        more = inflight->read(offset, chunk);
+        if (chunk.empty()) continue;
+        if (offset == 0) metrics.record(METRIC_TIME_TO_FIRST_BYTE, std::chrono::steady_clock::now() - accepted_at);
+        if (send(client_fd, chunk.data(), chunk.size(), 0) <= 0) {
+            throw std::runtime_error("Failed to relay collapsed response to client");
         }
+        offset += chunk.size();
+    }
+    metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, offset);
+    if (!inflight->isComplete()) {
+        throw std::runtime_error("Collapsed origin fetch ended early");
+    }
 
-        buffer[bytes_read] = '\0';
-        std::string rawRequest(buffer);
+    metrics.increment(METRIC_COLLAPSED_REQUESTS);
+    LOG_DEBUG("Collapsed onto in-flight fetch: %s", inflight->key.c_str());
+    HttpResponse response = parseHttpResponse(head);
+    conn_info.addTransaction(request, response);
+    return true;
+}
 
-        HttpRequest request = parseHttpRequest(rawRequest);
-        conn_info.parseServerPort(request);
-        HttpResponse response;
-        
-        sockaddr_in remote_addr;
-        std::string host = request.getHeader("Host");
+// A request as a parent proxy expects it, with the scheme and host in the request line.
+static std::string absoluteForm(const std::string& rawRequest, const std::string& host) {
+    size_t target = rawRequest.find(' ');
+    if (target == std::string::npos || rawRequest.compare(target + 1, 1, "/") != 0) return rawRequest;
+    return rawRequest.substr(0, target + 1) + "http://" + host + rawRequest.substr(target + 1);
+}
 
-        remote_fd = socket(AF_INET, SOCK_STREAM, 0);
+// Methods a parent may be asked again when the first one dropped the request (RFC 9110 section 9.2.2).
+static bool isIdempotent(const std::string& method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "PUT" || method == "DELETE" || method == "TRACE";
+}
+
+socket_t Proxy::connectParent(const std::string& host, const std::string& tunnel, const std::string& request, bool retryable,
+                              ConnectionDeadlines& deadlines, ConnectionEntry* entry, sockaddr_in& parent_addr) {
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    std::string opening = tunnel.empty() ? absoluteForm(request, host)
+                                         : "CONNECT " + tunnel + " HTTP/1.1\r\nHost: " + tunnel + "\r\n\r\n";
+    std::vector<std::shared_ptr<ParentProxy>> candidates = parents.candidates(host);
+
+    for (size_t attempt = 0; attempt < candidates.size(); attempt++) {
+        ParentProxy& parent = *candidates[attempt];
+        if (attempt > 0) metrics.increment(METRIC_PARENT_RETRIES);
+        if (!parent.getAddress(parent_addr)) {
+            LOG_WARNING("(Proxy::connectParent) Parent %s does not resolve", parent.name.c_str());
+            parents.reportFailure(parent);
+            continue;
+        }
+
+        socket_t remote_fd = socket(AF_INET, SOCK_STREAM, 0);
         if (remote_fd == INVALID_SOCKET) {
-            print_socket_error(ANSI_RED "ERROR (Proxy::handleClient):" ANSI_RESET " Socket (remote) creation failed");
+            LOG_ERROR("(Proxy::connectParent) Socket (remote) creation failed: %s", socketErrorText().c_str());
             throw std::runtime_error("Failed to connect server remote");
         }
-        file_descriptors.push_back(remote_fd);
+        if (entry) entry->setRemote(remote_fd);
+        applyUpstreamOptions(remote_fd, *socket_profile.load());
 
-        memset(&remote_addr, 0, sizeof(remote_addr));
-        remote_addr.sin_family = AF_INET;
-        remote_addr.sin_port = htons(conn_info.server.port);
-        struct hostent* remote_host = gethostbyname(host.c_str());
+        auto connect_start = std::chrono::steady_clock::now();
+        deadlines.armConnect(remote_fd);
+        int connected = connect(remote_fd, (struct sockaddr*)&parent_addr, sizeof(parent_addr));
+        deadlines.cancelConnect();
+        bool answered = connected == 0 && send(remote_fd, opening.data(), opening.size(), flags) == ssize_t(opening.size());
+        std::string failure = answered ? "" : socketErrorText();
+        if (answered) metrics.record(METRIC_CONNECT_LATENCY, std::chrono::steady_clock::now() - connect_start);
 
-        if (!remote_host) {
-            print_socket_error(ANSI_RED "ERROR (Proxy::handleClient):" ANSI_RESET " Failed to resolve remote domain");
-            CLOSE_SOCKET(remote_fd); 
-            throw std::runtime_error("Failed to connect server remote");
+        if (answered && !tunnel.empty()) {
+            // Read exactly the parent's head, so nothing of the tunnel is taken with it: peek at what has
+            // arrived and take it all while the head has not ended in it, or only up to the end once it has.
+            std::string head;
+            PooledBuffer buffer(BUFFER_SIZE);
+            answered = false;
+            while (!answered && head.size() < BUFFER_SIZE && wait_readable(remote_fd, HTTP_IDLE_TIMEOUT_MS)) {
+                ssize_t peeked = recv(remote_fd, buffer.data(), BUFFER_SIZE - head.size(), MSG_PEEK);
+                if (peeked <= 0) break;
+                size_t before = head.size();
+                head.append(buffer.data(), peeked);
+                size_t end = head.find("\r\n\r\n", before >= 3 ? before - 3 : 0);
+                answered = end != std::string::npos;
+                if (answered) head.resize(end + 4);
+                size_t take = head.size() - before;
+                if (recv(remote_fd, buffer.data(), take, MSG_WAITALL) != ssize_t(take)) {
+                    answered = false;
+                    break;
+                }
+            }
+            if (!answered) failure = "no answer to CONNECT";
+            if (answered && parseHttpResponse(head).statusCode != 200) {
+                // The parent is fine; it just will not go there.
+                parents.reportSuccess(parent);
+                if (entry) entry->setRemote(INVALID_SOCKET);
+                CLOSE_SOCKET(remote_fd);
+                LOG_WARNING("(Proxy::connectParent) Parent %s refused CONNECT %s: %s", parent.name.c_str(), tunnel.c_str(),
+                            head.substr(0, head.find("\r\n")).c_str());
+                throw std::runtime_error("Parent refused the tunnel");
+            }
+        } else if (answered && retryable) {
+            // A parent that drops the request before a byte of the response can be replaced by the next
+            // one. One that is merely slow is waited for no longer than any origin, but not blamed.
+            char first;
+            if (!wait_readable(remote_fd, HTTP_IDLE_TIMEOUT_MS)) {
+                if (entry) entry->setRemote(INVALID_SOCKET);
+                CLOSE_SOCKET(remote_fd);
+                throw std::runtime_error("Parent proxy did not answer");
+            }
+            answered = recv(remote_fd, &first, 1, MSG_PEEK) == 1;
+            if (!answered) failure = "closed before answering";
         }
-        memcpy(&remote_addr.sin_addr.s_addr, remote_host->h_addr, remote_host->h_length);
-        
-        if (unsigned(remote_host->h_length) > sizeof(remote_addr.sin_addr)) {
-            print_socket_error(ANSI_RED "ERROR (Proxy::handleClient):" ANSI_RESET " Remote host length is too long");
-            CLOSE_SOCKET(remote_fd);
-            throw std::runtime_error("Failed to connect server remote");
+
+        if (answered) {
+            parents.reportSuccess(parent);
+            return remote_fd;
         }
+        LOG_WARNING("(Proxy::connectParent) Parent %s failed for %s: %s", parent.name.c_str(), host.c_str(), failure.c_str());
+        parents.reportFailure(parent);
+        if (entry) entry->setRemote(INVALID_SOCKET);
+        CLOSE_SOCKET(remote_fd);
+        // Once the request itself went out it may not be sent again.
+        if (connected == 0 && tunnel.empty() && !retryable) break;
+    }
+    throw std::runtime_error("No parent proxy could be reached");
+}
 
-        if (connect(remote_fd, (struct sockaddr*)&remote_addr, sizeof(remote_addr)) < 0) {
-            print_socket_error(ANSI_RED "ERROR (Proxy::handleClient):" ANSI_RESET " Connect to remote server failed");
-            CLOSE_SOCKET(remote_fd);
-            throw std::runtime_error("Failed to connect server remote");
+// Fetches one complete response on a connection of its own, for refreshes no client is waiting on.
+bool Proxy::fetchFromOrigin(const HttpRequest& request, const std::string& rawRequest, std::string& response) {
+    ConnectionInfo target;
+    target.parseServerPort(request);
+    if (h2c.routes(request, target.server.port)) {
+        ResponseTracker tracker(request.method);
+        std::string raw;
+        try {
+            sockaddr_in address;
+            std::shared_ptr<H2Stream> stream = h2c.open(rawRequest, target.server.port, *socket_profile.load(), address,
+                                                        [this](const sockaddr_in& address) { return isBlockedAddress(address); });
+            if (!stream) return false;
+            PooledBuffer buffer(BUFFER_SIZE);
+            while (!tracker.isComplete() && raw.size() <= DISK_CACHE_MAX_OBJECT_BYTES) {
+                ssize_t bytes_read = stream->read(buffer.data(), buffer.capacity(), HTTP_IDLE_TIMEOUT_MS);
+                if (bytes_read <= 0) break;
+                raw.append(buffer.data(), bytes_read);
+                tracker.feed(buffer.data(), bytes_read);
+            }
+        } catch (const std::exception& e) {
+            LOG_WARNING("(Proxy::fetchFromOrigin) %s", e.what());
+            return false;
+        }
+        if (raw.size() > DISK_CACHE_MAX_OBJECT_BYTES || !tracker.isComplete(true)) return false;
+        response = tracker.finalResponse(raw);
+        return true;
+    }
+
+    std::string host = findHeader(request.headers, "Host");
+    ConnectionDeadlines deadlines(timers);
+    socket_t remote_fd = INVALID_SOCKET;
+    if (parents.routes(host)) {
+        try {
+            sockaddr_in address;
+            remote_fd = connectParent(host, "", rawRequest, isIdempotent(request.method), deadlines, nullptr, address);
+        } catch (const std::exception& e) {
+            LOG_WARNING("(Proxy::fetchFromOrigin) %s", e.what());
+            return false;
         }
+    } else {
+        host = host.substr(0, host.find(':'));
 
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* resolved = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(target.server.port).c_str(), &hints, &resolved) != 0 || !resolved) {
+            LOG_WARNING("(Proxy::fetchFromOrigin) Failed to resolve %s", host.c_str());
+            return false;
+        }
+
+        remote_fd = socket(AF_INET, SOCK_STREAM, 0);
         if (remote_fd == INVALID_SOCKET) {
-            throw std::runtime_error("Failed to connect to remote server");
+            freeaddrinfo(resolved);
+            return false;
         }
 
-        inet_ntop(AF_INET, &(remote_addr.sin_addr), conn_info.server.ip, INET_ADDRSTRLEN);
-        conn_info.server.port = ntohs(remote_addr.sin_port);
+        applyUpstreamOptions(remote_fd, *socket_profile.load());
+        deadlines.armConnect(remote_fd);
+        int connected = connect(remote_fd, resolved->ai_addr, resolved->ai_addrlen);
+        deadlines.cancelConnect();
+        freeaddrinfo(resolved);
+        if (connected != 0) {
+            LOG_WARNING("(Proxy::fetchFromOrigin) Connect to %s failed: %s", host.c_str(), socketErrorText().c_str());
+            CLOSE_SOCKET(remote_fd);
+            return false;
+        }
+        send(remote_fd, rawRequest.c_str(), rawRequest.size(), 0);
+    }
+
+    ResponseTracker tracker(request.method);
+    std::string raw;
+    deadlines.armIdle(remote_fd, remote_fd, HTTP_IDLE_TIMEOUT_MS);
+    PooledBuffer buffer(BUFFER_SIZE);
+    while (!tracker.isComplete() && raw.size() <= DISK_CACHE_MAX_OBJECT_BYTES) {
+        ssize_t bytes_read = recv(remote_fd, buffer.data(), buffer.capacity(), 0);
+        if (bytes_read <= 0) break;
+        deadlines.touch();
+        raw.append(buffer.data(), bytes_read);
+        tracker.feed(buffer.data(), bytes_read);
+    }
+
+    deadlines.cancelAll();
+    CLOSE_SOCKET(remote_fd);
+
+    if (raw.size() > DISK_CACHE_MAX_OBJECT_BYTES || !tracker.isComplete(true)) return false;
+    response = tracker.finalResponse(raw);
+    return true;
+}
+
+// stale-while-revalidate: the client already has the stale copy; refresh it once per key off the
+// request path. When the refresh threads are all busy and the queue is full, the next stale hit tries again.
+void Proxy::revalidateInBackground(const HttpRequest& request, const CachedResponse& stale) {
+    std::string key = HttpCache::cacheKey(request);
+    std::lock_guard<std::mutex> lock(revalidations_mutex);
+    if (!refreshing || refresh_queue.size() >= CACHE_REFRESH_QUEUE || !revalidations.insert(key).second) return;
+    refresh_queue.push_back({request, key, HttpCache::conditionalRequest(request, stale)});
+    refresh_wake.notify_one();
+}
+
+void Proxy::refreshLoop() {
+    std::unique_lock<std::mutex> lock(revalidations_mutex);
+    while (true) {
+        refresh_wake.wait(lock, [this]() { return !refreshing || !refresh_queue.empty(); });
+        if (!refreshing) return;
+        Refresh refresh = std::move(refresh_queue.front());
+        refresh_queue.pop_front();
+        lock.unlock();
+
+        const HttpRequest& request = refresh.request;
+        std::string response;
+        if (fetchFromOrigin(request, refresh.conditional, response)) {
+            HttpResponse head = parseHttpResponse(response.substr(0, response.find("\r\n\r\n") + 4));
+            CacheEntryRef current;
+            if (head.statusCode == 304) {
+                if (findCached(request, current)) refreshCached(request, current, response);
+            } else if (head.statusCode < 500) {
+                std::shared_ptr<CachedResponse> entry = HttpCache::buildEntry(request, response);
+                if (entry) {
+                    storeResponse(entry);
+                } else {
+                    cache.remove(refresh.key);
+                    disk_cache.remove(refresh.key);
+                }
+            }
+        }
+
+        lock.lock();
+        revalidations.erase(refresh.key);
+    }
+}
+
+void Proxy::relayTunnel(socket_t client_fd, socket_t remote_fd, const HttpRequest& request, const std::string& host,
+                        ConnectionInfo& conn_info, ConnectionDeadlines& deadlines, ConnectionEntry& entry,
+                        std::chrono::steady_clock::time_point accepted_at) {
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    bool firstUpstreamByte = true;
+    bool clientSpoke = false;
+    std::vector<std::string> captured;     // response heads of a plaintext tunnel, parsed once it is over
+    RateLimit rateLimit = shaper.limit(conn_info.client.ip, host);
+    // No poll timeout inside the relay: idle and lifetime deadlines shut the sockets down instead.
+    TunnelRelay relay(client_fd, remote_fd, [&](bool upstream, const char* data, size_t length) {
+        deadlines.touch();
+        entry.addBytes(upstream, length);
+        if (upstream) {
+            metrics.increment(METRIC_BYTES_CLIENT_TO_SERVER, length);
+            clientSpoke = true;
+            return;
+        }
+        if (firstUpstreamByte) {
+            metrics.record(METRIC_TIME_TO_FIRST_BYTE, std::chrono::steady_clock::now() - accepted_at);
+            firstUpstreamByte = false;
+        }
+        metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, length);
+        // Only plaintext tunnels are recorded as transactions; TLS records are not parsed. As in
+        // AsyncConnection::relay, only the head each request is answered with is kept, up to a limit.
+        if (clientSpoke && !request.isEncrypted && captured.size() < TUNNEL_MAX_CAPTURED_RESPONSES) {
+            captured.push_back(messageHead(data, length));
+        }
+        clientSpoke = false;
+    }, rateLimit);
+    relay.run([this] { return running; });
+
+    if (captured.empty()) return;
+    std::vector<HttpResponse> responses = WorkStealingPool::instance().async([&captured]() {
+        std::vector<HttpResponse> parsed;
+        parsed.reserve(captured.size());
+        for (const std::string& head : captured) parsed.push_back(parseHttpResponse(head));
+        return parsed;
+    }).get();
+    for (const HttpResponse& response : responses) conn_info.addTransaction(request, response);
+}
+
+void Proxy::handleClient(socket_t client_fd, sockaddr_in client_addr, std::chrono::steady_clock::time_point accepted_at,
+                         std::string prefetched, Admission admission, ConnectionEntry entry) {
+    PooledBuffer buffer(BUFFER_SIZE);
+    socket_t remote_fd = -1;
+    ObjectPool<ConnectionInfo>::Handle pooled_info = ObjectPool<ConnectionInfo>::acquire();
+    ConnectionInfo& conn_info = *pooled_info;
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    bool firstUpstreamByte = true;
+
+    if (prefetched.empty()) metrics.record(METRIC_ACCEPT_LATENCY, std::chrono::steady_clock::now() - accepted_at);
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE);
+    
+    inet_ntop(AF_INET, &(client_addr.sin_addr), conn_info.client.ip, INET_ADDRSTRLEN);
+    conn_info.client.port = ntohs(client_addr.sin_port);
+
+    conn_info.time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+    ConnectionDeadlines deadlines(timers);
+    if (prefetched.empty()) deadlines.armHeaderRead(client_fd);
+
+    HttpRequest request;
+    CacheEntryRef stale;            // expired copy that may still answer if the origin fails
+    bool responseStarted = false;   // origin bytes already reached the client
+
+    try {
+        ssize_t bytes_read = prefetched.size();
+        if (prefetched.empty()) {
+            bytes_read = recv(client_fd, buffer.data(), buffer.capacity(), 0);
+            deadlines.cancelHeaderRead();
+            if (bytes_read <= 0) {
+                throw std::runtime_error("Failed to receive data from client");
+            }
+        }
 
-        std::cout << ANSI_GREEN << "[ " << std::ctime(&conn_info.time) << " ] " << ANSI_RESET << "Client " << conn_info.client.ip << ":" << conn_info.client.port << " connected to " << conn_info.server.ip << ":" << conn_info.server.port << "\n";
+        std::string rawRequest = prefetched.empty() ? std::string(buffer.data(), bytes_read) : prefetched;
+
+        request = parseHttpRequest(rawRequest);
+        conn_info.parseServerPort(request);
+        HttpResponse response;
+        
+        sockaddr_in remote_addr;
+        std::string host = request.getHeader("Host");
+        entry.setTarget(host, conn_info.server.port);
 
         if (!isValidHttpMethod(request.method)) {
-            std::cout << ANSI_YELLOW << "WARNING: " << ANSI_RESET << "Method is not valid!\n";
+            LOG_WARNING("Method is not valid!");
 
-            const char* connect_response =  "HTTP/1.1 400 Bad Request\r\n"
-                                            "Content-Type: text/plain\r\n"
-                                            "Content-Length: 0\r\n\r\n";
+            send(client_fd, BAD_REQUEST_RESPONSE, strlen(BAD_REQUEST_RESPONSE), 0);
             
-            send(client_fd, connect_response, strlen(connect_response), 0);
-            
-            response = parseHttpResponse(connect_response);
+            response = parseHttpResponse(BAD_REQUEST_RESPONSE);
             conn_info.addTransaction(request, response);
             updateConnections(conn_info);
             
-            throw std::runtime_error("Method is not valid!\n");
+            throw std::runtime_error("Method is not valid!");
         }
 
         if (!isValidHttpVersion(request.httpVersion)) {
-            std::cout << ANSI_YELLOW << "WARNING: " << ANSI_RESET << "HTTP version is not supported!\n";
-
-            const char *connect_response =  "HTTP/1.1 505 HTTP Version Not Supported\r\n"
-                                            "Content-Type: text/plain\r\n"
-                                            "Content-Length: 0\r\n\r\n";
+            LOG_WARNING("HTTP version is not supported!");
 
-            send(client_fd, connect_response, strlen(connect_response), 0);
+            send(client_fd, VERSION_NOT_SUPPORTED_RESPONSE, strlen(VERSION_NOT_SUPPORTED_RESPONSE), 0);
 
-            response = parseHttpResponse(connect_response);
+            response = parseHttpResponse(VERSION_NOT_SUPPORTED_RESPONSE);
             conn_info.addTransaction(request, response);
             updateConnections(conn_info);
 
-            throw std::runtime_error("Version HTTP is not supported!\n");
+            throw std::runtime_error("Version HTTP is not supported!");
         }
 
-        if (BLACK_LIST.isBlocked(host) || BLACK_LIST.isBlocked(conn_info.server.ip)) {
-            std::cout << ANSI_YELLOW << "WARNING: " << ANSI_RESET << "This domain/ip is blocked!\n";
-
-            const char *http_404_message =
-                    "HTTP/1.1 404 Not Found\r\n"
-                    "Content-Type: text/html; charset=UTF-8\r\n"
-                    "Content-Length: 123\r\n"
-                    "Server: Apache/2.4.41 (Ubuntu)\r\n"
-                    "\r\n"
-                    "<!DOCTYPE html>\n"
-                    "<html>\n"
-                    "<head><title>404 Not Found</title></head>\n"
-                    "<body>\n"
-                    "    <h1>404 Not Found</h1>\n"
-                    "    <p>The requested resource was not found on this server.</p>\n"
-                    "</body>\n"
-                    "</html>";
+        // The host is checked before the cache so blocked sites are never served from it;
+        // the resolved address is checked again once connected.
+        if (BLACK_LIST.isBlocked(host)) {
+            rejectBlocked(client_fd, request, conn_info);
+        }
 
-            send(client_fd, http_404_message, strlen(http_404_message), 0);
+        bool cacheable = HttpCache::isCacheableRequest(request);
+        bool served = cacheable && serveFromCache(client_fd, request, conn_info, accepted_at, stale);
 
-            response = parseHttpResponse(http_404_message);
-            conn_info.addTransaction(request, response);
-            updateConnections(conn_info);
-
-            throw std::runtime_error("This domain/ip is blocked!\n");
+        // Collapsed forwarding: the first miss for a URL fetches it, concurrent identical misses
+        // replay that fetch. A follower that cannot share it fetches on its own without leading.
+        std::shared_ptr<InflightFetch> inflight;
+        std::unique_ptr<InflightLease> lease;
+        if (!served && cacheable && !stale && !hasClientValidators(request)) {
+            bool leader;
+            inflight = collapsed.join(HttpCache::cacheKey(request), request, leader);
+            if (leader) {
+                lease = std::make_unique<InflightLease>(collapsed, inflight);
+            } else {
+                served = followInflight(client_fd, request, inflight, conn_info, accepted_at);
+                inflight.reset();
+            }
         }
 
-        struct timeval timeout;
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
-        std::string res;
+        if (!served) {
+            // With an expired copy at hand, ask the origin whether it is still valid rather than
+            // refetching the body; conditional requests from the client itself pass through untouched.
+            bool revalidate = stale && !hasClientValidators(request);
+            std::string upstreamRequest = revalidate ? HttpCache::conditionalRequest(request, stale.meta()) : request.rawRequest;
 
-        if (request.method == "CONNECT") {
-            std::cout << ANSI_CONCEALED << "Connect successful!\n" << ANSI_RESET;
+            // Requests to an h2c origin become streams on a connection shared with other clients; none
+            // is opened, and nothing sent, when the origin's address is blocked. A parent proxy resolves
+            // the host itself and is handed the request, or the tunnel, as soon as it is connected.
+            std::shared_ptr<H2Stream> stream;
+            bool viaParent = false;
+            if (h2c.routes(request, conn_info.server.port)) {
+                entry.setState(CONNECTION_CONNECTING);
+                stream = h2c.open(upstreamRequest, conn_info.server.port, *socket_profile.load(), remote_addr,
+                                  [this](const sockaddr_in& address) { return isBlockedAddress(address); });
+            } else if (parents.routes(host)) {
+                entry.setState(CONNECTION_CONNECTING);
+                viaParent = true;
+                std::string tunnel = request.method == "CONNECT" ? request.url : std::string();
+                remote_fd = connectParent(host, tunnel, upstreamRequest, isIdempotent(request.method), deadlines, &entry, remote_addr);
+            } else {
+                remote_fd = socket(AF_INET, SOCK_STREAM, 0);
+                if (remote_fd == INVALID_SOCKET) {
+                    LOG_ERROR("(Proxy::handleClient) Socket (remote) creation failed: %s", socketErrorText().c_str());
+                    throw std::runtime_error("Failed to connect server remote");
+                }
+                entry.setRemote(remote_fd);
+
+                memset(&remote_addr, 0, sizeof(remote_addr));
+                remote_addr.sin_family = AF_INET;
+                remote_addr.sin_port = htons(conn_info.server.port);
+                entry.setState(CONNECTION_RESOLVING);
+                auto dns_start = std::chrono::steady_clock::now();
+                struct hostent* remote_host = gethostbyname(host.c_str());
+                metrics.record(METRIC_DNS_LATENCY, std::chrono::steady_clock::now() - dns_start);
 
-            char connect_response[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+                if (!remote_host) {
+                    LOG_ERROR("(Proxy::handleClient) Failed to resolve remote domain: %s", socketErrorText().c_str());
+                    throw std::runtime_error("Failed to connect server remote");
+                }
+                memcpy(&remote_addr.sin_addr.s_addr, remote_host->h_addr, remote_host->h_length);
             
-            send(client_fd, connect_response, strlen(connect_response), 0);
-            response = parseHttpResponse(connect_response);
-            conn_info.addTransaction(request, response);
+                if (unsigned(remote_host->h_length) > sizeof(remote_addr.sin_addr)) {
+                    LOG_ERROR("(Proxy::handleClient) Remote host length is too long: %s", socketErrorText().c_str());
+                    throw std::runtime_error("Failed to connect server remote");
+                }
 
-            bool countClient = 0, countRemote = 0;
-            while (running) {
-                fd_set fds;
-                FD_ZERO(&fds);
-                FD_SET(client_fd, &fds);
-                FD_SET(remote_fd, &fds);
-                int max_fd = std::max(client_fd, remote_fd);
-
-                int activity = select(max_fd + 1, &fds, NULL, NULL, &timeout);
-                if (activity < 0) {
-                    print_socket_error(ANSI_RED "ERROR (Proxy::handleClient):"  ANSI_RESET" Select Error.");
-                    break;
-                } else if (activity == 0) { 
-                    std::cout << ANSI_YELLOW << "WARNING: " << ANSI_RESET << "Timeout reached, ending read loop.\n";
-                    break;
+                applyUpstreamOptions(remote_fd, *socket_profile.load());
+                entry.setState(CONNECTION_CONNECTING);
+                auto connect_start = std::chrono::steady_clock::now();
+                deadlines.armConnect(remote_fd);
+                int connected = connect(remote_fd, (struct sockaddr*)&remote_addr, sizeof(remote_addr));
+                deadlines.cancelConnect();
+                if (connected < 0) {
+                    LOG_ERROR("(Proxy::handleClient) Connect to remote server failed: %s", socketErrorText().c_str());
+                    throw std::runtime_error("Failed to connect server remote");
+                }
+                metrics.record(METRIC_CONNECT_LATENCY, std::chrono::steady_clock::now() - connect_start);
+
+                if (remote_fd == INVALID_SOCKET) {
+                    throw std::runtime_error("Failed to connect to remote server");
                 }
+            }
+
+            inet_ntop(AF_INET, &(remote_addr.sin_addr), conn_info.server.ip, INET_ADDRSTRLEN);
+            conn_info.server.port = ntohs(remote_addr.sin_port);
+
+            LOG_INFO("Client %s:%u connected to %s:%u", conn_info.client.ip, conn_info.client.port, conn_info.server.ip, conn_info.server.port);
 
-                if (FD_ISSET(client_fd, &fds)) {
-                    bytes_read = recv(client_fd, buffer, BUFFER_SIZE, 0);
+            if (BLACK_LIST.isBlocked(conn_info.server.ip)) {
+                stale = CacheEntryRef();    // the 404 is the answer; never fall back to the cached copy
+                rejectBlocked(client_fd, request, conn_info);
+            }
+
+            std::string res;
+            deadlines.armLifetime(client_fd, remote_fd, CONNECTION_LIFETIME_MS);
+
+            if (request.method == "CONNECT") {
+                deadlines.armIdle(client_fd, remote_fd, TUNNEL_IDLE_TIMEOUT_MS);
+                entry.setState(CONNECTION_TUNNELING);
+                LOG_DEBUG("Connect successful!");
+
+                send(client_fd, CONNECT_ESTABLISHED_RESPONSE, strlen(CONNECT_ESTABLISHED_RESPONSE), 0);
+                response = parseHttpResponse(CONNECT_ESTABLISHED_RESPONSE);
+                conn_info.addTransaction(request, response);
+
+                // The relay sizes its own buffers from the traffic; the request buffer is not needed again.
+                buffer.release(true);
+                relayTunnel(client_fd, remote_fd, request, host, conn_info, deadlines, entry, accepted_at);
+            } else {
+                deadlines.armIdle(client_fd, remote_fd, HTTP_IDLE_TIMEOUT_MS);
+                entry.setState(CONNECTION_FORWARDING);
+                if (!stream && !viaParent) send(remote_fd, upstreamRequest.c_str(), upstreamRequest.size(), 0);
+                metrics.increment(METRIC_BYTES_CLIENT_TO_SERVER, upstreamRequest.size());
+                entry.addBytes(true, upstreamRequest.size());
+
+                // Follow the response framing so the relay ends with the message rather than when the
+                // origin closes or goes idle. Only a complete, untruncated response may be cached.
+                // While a stale copy could still answer instead, the head is held back until its status is known.
+                ResponseTracker tracker(request.method);
+                ResponseCompressor compressor(request);
+                bool storable = cacheable;
+                bool holdHead = bool(stale);
+                bool answeredFromCache = false;
+                while (!tracker.isComplete()) {
+                    ssize_t bytes_read;
+                    if (stream) {
+                        // The idle deadline only watches sockets, so the stream times out on its own.
+                        bytes_read = stream->read(buffer.data(), buffer.capacity(), HTTP_IDLE_TIMEOUT_MS);
+                    } else {
+                        pollfd watched = {};
+                        watched.fd = remote_fd;
+                        watched.events = POLLIN;
+
+                        int activity = POLL_SOCKETS(&watched, 1, -1);
+                        if (activity < 0) {
+                            LOG_ERROR("(Proxy::handleClient) Poll Error: %s", socketErrorText().c_str());
+                            break;
+                        }
+                        bytes_read = recv(remote_fd, buffer.data(), buffer.capacity(), 0);
+                    }
+                    deadlines.touch();
                     if (bytes_read <= 0) break;
-                    send(remote_fd, buffer, bytes_read, 0);
+                    entry.addBytes(false, bytes_read);
+                    if (firstUpstreamByte) {
+                        metrics.record(METRIC_TIME_TO_FIRST_BYTE, std::chrono::steady_clock::now() - accepted_at);
+                        firstUpstreamByte = false;
+                    }
+
+                    bool kept = res.size() + bytes_read <= (cacheable ? DISK_CACHE_MAX_OBJECT_BYTES : CACHE_MAX_OBJECT_BYTES);
+                    if (kept) {
+                        res.append(buffer.data(), bytes_read);
+                    } else {
+                        storable = false;
+                    }
+                    tracker.feed(buffer.data(), bytes_read);
+                    if (inflight) inflight->append(buffer.data(), bytes_read);
+
+                    if (holdHead) {
+                        if (!tracker.hasHead() && kept) continue;
+                        holdHead = false;
+
+                        std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+                        if (revalidate && tracker.statusCode() == 304) {
+                            std::string notModified = tracker.finalResponse(res);
+                            std::shared_ptr<CachedResponse> refreshed = refreshCached(request, stale, notModified);
+                            CacheEntryRef answer;
+                            answer.memory = refreshed;
+                            answeredFromCache = sendCached(client_fd, request, refreshed ? answer : stale, conn_info, accepted_at);
+                            break;
+                        }
+                        if (tracker.statusCode() >= 500 && stale.meta().canServeOnError(now)) {
+                            LOG_WARNING("Origin answered %d, serving stale %s", tracker.statusCode(), HttpCache::cacheKey(request).c_str());
+                            metrics.increment(METRIC_CACHE_STALE_SERVED);
+                            answeredFromCache = sendCached(client_fd, request, stale, conn_info, accepted_at);
+                            break;
+                        }
+
+                        std::string out = compressor.feed(res.data(), res.size());
+                        send(client_fd, out.data(), out.size(), 0);
+                        metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, out.size());
+                        responseStarted = true;
+                        if (kept) continue;
+                    }
 
-                    HttpRequest req = parseHttpRequest(buffer);
-                    countClient = true;
+                    // The cache and any collapsed followers keep the origin's bytes; only this client's
+                    // copy is compressed.
+                    std::string out = compressor.feed(buffer.data(), bytes_read);
+                    send(client_fd, out.data(), out.size(), 0);
+                    metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, out.size());
+                    responseStarted = true;
+                }
+                if (inflight) inflight->finish(tracker.isComplete(true));
+                // A truncated compressed body must not be terminated as if it were whole.
+                if (!answeredFromCache && (tracker.isComplete(true) || !compressor.isActive())) {
+                    std::string out = compressor.finish();
+                    send(client_fd, out.data(), out.size(), 0);
+                    metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, out.size());
                 }
 
-                if (FD_ISSET(remote_fd, &fds)) {
-                    bytes_read = recv(remote_fd, buffer, BUFFER_SIZE, 0);
-                    if (bytes_read <= 0) break;
-                    send(client_fd, buffer, bytes_read, 0);
-                    
-                    response = parseHttpResponse(buffer);
-                    countRemote = true;
+                if (holdHead) {
+                    // The origin went away before a complete head; nothing has reached the client yet.
+                    throw std::runtime_error("Origin closed before sending a response");
                 }
-                if (countClient && countRemote && !conn_info.transactions[0].request.isEncrypted) {
+
+                if (!answeredFromCache) {
+                    if (cacheable) {
+                        metrics.increment(METRIC_CACHE_MISSES);
+                        metrics.increment(METRIC_CACHE_MISS_BYTES, tracker.bytesSeen());
+                        // A body delimited by the connection close is complete once the origin closed it.
+                        if (storable && tracker.isComplete(true)) {
+                            stale = CacheEntryRef();
+                            storeResponse(HttpCache::buildEntry(request, tracker.finalResponse(res)));
+                        }
+                    }
+                    res += "\n";
+                    response = parseHttpResponse(res);
                     conn_info.addTransaction(request, response);
-                    countClient = false;
-                    countRemote = false;
                 }
             }
+        }
+        updateConnections(conn_info);
+    } catch (const std::exception& e) {
+        std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        // stale-if-error: the origin could not be reached, so the expired copy is better than nothing.
+        if (stale && !responseStarted && stale.meta().canServeOnError(now) &&
+            sendCached(client_fd, request, stale, conn_info, accepted_at)) {
+            LOG_WARNING("Serving stale %s after upstream failure: %s", HttpCache::cacheKey(request).c_str(), e.what());
+            metrics.increment(METRIC_CACHE_STALE_SERVED);
+            updateConnections(conn_info);
         } else {
-            send(remote_fd, request.rawRequest.c_str(), request.rawRequest.size(), 0);
-            while (true) {
-                fd_set fds;
-                FD_ZERO(&fds);
-                FD_SET(remote_fd, &fds);
-
-                int activity = select(remote_fd + 1, &fds, NULL, NULL, &timeout);
-                if (activity < 0) {
-                    print_socket_error(ANSI_RED "ERROR (Proxy::handleClient):" ANSI_RESET " Select Error.");
-                    break;
-                } else if (activity == 0) {
-                    std::cout << ANSI_YELLOW << "WARNING: " << ANSI_RESET << "Timeout reached, ending read loop.\n";
-                    break;
+            metrics.increment(METRIC_CONNECTION_ERRORS);
+            LOG_ERROR("Connection from %s:%u ended with exception: %s", conn_info.client.ip, conn_info.client.port, e.what());
+        }
+    }
+
+    // Deadlines and the registry entry must be gone before the descriptors can be reused by another connection.
+    deadlines.cancelAll();
+    entry.reset();
+    if (remote_fd != INVALID_SOCKET) CLOSE_SOCKET(remote_fd);
+    CLOSE_SOCKET(client_fd);
+
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE, -1);
+    metrics.record(METRIC_TOTAL_DURATION, std::chrono::steady_clock::now() - accepted_at);
+}
+
+void Proxy::handleTransparent(socket_t client_fd, sockaddr_in client_addr, std::chrono::steady_clock::time_point accepted_at,
+                              Admission admission, ConnectionEntry entry) {
+    socket_t remote_fd = INVALID_SOCKET;
+    ObjectPool<ConnectionInfo>::Handle pooled_info = ObjectPool<ConnectionInfo>::acquire();
+    ConnectionInfo& conn_info = *pooled_info;
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    bool firstUpstreamByte = true;
+
+    metrics.record(METRIC_ACCEPT_LATENCY, std::chrono::steady_clock::now() - accepted_at);
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE);
+
+    inet_ntop(AF_INET, &(client_addr.sin_addr), conn_info.client.ip, INET_ADDRSTRLEN);
+    conn_info.client.port = ntohs(client_addr.sin_port);
+    conn_info.time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+    ConnectionDeadlines deadlines(timers);
+
+    try {
+        sockaddr_in remote_addr;
+        if (!originalDestination(client_fd, transparent_port, remote_addr)) {
+            throw std::runtime_error("Connection was not redirected to the transparent listener");
+        }
+        inet_ntop(AF_INET, &(remote_addr.sin_addr), conn_info.server.ip, INET_ADDRSTRLEN);
+        conn_info.server.port = ntohs(remote_addr.sin_port);
+
+        // The client believes it is talking to the origin, so the name for the policy comes from
+        // what it sends first. The address it connected to is what gets dialled either way; a
+        // name never redirects the connection elsewhere.
+        std::string opening = readOpening(client_fd);
+        HttpRequest request = parseHttpRequest(opening);
+        bool plaintext = !opening.empty() && !request.isEncrypted && isValidHttpMethod(request.method);
+        std::string name = plaintext ? request.getHeader("Host") : tlsServerName(opening);
+        if (name.empty()) name = conn_info.server.ip;
+        std::string authority = name + ":" + std::to_string(conn_info.server.port);
+        if (plaintext) {
+            if (!request.url.empty() && request.url[0] == '/') request.url = "http://" + authority + request.url;
+        } else {
+            // Recorded the way the same connection through CONNECT would be; the bytes are not parsed.
+            request = HttpRequest();
+            request.method = "CONNECT";
+            request.url = authority;
+            request.httpVersion = "HTTP/1.1";
+            request.addHeader("Host", authority);
+            request.isEncrypted = true;
+        }
+        entry.setTarget(name, conn_info.server.port);
+
+        if (BLACK_LIST.isBlocked(name) || BLACK_LIST.isBlocked(conn_info.server.ip)) {
+            // Only a plaintext client can read the 404; anyone else just sees the connection close.
+            if (plaintext) rejectBlocked(client_fd, request, conn_info);
+            LOG_WARNING("This domain/ip is blocked: %s", name.c_str());
+            metrics.increment(METRIC_REQUESTS_BLOCKED);
+            conn_info.addTransaction(request, parseHttpResponse(BLOCKED_RESPONSE));
+            updateConnections(conn_info);
+            throw std::runtime_error("This domain/ip is blocked!");
+        }
+
+        entry.setState(CONNECTION_CONNECTING);
+        if (parents.routes(name)) {
+            // The parent is chosen by name but asked for the address, for the same reason.
+            sockaddr_in parent_addr;
+            std::string destination = std::string(conn_info.server.ip) + ":" + std::to_string(conn_info.server.port);
+            remote_fd = connectParent(name, destination, std::string(), false, deadlines, &entry, parent_addr);
+        } else {
+            remote_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (remote_fd == INVALID_SOCKET) {
+                LOG_ERROR("(Proxy::handleTransparent) Socket (remote) creation failed: %s", socketErrorText().c_str());
+                throw std::runtime_error("Failed to connect server remote");
+            }
+            entry.setRemote(remote_fd);
+
+            applyUpstreamOptions(remote_fd, *socket_profile.load());
+            auto connect_start = std::chrono::steady_clock::now();
+            deadlines.armConnect(remote_fd);
+            int connected = connect(remote_fd, (struct sockaddr*)&remote_addr, sizeof(remote_addr));
+            deadlines.cancelConnect();
+            if (connected < 0) {
+                LOG_ERROR("(Proxy::handleTransparent) Connect to remote server failed: %s", socketErrorText().c_str());
+                throw std::runtime_error("Failed to connect server remote");
+            }
+            metrics.record(METRIC_CONNECT_LATENCY, std::chrono::steady_clock::now() - connect_start);
+        }
+
+        LOG_INFO("Client %s:%u redirected to %s (%s)", conn_info.client.ip, conn_info.client.port, authority.c_str(), conn_info.server.ip);
+
+        if (!opening.empty()) {
+            int flags = 0;
+#ifdef MSG_NOSIGNAL
+            flags = MSG_NOSIGNAL;
+#endif
+            if (send(remote_fd, opening.data(), opening.size(), flags) != ssize_t(opening.size())) {
+                throw std::runtime_error("Failed to send to server remote");
+            }
+            metrics.increment(METRIC_BYTES_CLIENT_TO_SERVER, opening.size());
+            entry.addBytes(true, opening.size());
+        }
+
+        deadlines.armLifetime(client_fd, remote_fd, CONNECTION_LIFETIME_MS);
+        deadlines.armIdle(client_fd, remote_fd, plaintext ? HTTP_IDLE_TIMEOUT_MS : TUNNEL_IDLE_TIMEOUT_MS);
+        entry.setState(CONNECTION_TUNNELING);
+
+        RateLimit rateLimit = shaper.limit(conn_info.client.ip, name);
+        // A plaintext exchange is recorded from the first chunk in each direction after the previous
+        // one ended, so body chunks are never taken for a request or a response. Once a 101 switches
+        // protocols nothing further is HTTP.
+        bool awaitingResponse = plaintext;
+        bool awaitingRequest = false;
+        TunnelRelay relay(client_fd, remote_fd, [&](bool upstream, const char* data, size_t length) {
+            deadlines.touch();
+            entry.addBytes(upstream, length);
+            if (upstream) {
+                metrics.increment(METRIC_BYTES_CLIENT_TO_SERVER, length);
+                if (awaitingRequest) {
+                    // Later requests on a kept-alive connection are recorded under their own line.
+                    HttpRequest next = parseHttpRequest(messageHead(data, length));
+                    if (isValidHttpMethod(next.method)) {
+                        if (!next.url.empty() && next.url[0] == '/') next.url = "http://" + authority + next.url;
+                        request = next;
+                        awaitingResponse = true;
+                    }
+                    awaitingRequest = false;
                 }
+                return;
+            }
+            if (firstUpstreamByte) {
+                metrics.record(METRIC_TIME_TO_FIRST_BYTE, std::chrono::steady_clock::now() - accepted_at);
+                firstUpstreamByte = false;
+            }
+            metrics.increment(METRIC_BYTES_SERVER_TO_CLIENT, length);
+            if (awaitingResponse) {
+                HttpResponse response = parseHttpResponse(messageHead(data, length));
+                // 100 Continue comes before the response proper, on its own.
+                if (response.statusCode >= 100 && response.statusCode < 200 && response.statusCode != 101) return;
+                if (response.statusCode != 0) conn_info.addTransaction(request, response);
+                awaitingResponse = false;
+                awaitingRequest = plaintext && response.statusCode != 101;
+            }
+        }, rateLimit);
+        relay.run([this] { return running; });
 
-                ssize_t bytes_read = recv(remote_fd, buffer, BUFFER_SIZE, 0);
-                if (bytes_read <= 0) break;
-                send(client_fd, buffer, bytes_read, 0); 
+        if (conn_info.transactions.empty()) conn_info.addTransaction(request, HttpResponse());
+        updateConnections(conn_info);
+    } catch (const std::exception& e) {
+        metrics.increment(METRIC_CONNECTION_ERRORS);
+        LOG_ERROR("Connection from %s:%u ended with exception: %s", conn_info.client.ip, conn_info.client.port, e.what());
+    }
+
+    // Deadlines and the registry entry must be gone before the descriptors can be reused by another connection.
+    deadlines.cancelAll();
+    entry.reset();
+    if (remote_fd != INVALID_SOCKET) CLOSE_SOCKET(remote_fd);
+    CLOSE_SOCKET(client_fd);
+
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE, -1);
+    metrics.record(METRIC_TOTAL_DURATION, std::chrono::steady_clock::now() - accepted_at);
+}
+
+// A SOCKS reply as recorded next to the request it answered.
+static HttpResponse socksResponse(SocksReply reply, const char* reason) {
+    HttpResponse response;
+    response.httpVersion = "SOCKS5";
+    response.statusCode = reply;
+    response.reasonPhrase = reason;
+    return response;
+}
+
+void Proxy::handleSocks(socket_t client_fd, sockaddr_in client_addr, std::chrono::steady_clock::time_point accepted_at,
+                        Admission admission, ConnectionEntry entry) {
+    socket_t remote_fd = INVALID_SOCKET;
+    ObjectPool<ConnectionInfo>::Handle pooled_info = ObjectPool<ConnectionInfo>::acquire();
+    ConnectionInfo& conn_info = *pooled_info;
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+
+    metrics.record(METRIC_ACCEPT_LATENCY, std::chrono::steady_clock::now() - accepted_at);
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE);
+
+    inet_ntop(AF_INET, &(client_addr.sin_addr), conn_info.client.ip, INET_ADDRSTRLEN);
+    conn_info.client.port = ntohs(client_addr.sin_port);
+    conn_info.time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+    ConnectionDeadlines deadlines(timers);
+
+    try {
+        deadlines.armHeaderRead(client_fd);
+        SocksRequest target = socksHandshake(client_fd, socks_users);
+        deadlines.cancelHeaderRead();
+
+        // Recorded as the HTTP CONNECT it stands for. What goes through is opaque, as it is for a
+        // transparent connection that is not plaintext HTTP, so the relay parses none of it.
+        std::string authority = target.authority();
+        HttpRequest request;
+        request.method = "CONNECT";
+        request.url = authority;
+        request.httpVersion = "SOCKS5";
+        request.addHeader("Host", authority);
+        request.isEncrypted = true;
+        conn_info.server.port = target.port;
+        entry.setTarget(authority, target.port);
+
+        auto refuse = [&](const std::string& blocked) {
+            LOG_WARNING("This domain/ip is blocked: %s", blocked.c_str());
+            metrics.increment(METRIC_REQUESTS_BLOCKED);
+            socksReply(client_fd, SOCKS_NOT_ALLOWED);
+            conn_info.addTransaction(request, socksResponse(SOCKS_NOT_ALLOWED, "connection not allowed by ruleset"));
+            updateConnections(conn_info);
+            throw std::runtime_error("This domain/ip is blocked!");
+        };
+        if (BLACK_LIST.isBlocked(target.host)) refuse(target.host);
 
-                res += buffer;
+        if (parents.routes(target.host)) {
+            // The parent resolves the name; the blocklist has already seen it.
+            entry.setState(CONNECTION_CONNECTING);
+            sockaddr_in parent_addr;
+            try {
+                remote_fd = connectParent(target.host, authority, std::string(), false, deadlines, &entry, parent_addr);
+            } catch (const std::exception&) {
+                socksReply(client_fd, SOCKS_HOST_UNREACHABLE);
+                throw;
+            }
+            inet_ntop(AF_INET, &(parent_addr.sin_addr), conn_info.server.ip, INET_ADDRSTRLEN);
+        } else {
+            // A name may resolve to IPv4 and IPv6 addresses alike; they are tried in the resolver's order.
+            std::vector<sockaddr_storage> candidates;
+            if (target.family != AF_UNSPEC) {
+                candidates.push_back(target.address);
+            } else {
+                entry.setState(CONNECTION_RESOLVING);
+                addrinfo hints = {};
+                hints.ai_family = AF_UNSPEC;
+                hints.ai_socktype = SOCK_STREAM;
+                addrinfo* found = nullptr;
+                auto dns_start = std::chrono::steady_clock::now();
+                int resolved = getaddrinfo(target.host.c_str(), std::to_string(target.port).c_str(), &hints, &found);
+                metrics.record(METRIC_DNS_LATENCY, std::chrono::steady_clock::now() - dns_start);
+                if (resolved != 0) {
+                    LOG_ERROR("(Proxy::handleSocks) Failed to resolve %s: %s", target.host.c_str(), gai_strerror(resolved));
+                    socksReply(client_fd, SOCKS_HOST_UNREACHABLE);
+                    throw std::runtime_error("Failed to connect server remote");
+                }
+                for (addrinfo* address = found; address; address = address->ai_next) {
+                    sockaddr_storage candidate = {};
+                    memcpy(&candidate, address->ai_addr, address->ai_addrlen);
+                    candidates.push_back(candidate);
+                }
+                freeaddrinfo(found);
+            }
+
+            std::vector<std::string> addresses;
+            for (const sockaddr_storage& candidate : candidates) {
+                char ip[INET6_ADDRSTRLEN] = {};
+                getnameinfo((const sockaddr*)&candidate, sizeof(candidate), ip, sizeof(ip), NULL, 0, NI_NUMERICHOST);
+                if (BLACK_LIST.isBlocked(ip)) refuse(ip);
+                addresses.push_back(ip);
+            }
+
+            entry.setState(CONNECTION_CONNECTING);
+            int connectError = 0;
+            for (size_t i = 0; i < candidates.size() && remote_fd == INVALID_SOCKET; i++) {
+                const sockaddr_storage& candidate = candidates[i];
+                remote_fd = socket(candidate.ss_family, SOCK_STREAM, 0);
+                if (remote_fd == INVALID_SOCKET) {
+                    connectError = SOCKET_ERROR_CODE;
+                    continue;
+                }
+                entry.setRemote(remote_fd);
+                applyUpstreamOptions(remote_fd, *socket_profile.load());
+
+                auto connect_start = std::chrono::steady_clock::now();
+                deadlines.armConnect(remote_fd);
+                socklen_t length = candidate.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+                int connected = connect(remote_fd, (const sockaddr*)&candidate, length);
+                connectError = SOCKET_ERROR_CODE;
+                deadlines.cancelConnect();
+                if (connected == 0) {
+                    metrics.record(METRIC_CONNECT_LATENCY, std::chrono::steady_clock::now() - connect_start);
+                    strncpy(conn_info.server.ip, addresses[i].c_str(), sizeof(conn_info.server.ip) - 1);
+                    break;
+                }
+                LOG_WARNING("(Proxy::handleSocks) Connect to %s failed: %s", addresses[i].c_str(), socketErrorText().c_str());
+                entry.setRemote(INVALID_SOCKET);
+                CLOSE_SOCKET(remote_fd);
+                remote_fd = INVALID_SOCKET;
+            }
+            if (remote_fd == INVALID_SOCKET) {
+                socksReply(client_fd, socksReplyForError(connectError));
+                throw std::runtime_error("Failed to connect server remote");
             }
-            res += "\n";
-            response = parseHttpResponse(res);
-            conn_info.addTransaction(request, response);
         }
+
+        LOG_INFO("SOCKS client %s:%u connected to %s (%s)", conn_info.client.ip, conn_info.client.port, authority.c_str(), conn_info.server.ip);
+
+        socksReply(client_fd, SOCKS_SUCCEEDED, remote_fd);
+        conn_info.addTransaction(request, socksResponse(SOCKS_SUCCEEDED, "succeeded"));
+
+        deadlines.armLifetime(client_fd, remote_fd, CONNECTION_LIFETIME_MS);
+        deadlines.armIdle(client_fd, remote_fd, TUNNEL_IDLE_TIMEOUT_MS);
+        entry.setState(CONNECTION_TUNNELING);
+        relayTunnel(client_fd, remote_fd, request, target.host, conn_info, deadlines, entry, accepted_at);
         updateConnections(conn_info);
     } catch (const std::exception& e) {
-        if (remote_fd != INVALID_SOCKET) CLOSE_SOCKET(remote_fd);
-        CLOSE_SOCKET(client_fd);
-        std::cerr << ANSI_RED << "[ " << std::ctime(&conn_info.time) << " ] " << "- Program throw exception: " << e.what() << "\n";
+        metrics.increment(METRIC_CONNECTION_ERRORS);
+        LOG_ERROR("Connection from %s:%u ended with exception: %s", conn_info.client.ip, conn_info.client.port, e.what());
     }
 
+    // Deadlines and the registry entry must be gone before the descriptors can be reused by another connection.
+    deadlines.cancelAll();
+    entry.reset();
     if (remote_fd != INVALID_SOCKET) CLOSE_SOCKET(remote_fd);
     CLOSE_SOCKET(client_fd);
-}
\ No newline at end of file
+
+    metrics.increment(METRIC_CONNECTIONS_ACTIVE, -1);
+    metrics.record(METRIC_TOTAL_DURATION, std::chrono::steady_clock::now() - accepted_at);
+}
@@ -0,0 +1,187 @@
+#include "../include/socks5.h"
+#include "../include/http_parser.h"
+#include "../include/logger.h"
+
+#define SOCKS_VERSION 0x05
+#define SOCKS_AUTH_VERSION 0x01             // of the username/password subnegotiation
+#define SOCKS_METHOD_NONE 0x00
+#define SOCKS_METHOD_PASSWORD 0x02
+#define SOCKS_METHOD_UNACCEPTABLE 0xFF
+#define SOCKS_COMMAND_CONNECT 0x01
+#define SOCKS_ADDRESS_IPV4 0x01
+#define SOCKS_ADDRESS_DOMAIN 0x03
+#define SOCKS_ADDRESS_IPV6 0x04
+
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+// The handshake is a strict exchange, so it reads exactly what each step holds and never takes
+// tunnel bytes a client sent early along with it.
+static void readExactly(socket_t fd, unsigned char* out, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t received = recv(fd, (char*)out + done, length - done, 0);
+        if (received <= 0) throw std::runtime_error("Client closed during the SOCKS handshake");
+        done += size_t(received);
+    }
+}
+
+static void sendAll(socket_t fd, const unsigned char* data, size_t length) {
+    if (send(fd, (const char*)data, length, SEND_FLAGS) != ssize_t(length)) {
+        throw std::runtime_error("Failed to answer the SOCKS client");
+    }
+}
+
+std::string SocksRequest::authority() const {
+    std::string name = family == AF_INET6 ? "[" + host + "]" : host;
+    return name + ":" + std::to_string(port);
+}
+
+// ----------------- SocksUsers -----------------
+void SocksUsers::load(const char* file) {
+    std::ifstream in(file);
+    if (!in.is_open()) return;
+    std::string line;
+    while (std::getline(in, line)) {
+        trimNewlineChars(line);
+        size_t colon = line.find(':');
+        if (line.empty() || line[0] == '#' || colon == std::string::npos) continue;
+        passwords[line.substr(0, colon)] = line.substr(colon + 1);
+    }
+    LOG_INFO("Loaded %zu SOCKS users from %s", passwords.size(), file);
+}
+
+bool SocksUsers::check(const std::string& user, const std::string& password) const {
+    auto it = passwords.find(user);
+    return it != passwords.end() && it->second == password;
+}
+
+// ----------------- Handshake -----------------
+SocksRequest socksHandshake(socket_t client_fd, const SocksUsers& users) {
+    unsigned char head[2];
+    readExactly(client_fd, head, 2);
+    if (head[0] != SOCKS_VERSION) throw std::runtime_error("Not a SOCKS5 client");
+    unsigned char methods[255];
+    readExactly(client_fd, methods, head[1]);
+
+    // With users configured, only the password method is good enough.
+    unsigned char wanted = users.empty() ? SOCKS_METHOD_NONE : SOCKS_METHOD_PASSWORD;
+    unsigned char chosen = SOCKS_METHOD_UNACCEPTABLE;
+    for (int i = 0; i < head[1]; i++) {
+        if (methods[i] == wanted) chosen = wanted;
+    }
+    unsigned char selection[2] = {SOCKS_VERSION, chosen};
+    sendAll(client_fd, selection, sizeof(selection));
+    if (chosen == SOCKS_METHOD_UNACCEPTABLE) throw std::runtime_error("SOCKS client offered no acceptable method");
+
+    if (chosen == SOCKS_METHOD_PASSWORD) {
+        unsigned char field[256];
+        readExactly(client_fd, head, 2);
+        if (head[0] != SOCKS_AUTH_VERSION) throw std::runtime_error("Unknown SOCKS authentication version");
+        readExactly(client_fd, field, head[1]);
+        std::string user((const char*)field, head[1]);
+        readExactly(client_fd, field, 1);
+        size_t passwordLength = field[0];
+        readExactly(client_fd, field, passwordLength);
+        std::string password((const char*)field, passwordLength);
+
+        bool accepted = users.check(user, password);
+        unsigned char status[2] = {SOCKS_AUTH_VERSION, (unsigned char)(accepted ? 0x00 : 0x01)};
+        sendAll(client_fd, status, sizeof(status));
+        if (!accepted) throw std::runtime_error("SOCKS authentication failed for " + user);
+    }
+
+    // VER CMD RSV ATYP, then the address and port.
+    unsigned char request[4];
+    readExactly(client_fd, request, 4);
+    if (request[0] != SOCKS_VERSION) throw std::runtime_error("Not a SOCKS5 request");
+
+    SocksRequest target;
+    unsigned char address[256];
+    char text[INET6_ADDRSTRLEN];
+    switch (request[3]) {
+        case SOCKS_ADDRESS_IPV4: {
+            sockaddr_in& ipv4 = *(sockaddr_in*)&target.address;
+            readExactly(client_fd, address, 4);
+            ipv4.sin_family = AF_INET;
+            memcpy(&ipv4.sin_addr, address, 4);
+            inet_ntop(AF_INET, &ipv4.sin_addr, text, sizeof(text));
+            target.family = AF_INET;
+            target.host = text;
+            break;
+        }
+        case SOCKS_ADDRESS_IPV6: {
+            sockaddr_in6& ipv6 = *(sockaddr_in6*)&target.address;
+            readExactly(client_fd, address, 16);
+            ipv6.sin6_family = AF_INET6;
+            memcpy(&ipv6.sin6_addr, address, 16);
+            inet_ntop(AF_INET6, &ipv6.sin6_addr, text, sizeof(text));
+            target.family = AF_INET6;
+            target.host = text;
+            break;
+        }
+        case SOCKS_ADDRESS_DOMAIN:
+            readExactly(client_fd, address, 1);
+            target.host.resize(address[0]);
+            readExactly(client_fd, (unsigned char*)&target.host[0], address[0]);
+            break;
+        default:
+            socksReply(client_fd, SOCKS_ADDRESS_NOT_SUPPORTED);
+            throw std::runtime_error("Unknown SOCKS address type");
+    }
+    unsigned char port[2];
+    readExactly(client_fd, port, 2);
+    target.port = uint16_t((port[0] << 8) | port[1]);
+    if (target.family == AF_INET) ((sockaddr_in*)&target.address)->sin_port = htons(target.port);
+    if (target.family == AF_INET6) ((sockaddr_in6*)&target.address)->sin6_port = htons(target.port);
+
+    // BIND and UDP ASSOCIATE would need listeners of their own.
+    if (request[1] != SOCKS_COMMAND_CONNECT) {
+        socksReply(client_fd, SOCKS_COMMAND_NOT_SUPPORTED);
+        throw std::runtime_error("Unsupported SOCKS command");
+    }
+    return target;
+}
+
+void socksReply(socket_t client_fd, SocksReply reply, socket_t remote_fd) {
+    // VER REP RSV ATYP BND.ADDR BND.PORT; a failure names no address.
+    unsigned char message[4 + 16 + 2] = {SOCKS_VERSION, (unsigned char)reply, 0x00, SOCKS_ADDRESS_IPV4};
+    size_t length = 4 + 4 + 2;
+
+    sockaddr_storage bound;
+    socklen_t boundLength = sizeof(bound);
+    if (remote_fd != INVALID_SOCKET && getsockname(remote_fd, (sockaddr*)&bound, &boundLength) == 0) {
+        if (bound.ss_family == AF_INET6) {
+            const sockaddr_in6& ipv6 = (const sockaddr_in6&)bound;
+            message[3] = SOCKS_ADDRESS_IPV6;
+            memcpy(message + 4, &ipv6.sin6_addr, 16);
+            memcpy(message + 20, &ipv6.sin6_port, 2);
+            length = 4 + 16 + 2;
+        } else {
+            const sockaddr_in& ipv4 = (const sockaddr_in&)bound;
+            memcpy(message + 4, &ipv4.sin_addr, 4);
+            memcpy(message + 8, &ipv4.sin_port, 2);
+        }
+    }
+    sendAll(client_fd, message, length);
+}
+
+SocksReply socksReplyForError(int error) {
+    switch (error) {
+#if IS_WINDOWS
+        case WSAECONNREFUSED: return SOCKS_CONNECTION_REFUSED;
+        case WSAENETUNREACH:  return SOCKS_NETWORK_UNREACHABLE;
+        case WSAEHOSTUNREACH:
+        case WSAETIMEDOUT:    return SOCKS_HOST_UNREACHABLE;
+#else
+        case ECONNREFUSED:    return SOCKS_CONNECTION_REFUSED;
+        case ENETUNREACH:     return SOCKS_NETWORK_UNREACHABLE;
+        case EHOSTUNREACH:
+        case ETIMEDOUT:       return SOCKS_HOST_UNREACHABLE;
+#endif
+        default:              return SOCKS_GENERAL_FAILURE;
+    }
+}
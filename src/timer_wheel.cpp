@@ -0,0 +1,155 @@
+#include "../include/timer_wheel.h"
+
+// ----------------- TimerWheel -----------------
+TimerWheel::TimerWheel(uint64_t startTick) : currentTick(startTick), count(0) {
+    for (auto& level : slots) {
+        for (auto& head : level) {
+            head.prev = &head;
+            head.next = &head;
+        }
+    }
+}
+
+void TimerWheel::place(TimerNode* node) {
+    // Deadlines beyond the wheel's horizon are parked in the top level and re-placed on cascade.
+    const uint64_t horizon = (uint64_t(1) << (SLOT_BITS * LEVELS)) - (uint64_t(1) << (SLOT_BITS * (LEVELS - 1)));
+    uint64_t expiry = std::max(node->expiry, currentTick);
+    expiry = std::min(expiry, currentTick + horizon - 1);
+
+    int level = 0;
+    while (level < LEVELS - 1 && (expiry >> (SLOT_BITS * (level + 1))) != (currentTick >> (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    TimerNode* head = &slots[level][(expiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void TimerWheel::insert(TimerNode* node, uint64_t expiryTick) {
+    if (node->isArmed()) cancel(node);
+    // The current tick's slot has already been processed.
+    node->expiry = std::max(expiryTick, currentTick + 1);
+    place(node);
+    count++;
+}
+
+void TimerWheel::cancel(TimerNode* node) {
+    if (!node->isArmed()) return;
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = nullptr;
+    node->next = nullptr;
+    count--;
+}
+
+void TimerWheel::cascade(int level) {
+    TimerNode* head = &slots[level][(currentTick >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    TimerNode* node = head->next;
+    head->prev = head;
+    head->next = head;
+
+    while (node != head) {
+        TimerNode* next = node->next;
+        place(node);
+        node = next;
+    }
+}
+
+void TimerWheel::advance(uint64_t tick, std::vector<TimerNode*>& expired) {
+    while (currentTick < tick) {
+        currentTick++;
+
+        for (int level = 1; level < LEVELS; level++) {
+            if ((currentTick & ((1ULL << (SLOT_BITS * level)) - 1)) != 0) break;
+            cascade(level);
+        }
+
+        TimerNode* head = &slots[0][currentTick & (SLOTS - 1)];
+        while (head->next != head) {
+            TimerNode* node = head->next;
+            cancel(node);
+            if (node->expiry > currentTick) {
+                // Was clamped to the horizon; not due yet.
+                insert(node, node->expiry);
+            } else {
+                expired.push_back(node);
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::now() const {
+    return currentTick;
+}
+
+size_t TimerWheel::size() const {
+    return count;
+}
+
+// ----------------- TimerService -----------------
+TimerService::TimerService() : wheel(0), epoch(std::chrono::steady_clock::now()), running(false) {}
+
+TimerService::~TimerService() {
+    stop();
+}
+
+uint64_t TimerService::currentTick() const {
+    auto elapsed = std::chrono::steady_clock::now() - epoch;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / TIMER_TICK_MS;
+}
+
+void TimerService::start() {
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    if (running) return;
+    running = true;
+    worker = std::thread(&TimerService::run, this);
+}
+
+void TimerService::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wheel_mutex);
+        if (!running) return;
+        running = false;
+    }
+    wake_cv.notify_one();
+    if (worker.joinable()) worker.join();
+}
+
+void TimerService::schedule(TimerNode* node, uint64_t delayMs, std::function<uint64_t()> callback) {
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    node->callback = std::move(callback);
+    // Round up so a deadline never fires early.
+    wheel.insert(node, currentTick() + (delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS);
+}
+
+void TimerService::cancel(TimerNode* node) {
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    wheel.cancel(node);
+}
+
+size_t TimerService::pending() {
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    return wheel.size();
+}
+
+void TimerService::run() {
+    std::vector<TimerNode*> expired;
+    std::unique_lock<std::mutex> lock(wheel_mutex);
+    while (running) {
+        wake_cv.wait_for(lock, std::chrono::milliseconds(TIMER_TICK_MS));
+        if (!running) break;
+
+        expired.clear();
+        uint64_t tick = currentTick();
+        wheel.advance(tick, expired);
+        for (TimerNode* node : expired) {
+            uint64_t again = node->callback ? node->callback() : 0;
+            if (again > 0) {
+                wheel.insert(node, tick + (again + TIMER_TICK_MS - 1) / TIMER_TICK_MS);
+            }
+        }
+    }
+}
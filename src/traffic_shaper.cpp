@@ -0,0 +1,69 @@
+#include "../include/traffic_shaper.h"
+#include "../include/metrics.h"
+
+static int64_t steadyNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------- TokenBucket -----------------
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst)
+    : rate(int64_t(rate)), tolerance(int64_t(burst * 1000000000ULL / rate)), paidOff(0) {}
+
+int64_t TokenBucket::charge(size_t bytes, int64_t now) {
+    int64_t cost = int64_t(bytes) * 1000000000LL / rate;
+    int64_t current = paidOff.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+        // An idle bucket refills up to the burst and no further.
+        next = std::max(current, now - tolerance) + cost;
+    } while (!paidOff.compare_exchange_weak(current, next, std::memory_order_relaxed));
+    return std::max<int64_t>(0, next - now);
+}
+
+// ----------------- RateLimit -----------------
+RateLimit::RateLimit(std::shared_ptr<TokenBucket> global, std::shared_ptr<TokenBucket> client, std::shared_ptr<TokenBucket> host)
+    : buckets{std::move(global), std::move(client), std::move(host)} {}
+
+std::chrono::milliseconds RateLimit::charge(size_t bytes) {
+    if (bytes == 0 || (!buckets[0] && !buckets[1] && !buckets[2])) return std::chrono::milliseconds(0);
+
+    int64_t now = steadyNanos();
+    int64_t wait = 0;
+    for (const auto& bucket : buckets) {
+        if (bucket) wait = std::max(wait, bucket->charge(bytes, now));
+    }
+    std::chrono::milliseconds delay = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds(wait));
+    if (delay.count() > 0) MetricsRegistry::instance().increment(METRIC_TRANSFERS_THROTTLED);
+    return delay;
+}
+
+// ----------------- TrafficShaper -----------------
+TrafficShaper::TrafficShaper() {
+    if (SHAPING_GLOBAL_RATE > 0) global = std::make_shared<TokenBucket>(SHAPING_GLOBAL_RATE, SHAPING_GLOBAL_BURST);
+}
+
+std::shared_ptr<TokenBucket> TrafficShaper::find(std::unordered_map<std::string, std::weak_ptr<TokenBucket>>& buckets,
+                                                 const std::string& key, uint64_t rate, uint64_t burst) {
+    if (rate == 0) return nullptr;
+    std::shared_ptr<TokenBucket> bucket = buckets[key].lock();
+    if (bucket) return bucket;
+
+    bucket = std::make_shared<TokenBucket>(rate, burst);
+    buckets[key] = bucket;
+    // Buckets nobody draws from any more are swept each time the table reaches a power of two.
+    size_t size = buckets.size();
+    if (size >= 64 && (size & (size - 1)) == 0) {
+        for (auto it = buckets.begin(); it != buckets.end();) {
+            it = it->second.expired() ? buckets.erase(it) : std::next(it);
+        }
+    }
+    return bucket;
+}
+
+RateLimit TrafficShaper::limit(const std::string& client_ip, const std::string& host) {
+    size_t colon = host.find_last_of(':');
+    std::string hostName = colon != std::string::npos && host.find(']', colon) == std::string::npos ? host.substr(0, colon) : host;
+    std::lock_guard<std::mutex> lock(mutex);
+    return RateLimit(global, find(clients, client_ip, SHAPING_CLIENT_RATE, SHAPING_CLIENT_BURST),
+                     find(hosts, hostName, SHAPING_HOST_RATE, SHAPING_HOST_BURST));
+}
@@ -0,0 +1,105 @@
+#include "../include/transparent.h"
+#include "../include/http_parser.h"
+
+#ifdef __linux__
+#include <linux/netfilter_ipv4.h>
+#endif
+
+#define TLS_RECORD_HEADER 5
+#define TLS_HANDSHAKE_CLIENT_HELLO 1
+#define TLS_EXTENSION_SERVER_NAME 0
+
+bool originalDestination(socket_t client_fd, int listen_port, sockaddr_in& destination) {
+#ifdef __linux__
+    sockaddr_in local;
+    socklen_t length = sizeof(local);
+    if (getsockname(client_fd, (sockaddr*)&local, &length) < 0) return false;
+    // With conntrack loaded the lookup also answers for connections nothing rewrote, with the
+    // address they were made to.
+    length = sizeof(destination);
+    if (getsockopt(client_fd, SOL_IP, SO_ORIGINAL_DST, &destination, &length) < 0) destination = local;
+    return ntohs(destination.sin_port) != listen_port || destination.sin_addr.s_addr != local.sin_addr.s_addr;
+#else
+    (void)client_fd;
+    (void)listen_port;
+    (void)destination;
+    return false;
+#endif
+}
+
+// Whether `opening` already holds everything readOpening waits for.
+static bool openingComplete(const std::string& opening) {
+    if (isSSLorTLS(opening)) {
+        if (opening.size() < TLS_RECORD_HEADER) return false;
+        size_t record = ((unsigned char)opening[3] << 8) | (unsigned char)opening[4];
+        return opening.size() >= TLS_RECORD_HEADER + record;
+    }
+    // Request methods are upper-case words; anything else is not worth waiting for.
+    if (opening[0] < 'A' || opening[0] > 'Z') return true;
+    return opening.find("\r\n\r\n") != std::string::npos;
+}
+
+std::string readOpening(socket_t client_fd) {
+    std::string opening;
+    char buffer[4096];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TRANSPARENT_SNIFF_MS);
+    while (opening.size() < TRANSPARENT_SNIFF_BYTES) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0 || !wait_readable(client_fd, int(left))) break;
+
+        size_t room = std::min(sizeof(buffer), size_t(TRANSPARENT_SNIFF_BYTES) - opening.size());
+        ssize_t received = recv(client_fd, buffer, room, 0);
+        // A close or an error shows up again once the relay reads the socket.
+        if (received <= 0) break;
+        opening.append(buffer, size_t(received));
+        if (openingComplete(opening)) break;
+    }
+    return opening;
+}
+
+std::string tlsServerName(const std::string& opening) {
+    const unsigned char* data = (const unsigned char*)opening.data();
+    size_t end = opening.size();
+    if (!isSSLorTLS(opening) || end < TLS_RECORD_HEADER) return "";
+    end = std::min(end, TLS_RECORD_HEADER + ((size_t(data[3]) << 8) | data[4]));
+
+    // Handshake header, client version and random, then the variable-length fields in front of
+    // the extensions.
+    size_t pos = TLS_RECORD_HEADER;
+    if (pos + 4 + 2 + 32 > end || data[pos] != TLS_HANDSHAKE_CLIENT_HELLO) return "";
+    pos += 4 + 2 + 32;
+    auto skip = [&](size_t lengthBytes) {
+        if (pos + lengthBytes > end) return false;
+        size_t length = lengthBytes == 1 ? data[pos] : (size_t(data[pos]) << 8) | data[pos + 1];
+        pos += lengthBytes + length;
+        return pos <= end;
+    };
+    if (!skip(1) || !skip(2) || !skip(1)) return "";          // session id, cipher suites, compression
+    if (pos + 2 > end) return "";
+    size_t extensionsEnd = std::min(end, pos + 2 + ((size_t(data[pos]) << 8) | data[pos + 1]));
+    pos += 2;
+
+    while (pos + 4 <= extensionsEnd) {
+        size_t type = (size_t(data[pos]) << 8) | data[pos + 1];
+        size_t length = (size_t(data[pos + 2]) << 8) | data[pos + 3];
+        pos += 4;
+        if (pos + length > extensionsEnd) return "";
+        if (type != TLS_EXTENSION_SERVER_NAME) {
+            pos += length;
+            continue;
+        }
+        // A list of names, of which only host names (type 0) are defined.
+        size_t listEnd = pos + length;
+        pos += 2;
+        while (pos + 3 <= listEnd) {
+            size_t nameType = data[pos];
+            size_t nameLength = (size_t(data[pos + 1]) << 8) | data[pos + 2];
+            pos += 3;
+            if (pos + nameLength > listEnd) return "";
+            if (nameType == 0) return std::string((const char*)data + pos, nameLength);
+            pos += nameLength;
+        }
+        return "";
+    }
+    return "";
+}
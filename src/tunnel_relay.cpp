@@ -0,0 +1,154 @@
+#include "../include/tunnel_relay.h"
+#include "../include/logger.h"
+
+void tuneTunnelSocket(socket_t fd) {
+    if (TUNNEL_SEND_BUFFER > 0) {
+        int size = TUNNEL_SEND_BUFFER;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char*)&size, sizeof(size));
+    }
+#ifdef TCP_NOTSENT_LOWAT
+    if (TUNNEL_NOTSENT_LOWAT > 0) {
+        // Keeps unsent data in the kernel to a bound, so the socket reports writable, and the relay
+        // reads more, only once the peer is close to needing it.
+        int lowat = TUNNEL_NOTSENT_LOWAT;
+        setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char*)&lowat, sizeof(lowat));
+    }
+#endif
+}
+
+// ----------------- TunnelRelay -----------------
+TunnelRelay::TunnelRelay(socket_t client_fd, socket_t remote_fd, DataHandler onData, RateLimit& rateLimit)
+    : onData(std::move(onData)), rateLimit(rateLimit) {
+    directions[0].from = client_fd;
+    directions[0].to = remote_fd;
+    directions[0].upstream = true;
+    directions[1].from = remote_fd;
+    directions[1].to = client_fd;
+    directions[1].upstream = false;
+}
+
+bool TunnelRelay::run(const std::function<bool()>& proceed) {
+    for (Direction& direction : directions) {
+        set_socket_blocking(direction.from, false);
+        tuneTunnelSocket(direction.from);
+    }
+
+    while (proceed()) {
+        if (directions[0].passedOn && directions[1].passedOn) return true;
+
+        // directions[i] reads from the socket at watched[slots[i]] and writes to the other one.
+        // Sockets nobody waits on are left out, so a hung-up peer cannot keep waking the relay.
+        pollfd watched[2];
+        int slots[2];
+        int count = 0;
+        auto now = std::chrono::steady_clock::now();
+        auto wakeAt = std::chrono::steady_clock::time_point::max();
+        for (int i = 0; i < 2; i++) {
+            Direction& direction = directions[i];
+            short events = 0;
+            if (!direction.finished && room(direction) > 0) {
+                if (direction.resumeAt <= now) {
+                    events |= POLLIN;
+                } else {
+                    wakeAt = std::min(wakeAt, direction.resumeAt);
+                }
+            }
+            if (directions[1 - i].start < directions[1 - i].end) events |= POLLOUT;
+            slots[i] = -1;
+            if (events == 0) continue;
+            watched[count].fd = direction.from;
+            watched[count].events = events;
+            watched[count].revents = 0;
+            slots[i] = count++;
+        }
+
+        int timeout = -1;
+        if (wakeAt != std::chrono::steady_clock::time_point::max()) {
+            auto wait = std::chrono::duration_cast<std::chrono::microseconds>(wakeAt - now).count();
+            timeout = int((wait + 999) / 1000);
+        }
+        if (count == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+            continue;
+        }
+
+        int activity = POLL_SOCKETS(watched, count, timeout);
+        if (activity < 0) {
+            if (socket_would_block()) continue;
+            LOG_ERROR("(TunnelRelay::run) Poll Error: %s", socketErrorText().c_str());
+            return false;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            Direction& direction = directions[i];
+            const short done = POLLHUP | POLLERR;
+            int to = slots[1 - i];
+            if (to >= 0 && (watched[to].events & POLLOUT) && (watched[to].revents & (POLLOUT | done)) && !flush(direction)) {
+                return false;
+            }
+            int from = slots[i];
+            if (from >= 0 && (watched[from].events & POLLIN) && (watched[from].revents & (POLLIN | done)) && !fill(direction)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t TunnelRelay::room(const Direction& direction) {
+    return (direction.buffer.empty() ? direction.capacity : direction.buffer.capacity()) - direction.end;
+}
+
+bool TunnelRelay::fill(Direction& direction) {
+    if (direction.buffer.empty()) direction.buffer.acquire(direction.capacity);
+    size_t room = TunnelRelay::room(direction);
+    ssize_t received = recv(direction.from, direction.buffer.data() + direction.end, room, 0);
+    if (received < 0) return socket_would_block();
+    if (received == 0) {
+        direction.finished = true;
+        if (direction.start == direction.end) passOn(direction);
+        return true;
+    }
+
+    onData(direction.upstream, direction.buffer.data() + direction.end, size_t(received));
+    direction.end += size_t(received);
+    direction.drained = size_t(received) < room;
+    // The size classes grow fourfold, so a read that fills a whole buffer, or uses less than a quarter
+    // of it, steps one class up or down once the buffer is next empty.
+    if (size_t(received) == direction.buffer.capacity()) {
+        direction.capacity = std::min<size_t>(direction.capacity * 4, RELAY_BUFFER_MAX);
+    } else if (size_t(received) < direction.capacity / 4) {
+        direction.capacity = std::max<size_t>(direction.capacity / 4, RELAY_BUFFER_MIN);
+    }
+    std::chrono::milliseconds delay = rateLimit.charge(size_t(received));
+    if (delay.count() > 0) direction.resumeAt = std::chrono::steady_clock::now() + delay;
+    // Most of the time the destination takes the bytes straight away.
+    return flush(direction);
+}
+
+bool TunnelRelay::flush(Direction& direction) {
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    while (direction.start < direction.end) {
+        ssize_t sent = send(direction.to, direction.buffer.data() + direction.start, direction.end - direction.start, flags);
+        if (sent < 0) return socket_would_block();
+        direction.start += size_t(sent);
+    }
+
+    direction.start = direction.end = 0;
+    if (direction.finished && !direction.passedOn) passOn(direction);
+    // An idle tunnel holds no buffers.
+    if (direction.drained || direction.finished || direction.buffer.capacity() != direction.capacity) {
+        direction.buffer.release();
+    }
+    return true;
+}
+
+void TunnelRelay::passOn(Direction& direction) {
+    // The peer may already be gone, in which case there is nobody left to tell.
+    SHUTDOWN_SOCKET_WRITE(direction.to);
+    direction.passedOn = true;
+    direction.buffer.release();
+}
@@ -0,0 +1,107 @@
+#include "../include/work_pool.h"
+#include "../include/logger.h"
+
+static thread_local WorkStealingPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+WorkStealingPool::WorkStealingPool(int threads) {
+    if (threads <= 0) threads = std::max(2u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; i++) workers.emplace_back(new Worker());
+    for (size_t i = 0; i < workers.size(); i++) workers[i]->thread = std::thread(&WorkStealingPool::work, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto& worker : workers) worker->thread.join();
+
+    // Jobs never started are dropped; waiting futures see a broken promise.
+    for (auto& worker : workers) {
+        while (Job* job = worker->deque.pop()) delete job;
+    }
+    for (Job* job : injected) delete job;
+}
+
+WorkStealingPool& WorkStealingPool::instance() {
+    static WorkStealingPool pool(WORK_POOL_THREADS);
+    return pool;
+}
+
+bool WorkStealingPool::onWorker() {
+    return current_pool != nullptr;
+}
+
+// Jobs spawned by a worker stay on its own deque, where they are warm in its cache and other
+// workers steal them only when idle.
+void WorkStealingPool::submit(Job job) {
+    Job* owned = new Job(std::move(job));
+    queued.fetch_add(1, std::memory_order_seq_cst);
+    if (current_pool == this) {
+        workers[current_worker]->deque.push(owned);
+    } else {
+        std::lock_guard<std::mutex> lock(injected_mutex);
+        injected.push_back(owned);
+    }
+    wakeOne();
+}
+
+void WorkStealingPool::wakeOne() {
+    // Pairs with the sleeper publishing `sleeping` before checking `queued` once more.
+    if (sleeping.load(std::memory_order_seq_cst) == 0) return;
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    wakeup.notify_one();
+}
+
+WorkStealingPool::Job* WorkStealingPool::find(size_t index, uint32_t& seed) {
+    if (Job* job = workers[index]->deque.pop()) return job;
+    {
+        std::lock_guard<std::mutex> lock(injected_mutex);
+        if (!injected.empty()) {
+            Job* job = injected.front();
+            injected.pop_front();
+            return job;
+        }
+    }
+    // Victims are tried from a random start so idle workers do not all hammer the same deque.
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    size_t count = workers.size();
+    for (size_t i = 0; i < count; i++) {
+        size_t victim = (seed + i) % count;
+        if (victim == index) continue;
+        if (Job* job = workers[victim]->deque.steal()) return job;
+    }
+    return nullptr;
+}
+
+void WorkStealingPool::work(size_t index) {
+    current_pool = this;
+    current_worker = index;
+    uint32_t seed = uint32_t(index) * 2654435761u + 1;
+
+    while (true) {
+        Job* job = find(index, seed);
+        if (!job) {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleeping.fetch_add(1, std::memory_order_seq_cst);
+            wakeup.wait(lock, [this]() {
+                return stopping || queued.load(std::memory_order_seq_cst) > 0;
+            });
+            sleeping.fetch_sub(1, std::memory_order_seq_cst);
+            if (stopping) return;
+            continue;
+        }
+
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        std::unique_ptr<Job> owned(job);
+        try {
+            (*job)();
+        } catch (const std::exception& e) {
+            LOG_ERROR("(WorkStealingPool) Job failed: %s", e.what());
+        }
+    }
+}